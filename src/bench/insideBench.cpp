@@ -0,0 +1,102 @@
+//
+// Benchmark of the inside/outside test on a loaded STL.
+// Times the per-triangle scan against BVH::isInside and the batched
+// classifyPoints, and checks that all of them classify the same points.
+//
+// Usage: insideBench model.stl [points] [scale] [seed]
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "model.h"
+#include "rng.h"
+#include "utils.h"
+
+// Points are drawn in the bounding box grown by this fraction per side,
+// so part of them always lands outside the mesh
+#define BOX_MARGIN 0.05f
+
+static double secondsSince(const std::chrono::system_clock::time_point &start) {
+    std::chrono::duration<double> diff = std::chrono::system_clock::now() - start;
+    return diff.count();
+}
+
+// Counts the points where a and b disagree
+static size_t mismatches(const vector<uint8_t> &a, const vector<uint8_t> &b) {
+    size_t count = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i] != b[i]) count++;
+    }
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " model.stl [points] [scale] [seed]\n";
+        return 2;
+    }
+    string path = argv[1];
+    size_t n = argc > 2 ? size_t(atol(argv[2])) : 10000;
+    float scale = argc > 3 ? float(atof(argv[3])) : 1.0f;
+    Rng::seed(argc > 4 ? uint64_t(atoll(argv[4])) : 1);
+
+    model_data model = model_data();
+    Utils::createModelFromFile(path, scale, model.vertices, model.normals);
+    if (model.vertices.empty()) {
+        cout << "No triangles read from " << path << "\n";
+        return 2;
+    }
+    int modelEnd = int(model.vertices.size());
+    model.n_vertices = modelEnd;
+    model.n_triangles = modelEnd / 3;
+    model.n_models = 1;
+    model.model_indices = &modelEnd;
+    model.bounds = boundingBox<glm::vec3>(model.vertices);
+    cout << path << ": " << model.n_triangles << " triangles, " << n << " points\n";
+
+    glm::vec3 margin = BOX_MARGIN * (model.bounds.maxCorner - model.bounds.minCorner);
+    vector<glm::vec3> points = vector<glm::vec3>(n);
+    Rng::stream(0).fillPoints(model.bounds.minCorner - margin, model.bounds.maxCorner + margin, points.data(), n);
+
+    // Per-triangle scan, model_data::isInside without a hierarchy
+    vector<uint8_t> brute = vector<uint8_t>(n);
+    auto start = std::chrono::system_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        brute[i] = model.isInside(points[i], 0);
+    }
+    double bruteTime = secondsSince(start);
+
+    start = std::chrono::system_clock::now();
+    model.buildBVH();
+    double buildTime = secondsSince(start);
+
+    // One query at a time on the calling thread, same loop as the scan
+    vector<uint8_t> single = vector<uint8_t>(n);
+    start = std::chrono::system_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        single[i] = model.isInside(points[i], 0);
+    }
+    double singleTime = secondsSince(start);
+
+    vector<uint8_t> batched = vector<uint8_t>();
+    start = std::chrono::system_clock::now();
+    model.classifyPoints(points, batched);
+    double batchedTime = secondsSince(start);
+
+    size_t inside = 0;
+    for (uint8_t b : brute) inside += b;
+    size_t singleDiff = mismatches(brute, single);
+    size_t batchedDiff = mismatches(brute, batched);
+
+    cout << "  inside (scan):      " << inside << " of " << n << "\n";
+    cout << "  per-triangle scan:  " << bruteTime << " s\n";
+    cout << "  BVH build:          " << buildTime << " s\n";
+    cout << "  BVH isInside:       " << singleTime << " s (" << bruteTime / singleTime << "x)\n";
+    cout << "  BVH classifyPoints: " << batchedTime << " s (" << bruteTime / batchedTime << "x)\n";
+    cout << "  mismatches:         " << singleDiff << " isInside, " << batchedDiff << " classifyPoints\n";
+
+    return (singleDiff == 0 && batchedDiff == 0) ? 0 : 1;
+}
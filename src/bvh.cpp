@@ -0,0 +1,477 @@
+//
+// Bounding volume hierarchy over a triangle soup.
+//
+
+#include "bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+#include "cpuFeatures.h"
+
+#define BVH_STACK_SIZE 64
+#define RAY_EPSILON 1E-6f
+
+// Builds the hierarchy with a median split on the widest centroid axis
+// ------------------------------------------------------------
+void BVH::build(const glm::vec3 *triangles, size_t n_tris) {
+// ------------------------------------------------------------
+
+    clear();
+    if (n_tris == 0) return;
+
+    std::vector<glm::vec3> centroids(n_tris);
+    std::vector<glm::vec3> tmin(n_tris);
+    std::vector<glm::vec3> tmax(n_tris);
+    triIds.resize(n_tris);
+
+    for (size_t i = 0; i < n_tris; i++) {
+        const glm::vec3 &a = triangles[3 * i];
+        const glm::vec3 &b = triangles[3 * i + 1];
+        const glm::vec3 &c = triangles[3 * i + 2];
+        tmin[i] = glm::min(a, glm::min(b, c));
+        tmax[i] = glm::max(a, glm::max(b, c));
+        centroids[i] = (a + b + c) * (1.0f / 3.0f);
+        triIds[i] = uint32_t(i);
+    }
+
+    nodes.reserve(2 * (n_tris / LEAF_SIZE + 1));
+    buildNode(0, uint32_t(n_tris), centroids, tmin, tmax);
+
+    // Store triangles in leaf order so leaves are contiguous.
+    // Padded with zero triangles so a full leaf can always be loaded.
+    size_t padded = n_tris + LEAF_SIZE;
+    v0x.resize(padded); v0y.resize(padded); v0z.resize(padded);
+    e1x.resize(padded); e1y.resize(padded); e1z.resize(padded);
+    e2x.resize(padded); e2y.resize(padded); e2z.resize(padded);
+
+    for (size_t i = 0; i < n_tris; i++) {
+        const glm::vec3 &a = triangles[3 * triIds[i]];
+        glm::vec3 e1 = triangles[3 * triIds[i] + 1] - a;
+        glm::vec3 e2 = triangles[3 * triIds[i] + 2] - a;
+        v0x[i] = a.x; v0y[i] = a.y; v0z[i] = a.z;
+        e1x[i] = e1.x; e1y[i] = e1.y; e1z[i] = e1.z;
+        e2x[i] = e2.x; e2y[i] = e2.y; e2z[i] = e2.z;
+    }
+}
+
+// Recursively builds nodes over triIds[start, end), returns node index
+// ------------------------------------------------------------
+uint32_t BVH::buildNode(uint32_t start, uint32_t end,
+                        const std::vector<glm::vec3> &centroids,
+                        const std::vector<glm::vec3> &tmin,
+                        const std::vector<glm::vec3> &tmax) {
+// ------------------------------------------------------------
+
+    uint32_t index = uint32_t(nodes.size());
+    nodes.push_back(Node());
+
+    glm::vec3 bmin = glm::vec3(FLT_MAX);
+    glm::vec3 bmax = glm::vec3(-FLT_MAX);
+    glm::vec3 cmin = glm::vec3(FLT_MAX);
+    glm::vec3 cmax = glm::vec3(-FLT_MAX);
+
+    for (uint32_t i = start; i < end; i++) {
+        uint32_t t = triIds[i];
+        bmin = glm::min(bmin, tmin[t]);
+        bmax = glm::max(bmax, tmax[t]);
+        cmin = glm::min(cmin, centroids[t]);
+        cmax = glm::max(cmax, centroids[t]);
+    }
+
+    nodes[index].bmin = bmin;
+    nodes[index].bmax = bmax;
+
+    glm::vec3 extent = cmax - cmin;
+    int axis = 0;
+    if (extent.y > extent.x) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    // Leaves never hold more than LEAF_SIZE triangles, the leaf kernels rely on it
+    if (end - start <= LEAF_SIZE) {
+        nodes[index].first = start;
+        nodes[index].count = end - start;
+        return index;
+    }
+
+    // Coincident centroids (duplicate or degenerate facets) are split by index
+    uint32_t mid = start + (end - start) / 2;
+    if (extent[axis] > 0) {
+        std::nth_element(triIds.begin() + start, triIds.begin() + mid, triIds.begin() + end,
+                         [&centroids, axis](uint32_t a, uint32_t b) {
+                             return centroids[a][axis] < centroids[b][axis];
+                         });
+    }
+
+    // Left child immediately follows its parent
+    buildNode(start, mid, centroids, tmin, tmax);
+    uint32_t right = buildNode(mid, end, centroids, tmin, tmax);
+
+    nodes[index].first = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+// Frees all storage
+// ------------------------------------------------------------
+void BVH::clear() {
+// ------------------------------------------------------------
+    std::vector<Node>().swap(nodes);
+    std::vector<float>().swap(v0x); std::vector<float>().swap(v0y); std::vector<float>().swap(v0z);
+    std::vector<float>().swap(e1x); std::vector<float>().swap(e1y); std::vector<float>().swap(e1z);
+    std::vector<float>().swap(e2x); std::vector<float>().swap(e2y); std::vector<float>().swap(e2z);
+    std::vector<uint32_t>().swap(triIds);
+}
+
+// Slab test of a ray against a node's bounding box
+// ------------------------------------------------------------
+bool BVH::intersectBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &invDir) const {
+// ------------------------------------------------------------
+
+    glm::vec3 t0 = (node.bmin - origin) * invDir;
+    glm::vec3 t1 = (node.bmax - origin) * invDir;
+    glm::vec3 tnear = glm::min(t0, t1);
+    glm::vec3 tfar = glm::max(t0, t1);
+
+    float enter = std::max(std::max(tnear.x, tnear.y), std::max(tnear.z, 0.0f));
+    float exit = std::min(std::min(tfar.x, tfar.y), tfar.z);
+
+    return enter <= exit;
+}
+
+// Moller-Trumbore test of one triangle, sets t on a hit in front of the origin
+// ------------------------------------------------------------
+inline bool BVH::intersectTriangle(uint32_t i, const glm::vec3 &origin, const glm::vec3 &dir, float &t) const {
+// ------------------------------------------------------------
+
+    // pvec = dir x e2
+    float px = dir.y * e2z[i] - dir.z * e2y[i];
+    float py = dir.z * e2x[i] - dir.x * e2z[i];
+    float pz = dir.x * e2y[i] - dir.y * e2x[i];
+
+    float det = e1x[i] * px + e1y[i] * py + e1z[i] * pz;
+    if (fabs(det) < 1E-20f) return false; // Ray is parallel to the triangle
+    float invDet = 1.0f / det;
+
+    float tx = origin.x - v0x[i];
+    float ty = origin.y - v0y[i];
+    float tz = origin.z - v0z[i];
+
+    float u = (tx * px + ty * py + tz * pz) * invDet;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    // qvec = tvec x e1
+    float qx = ty * e1z[i] - tz * e1y[i];
+    float qy = tz * e1x[i] - tx * e1z[i];
+    float qz = tx * e1y[i] - ty * e1x[i];
+
+    float v = (dir.x * qx + dir.y * qy + dir.z * qz) * invDet;
+    if (v < 0.0f || u + v >= 1.0f) return false;
+
+    t = (e2x[i] * qx + e2y[i] * qy + e2z[i] * qz) * invDet;
+    return t > RAY_EPSILON;
+}
+
+// Tests the triangles of a leaf, returns a bit mask of hits and
+// writes the hit distances to ts. Eight lanes at once with AVX2.
+// ------------------------------------------------------------
+inline int BVH::intersectLeaf(uint32_t first, uint32_t count, const glm::vec3 &origin, const glm::vec3 &dir, float *ts) const {
+// ------------------------------------------------------------
+
+#ifdef DMLIDE_AVX2
+    if (CpuFeatures::avx2()) return intersectLeafAvx2(first, count, origin, dir, ts);
+#endif
+    int mask = 0;
+    for (uint32_t l = 0; l < count; l++) {
+        if (intersectTriangle(first + l, origin, dir, ts[l])) mask |= (1 << l);
+    }
+    return mask;
+}
+
+#ifdef DMLIDE_AVX2
+// Moller-Trumbore on the eight triangles from first, lanes past count are masked.
+// Relies on the LEAF_SIZE padding of the SoA arrays
+// ------------------------------------------------------------
+AVX2_TARGET
+int BVH::intersectLeafAvx2(uint32_t first, uint32_t count, const glm::vec3 &origin, const glm::vec3 &dir, float *ts) const {
+// ------------------------------------------------------------
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+    __m256 dx = _mm256_set1_ps(dir.x), dy = _mm256_set1_ps(dir.y), dz = _mm256_set1_ps(dir.z);
+
+    __m256 ax = _mm256_loadu_ps(&e1x[first]), ay = _mm256_loadu_ps(&e1y[first]), az = _mm256_loadu_ps(&e1z[first]);
+    __m256 bx = _mm256_loadu_ps(&e2x[first]), by = _mm256_loadu_ps(&e2y[first]), bz = _mm256_loadu_ps(&e2z[first]);
+
+    // pvec = dir x e2
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, bz), _mm256_mul_ps(dz, by));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, bx), _mm256_mul_ps(dx, bz));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, by), _mm256_mul_ps(dy, bx));
+
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, px), _mm256_mul_ps(ay, py)), _mm256_mul_ps(az, pz));
+    __m256 valid = _mm256_cmp_ps(_mm256_andnot_ps(signMask, det), _mm256_set1_ps(1E-20f), _CMP_GE_OQ);
+    __m256 invDet = _mm256_div_ps(one, det);
+
+    __m256 tx = _mm256_sub_ps(_mm256_set1_ps(origin.x), _mm256_loadu_ps(&v0x[first]));
+    __m256 ty = _mm256_sub_ps(_mm256_set1_ps(origin.y), _mm256_loadu_ps(&v0y[first]));
+    __m256 tz = _mm256_sub_ps(_mm256_set1_ps(origin.z), _mm256_loadu_ps(&v0z[first]));
+
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+
+    // qvec = tvec x e1
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, az), _mm256_mul_ps(tz, ay));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, ax), _mm256_mul_ps(tx, az));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, ay), _mm256_mul_ps(ty, ax));
+
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LT_OQ));
+
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(bx, qx), _mm256_mul_ps(by, qy)), _mm256_mul_ps(bz, qz)), invDet);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(RAY_EPSILON), _CMP_GT_OQ));
+
+    _mm256_storeu_ps(ts, t);
+    return _mm256_movemask_ps(valid) & ((1 << count) - 1);
+}
+#endif
+
+// Walks the nodes pierced by the ray and calls visit(t) for every
+// Moller-Trumbore hit with t > 0
+// ------------------------------------------------------------
+template <typename Visitor>
+void BVH::traceRay(const glm::vec3 &origin, const glm::vec3 &dir, Visitor visit) const {
+// ------------------------------------------------------------
+
+    if (nodes.empty()) return;
+
+    // Avoid infinities times zero in the slab test
+    glm::vec3 invDir;
+    for (int i = 0; i < 3; i++) {
+        float d = dir[i];
+        if (fabs(d) < 1E-12f) d = (d < 0) ? -1E-12f : 1E-12f;
+        invDir[i] = 1.0f / d;
+    }
+
+    uint32_t stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    float ts[LEAF_SIZE];
+
+    while (top > 0) {
+        const Node &node = nodes[stack[--top]];
+
+        if (!intersectBox(node, origin, invDir)) continue;
+
+        if (node.count == 0) {
+            uint32_t left = uint32_t(&node - &nodes[0]) + 1;
+            stack[top++] = node.first;
+            stack[top++] = left;
+            continue;
+        }
+
+        int mask = intersectLeaf(node.first, node.count, origin, dir, ts);
+        for (uint32_t l = 0; mask != 0; l++, mask >>= 1) {
+            if (mask & 1) visit(ts[l]);
+        }
+    }
+}
+
+// Counts triangle crossings along the ray
+// ------------------------------------------------------------
+int BVH::countCrossings(const glm::vec3 &origin, const glm::vec3 &dir) const {
+// ------------------------------------------------------------
+
+    int intersections = 0;
+    traceRay(origin, dir, [&intersections](float) { intersections++; });
+    return intersections;
+}
+
+// Collects the ray parameter of every crossing
+// ------------------------------------------------------------
+void BVH::rayHits(const glm::vec3 &origin, const glm::vec3 &dir, std::vector<float> &ts) const {
+// ------------------------------------------------------------
+    traceRay(origin, dir, [&ts](float t) { ts.push_back(t); });
+}
+
+// Sorts the crossings of one ray along the row and walks the points with a
+// parity counter. Crossings closer than the tolerance are merged, rays through
+// an edge shared by two triangles report the same crossing twice
+// ------------------------------------------------------------
+bool BVH::insideRow(float y, float z, const std::vector<float> &xs, uint8_t *inside) const {
+// ------------------------------------------------------------
+
+    if (nodes.empty() || xs.empty()) return false;
+
+    // Ray starts before the root box so t = 0 is outside the mesh
+    glm::vec3 extent = nodes[0].bmax - nodes[0].bmin;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+    float startX = std::min(nodes[0].bmin.x, xs.front()) - 0.1f * size - 1.0f;
+    float tolerance = 1E-5f * (size + 1.0f);
+
+    std::vector<float> ts = std::vector<float>();
+    traceRay(glm::vec3(startX, y, z), glm::vec3(1, 0, 0), [&ts](float t) { ts.push_back(t); });
+    std::sort(ts.begin(), ts.end());
+
+    size_t n = 0;
+    for (size_t i = 0; i < ts.size(); i++) {
+        if (n > 0 && ts[i] - ts[n - 1] < tolerance) continue;
+        ts[n++] = ts[i];
+    }
+    ts.resize(n);
+    if (n % 2 == 1) return false;
+
+    size_t crossed = 0;
+    for (size_t i = 0; i < xs.size(); i++) {
+        float t = xs[i] - startX;
+        while (crossed < n && ts[crossed] < t) crossed++;
+        if ((crossed < n && ts[crossed] - t < tolerance)
+            || (crossed > 0 && t - ts[crossed - 1] < tolerance)) {
+            return false;
+        }
+        inside[i] = uint8_t(crossed % 2);
+    }
+    return true;
+}
+
+// Squared distance from p to triangle i, closest point by Voronoi region
+// (Ericson, Real-Time Collision Detection 5.1.5)
+// ------------------------------------------------------------
+float BVH::distanceSquared(uint32_t i, const glm::vec3 &p) const {
+// ------------------------------------------------------------
+
+    glm::vec3 a = glm::vec3(v0x[i], v0y[i], v0z[i]);
+    glm::vec3 ab = glm::vec3(e1x[i], e1y[i], e1z[i]);
+    glm::vec3 ac = glm::vec3(e2x[i], e2y[i], e2z[i]);
+    glm::vec3 ap = p - a;
+    glm::vec3 closest;
+
+    float d1 = glm::dot(ab, ap);
+    float d2 = glm::dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) {
+        closest = a;
+    } else {
+        glm::vec3 bp = ap - ab;
+        float d3 = glm::dot(ab, bp);
+        float d4 = glm::dot(ac, bp);
+
+        glm::vec3 cp = ap - ac;
+        float d5 = glm::dot(ab, cp);
+        float d6 = glm::dot(ac, cp);
+
+        float vc = d1 * d4 - d3 * d2;
+        float vb = d5 * d2 - d1 * d6;
+        float va = d3 * d6 - d5 * d4;
+
+        if (d3 >= 0 && d4 <= d3) {
+            closest = a + ab; // Vertex b
+        } else if (d6 >= 0 && d5 <= d6) {
+            closest = a + ac; // Vertex c
+        } else if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+            closest = a + ab * (d1 / (d1 - d3)); // Edge ab
+        } else if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+            closest = a + ac * (d2 / (d2 - d6)); // Edge ac
+        } else if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {
+            closest = a + ab + (ac - ab) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))); // Edge bc
+        } else {
+            float denom = 1.0f / (va + vb + vc);
+            closest = a + ab * (vb * denom) + ac * (vc * denom); // Face interior
+        }
+    }
+
+    glm::vec3 d = p - closest;
+    return glm::dot(d, d);
+}
+
+// Descends into nodes whose box is within r, stops at the first
+// triangle closer than r
+// ------------------------------------------------------------
+bool BVH::withinDistance(const glm::vec3 &point, float r) const {
+// ------------------------------------------------------------
+
+    if (nodes.empty()) return false;
+
+    float r2 = r * r;
+    uint32_t stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const Node &node = nodes[stack[--top]];
+
+        // Squared distance from the point to the box
+        glm::vec3 d = glm::max(node.bmin - point, glm::max(glm::vec3(0.0f), point - node.bmax));
+        if (glm::dot(d, d) > r2) continue;
+
+        if (node.count == 0) {
+            uint32_t left = uint32_t(&node - &nodes[0]) + 1;
+            stack[top++] = node.first;
+            stack[top++] = left;
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+            if (distanceSquared(i, point) <= r2) return true;
+        }
+    }
+
+    return false;
+}
+
+// Returns the vertices of triangle i in leaf order
+// ------------------------------------------------------------
+void BVH::triangle(size_t i, glm::vec3 &a, glm::vec3 &b, glm::vec3 &c) const {
+// ------------------------------------------------------------
+    a = glm::vec3(v0x[i], v0y[i], v0z[i]);
+    b = a + glm::vec3(e1x[i], e1y[i], e1z[i]);
+    c = a + glm::vec3(e2x[i], e2y[i], e2z[i]);
+}
+
+// Every node is reached once from the root within the traversal stack,
+// leaves stay inside the triangles and the SoA arrays hold the padding
+// ------------------------------------------------------------
+bool BVH::valid() const {
+// ------------------------------------------------------------
+    size_t n = triIds.size();
+    if (n == 0) {
+        return nodes.empty() && v0x.empty() && v0y.empty() && v0z.empty() && e1x.empty() && e1y.empty()
+               && e1z.empty() && e2x.empty() && e2y.empty() && e2z.empty();
+    }
+    if (nodes.empty() || n >= UINT32_MAX) return false;
+
+    size_t padded = n + LEAF_SIZE;
+    const std::vector<float> *arrays[] = {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z};
+    for (const std::vector<float> *a : arrays) {
+        if (a->size() != padded) return false;
+    }
+    for (uint32_t t : triIds) {
+        if (t >= n) return false;
+    }
+
+    std::vector<uint8_t> reached(nodes.size(), 0);
+    std::vector<std::pair<uint32_t, uint32_t>> pending; // Node and depth
+    pending.emplace_back(0, 0);
+    size_t visited = 0;
+    while (!pending.empty()) {
+        uint32_t i = pending.back().first, depth = pending.back().second;
+        pending.pop_back();
+        if (reached[i] || depth >= BVH_STACK_SIZE - 1) return false;
+        reached[i] = 1;
+        visited++;
+
+        const Node &node = nodes[i];
+        if (node.count == 0) {
+            // Left child follows its parent, the right one follows the left subtree
+            if (uint64_t(i) + 1 >= nodes.size() || node.first <= i + 1 || node.first >= nodes.size()) return false;
+            pending.emplace_back(i + 1, depth + 1);
+            pending.emplace_back(node.first, depth + 1);
+        } else if (node.count > LEAF_SIZE || uint64_t(node.first) + node.count > n) {
+            return false;
+        }
+    }
+    return visited == nodes.size();
+}
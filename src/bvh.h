@@ -0,0 +1,101 @@
+//
+// Bounding volume hierarchy over a triangle soup.
+// Used to accelerate point-in-mesh queries on loaded volumes.
+//
+
+#ifndef DMLIDE_BVH_H
+#define DMLIDE_BVH_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class BVH {
+
+public:
+    BVH() = default;
+
+    // Builds the hierarchy over n_tris triangles stored as
+    // consecutive vertex triples (the layout used by model_data)
+    void build(const glm::vec3 *triangles, size_t n_tris);
+    void clear();
+
+    bool empty() const { return nodes.empty(); }
+    size_t triangleCount() const { return triIds.size(); }
+    size_t nodeCount() const { return nodes.size(); }
+
+    // Number of triangles crossed by the ray origin + t * dir, t > 0
+    int countCrossings(const glm::vec3 &origin, const glm::vec3 &dir) const;
+
+    // Ray parity test, dir should not be aligned with mesh features
+    bool isInside(const glm::vec3 &point, const glm::vec3 &dir) const {
+        return (countCrossings(point, dir) % 2 == 1);
+    }
+
+    // True if some triangle lies within distance r of point
+    bool withinDistance(const glm::vec3 &point, float r) const;
+
+    // Appends the ray parameter t of every crossing to ts (unsorted)
+    void rayHits(const glm::vec3 &origin, const glm::vec3 &dir, std::vector<float> &ts) const;
+
+    // Parity test for the points (xs[i], y, z) of one row with a single +x ray,
+    // xs ascending. Sets inside[i] for every xs[i]. False when the row is
+    // ambiguous, an odd number of crossings or a crossing on one of the points,
+    // and the points need isInside with a random direction instead
+    bool insideRow(float y, float z, const std::vector<float> &xs, uint8_t *inside) const;
+
+    // Triangle i in leaf order
+    void triangle(size_t i, glm::vec3 &a, glm::vec3 &b, glm::vec3 &c) const;
+
+    // Checks the arrays and the node tree are consistent and in bounds,
+    // for hierarchies restored by serialize()
+    bool valid() const;
+
+    // Visits every array of the hierarchy with ar(vector), used to
+    // store and restore built hierarchies (see MeshCache)
+    template <class Archive>
+    void serialize(Archive &ar) {
+        ar(nodes);
+        ar(v0x); ar(v0y); ar(v0z);
+        ar(e1x); ar(e1y); ar(e1z);
+        ar(e2x); ar(e2y); ar(e2z);
+        ar(triIds);
+    }
+
+    // Leaves hold up to one AVX2 register of triangles
+    static const uint32_t LEAF_SIZE = 8;
+
+private:
+    struct Node {
+        glm::vec3 bmin;
+        glm::vec3 bmax;
+        uint32_t first; // First triangle for leaves, right child for inner nodes
+        uint32_t count; // Triangle count for leaves, 0 for inner nodes
+    };
+
+    uint32_t buildNode(uint32_t start, uint32_t end,
+                       const std::vector<glm::vec3> &centroids,
+                       const std::vector<glm::vec3> &tmin,
+                       const std::vector<glm::vec3> &tmax);
+
+    bool intersectBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &invDir) const;
+
+    template <typename Visitor>
+    void traceRay(const glm::vec3 &origin, const glm::vec3 &dir, Visitor visit) const;
+
+    float distanceSquared(uint32_t i, const glm::vec3 &p) const;
+    bool intersectTriangle(uint32_t i, const glm::vec3 &origin, const glm::vec3 &dir, float &t) const;
+    int intersectLeaf(uint32_t first, uint32_t count, const glm::vec3 &origin, const glm::vec3 &dir, float *ts) const;
+    int intersectLeafAvx2(uint32_t first, uint32_t count, const glm::vec3 &origin, const glm::vec3 &dir, float *ts) const;
+
+    std::vector<Node> nodes;
+
+    // Triangles in leaf order: first vertex and two edges, SoA
+    std::vector<float> v0x, v0y, v0z;
+    std::vector<float> e1x, e1y, e1z;
+    std::vector<float> e2x, e2y, e2z;
+    std::vector<uint32_t> triIds; // Leaf order to input triangle index
+};
+
+#endif //DMLIDE_BVH_H
@@ -0,0 +1,479 @@
+//
+// Host backend for a Titan simulation.
+//
+
+#include "cpuBackend.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+#include <QDebug>
+
+// Stiffness of the penalty force pushing masses back out of contact planes, per unit mass
+#define PLANE_STIFFNESS 1E5
+
+// Velocities below this slide without kinetic friction
+#define FRICTION_EPSILON 1E-12
+
+// Spring::_type values written by Loader::applyLoadcase for sin, expand_sin
+// and contract_sin actuations. Type 3 is an actuation with no wave
+static bool isActuated(int type) {
+    return type == 1 || type == 2 || type == 4 || type == 5;
+}
+
+// ------------------------------------------------------------
+CpuBackend::CpuBackend(Simulation *sim) : SimBackend(sim) {
+// ------------------------------------------------------------
+}
+
+// ------------------------------------------------------------
+bool CpuBackend::start() {
+// ------------------------------------------------------------
+    T = 0;
+    setAll();
+    qDebug() << "CPU backend with" << massRecords.size() << "masses and" << springRecords.size() << "springs";
+
+    size_t actuatedSprings = actuatedCount();
+    if (actuatedSprings > 0) {
+        qCritical() << "CPU backend cannot run" << actuatedSprings << "actuated springs, use --backend titan";
+        return false;
+    }
+    return true;
+}
+
+// Springs with an actuation wave. Rest length modulation is not implemented
+// on the host, such simulations are refused rather than run passively
+// ------------------------------------------------------------
+size_t CpuBackend::actuatedCount() const {
+// ------------------------------------------------------------
+    return size_t(std::count(actuated.begin(), actuated.end(), uint8_t(1)));
+}
+
+// Masses and springs created or deleted on the host since the last upload.
+// Single record transfers only compare the counts
+// ------------------------------------------------------------
+bool CpuBackend::topologyChanged(bool thorough) const {
+// ------------------------------------------------------------
+    if (sim->masses.size() != massRecords.size() || sim->springs.size() != springRecords.size()) return true;
+    return thorough && (sim->masses != massRecords || sim->springs != springRecords);
+}
+
+// ------------------------------------------------------------
+void CpuBackend::readMass(size_t i, const Mass *m) {
+// ------------------------------------------------------------
+    pos.set(i, m->pos);
+    vel.set(i, m->vel);
+    acc.set(i, m->acc);
+    extForce.set(i, m->extforce);
+    origPos.set(i, m->origpos);
+    mass[i] = m->m;
+    damping[i] = m->damping;
+    extDuration[i] = m->extduration;
+    massDt[i] = m->dt;
+    fixed[i] = m->constraints.fixed ? 1 : 0;
+    invMass[i] = (fixed[i] || m->m <= 0) ? 0.0 : 1.0 / m->m;
+}
+
+// Force is computed, not uploaded. Titan clears it every step
+// ------------------------------------------------------------
+void CpuBackend::writeMass(size_t i, Mass *m) const {
+// ------------------------------------------------------------
+    m->pos = pos.get(i);
+    m->vel = vel.get(i);
+    m->acc = acc.get(i);
+    m->force = force.get(i);
+}
+
+// ------------------------------------------------------------
+void CpuBackend::readSpring(size_t i, const Spring *s) {
+// ------------------------------------------------------------
+    auto found = massIndex.find(s->_left);
+    left[i] = (found != massIndex.end()) ? int64_t(found->second) : -1;
+    found = massIndex.find(s->_right);
+    right[i] = (found != massIndex.end()) ? int64_t(found->second) : -1;
+    k[i] = s->_k;
+    rest[i] = s->_rest;
+    breakForce[i] = s->_break_force;
+    currForce[i] = s->_curr_force;
+    maxStress[i] = s->_max_stress;
+    broken[i] = s->_broken ? 1 : 0;
+    actuated[i] = isActuated(s->_type) ? 1 : 0;
+}
+
+// ------------------------------------------------------------
+void CpuBackend::writeSpring(size_t i, Spring *s) const {
+// ------------------------------------------------------------
+    s->_curr_force = currForce[i];
+    s->_max_stress = maxStress[i];
+    s->_broken = broken[i] != 0;
+}
+
+// Resizes the arrays to the host lists. Records already simulated keep
+// their state, new ones are read from the host
+// ------------------------------------------------------------
+void CpuBackend::rebuild() {
+// ------------------------------------------------------------
+    CpuBackend old = std::move(*this);
+
+    massRecords = sim->masses;
+    size_t nm = massRecords.size();
+    massIndex.clear();
+    massIndex.reserve(nm);
+    pos.resize(nm);
+    vel.resize(nm);
+    acc.resize(nm);
+    force.resize(nm);
+    extForce.resize(nm);
+    origPos.resize(nm);
+    invMass.resize(nm);
+    mass.resize(nm);
+    damping.resize(nm);
+    extDuration.resize(nm);
+    massDt.resize(nm);
+    fixed.resize(nm);
+
+    for (size_t i = 0; i < nm; i++) {
+        Mass *m = massRecords[i];
+        massIndex.emplace(m, uint32_t(i));
+        auto found = old.massIndex.find(m);
+        if (found == old.massIndex.end()) {
+            readMass(i, m);
+            force.set(i, Vec(0, 0, 0));
+            continue;
+        }
+        size_t j = found->second;
+        pos.set(i, old.pos.get(j));
+        vel.set(i, old.vel.get(j));
+        acc.set(i, old.acc.get(j));
+        force.set(i, old.force.get(j));
+        extForce.set(i, old.extForce.get(j));
+        origPos.set(i, old.origPos.get(j));
+        invMass[i] = old.invMass[j];
+        mass[i] = old.mass[j];
+        damping[i] = old.damping[j];
+        extDuration[i] = old.extDuration[j];
+        massDt[i] = old.massDt[j];
+        fixed[i] = old.fixed[j];
+    }
+
+    springRecords = sim->springs;
+    size_t ns = springRecords.size();
+    springIndex.clear();
+    springIndex.reserve(ns);
+    left.resize(ns);
+    right.resize(ns);
+    k.resize(ns);
+    rest.resize(ns);
+    breakForce.resize(ns);
+    currForce.resize(ns);
+    maxStress.resize(ns);
+    broken.resize(ns);
+    actuated.resize(ns);
+    springForce.resize(ns);
+
+    for (size_t i = 0; i < ns; i++) {
+        Spring *s = springRecords[i];
+        springIndex.emplace(s, uint32_t(i));
+        auto found = old.springIndex.find(s);
+        if (found == old.springIndex.end()) {
+            readSpring(i, s);
+            continue;
+        }
+        size_t j = found->second;
+        auto remap = [&](int64_t e) -> int64_t {
+            if (e < 0) return -1;
+            auto kept = massIndex.find(old.massRecords[e]);
+            return (kept != massIndex.end()) ? int64_t(kept->second) : -1;
+        };
+        left[i] = remap(old.left[j]);
+        right[i] = remap(old.right[j]);
+        k[i] = old.k[j];
+        rest[i] = old.rest[j];
+        breakForce[i] = old.breakForce[j];
+        currForce[i] = old.currForce[j];
+        maxStress[i] = old.maxStress[j];
+        broken[i] = old.broken[j];
+        actuated[i] = old.actuated[j];
+    }
+
+    T = old.T;
+    global = sim->global;
+    planes.clear();
+    for (ContactPlane *c : sim->planes) {
+        planes.push_back(Plane{c->_normal, c->_offset, c->_FRICTION_K});
+    }
+    dt = DBL_MAX;
+    for (double d : massDt) dt = std::min(dt, d);
+    if (massDt.empty()) dt = 0;
+    adjacencyDirty = true;
+}
+
+// Counting sort of the spring ends by mass
+// ------------------------------------------------------------
+void CpuBackend::buildAdjacency() {
+// ------------------------------------------------------------
+    size_t nm = massRecords.size(), ns = springRecords.size();
+    adjacencyStart.assign(nm + 1, 0);
+    for (size_t s = 0; s < ns; s++) {
+        if (left[s] >= 0) adjacencyStart[left[s] + 1]++;
+        if (right[s] >= 0) adjacencyStart[right[s] + 1]++;
+    }
+    for (size_t i = 0; i < nm; i++) {
+        adjacencyStart[i + 1] += adjacencyStart[i];
+    }
+    adjacency.resize(adjacencyStart[nm]);
+    std::vector<uint32_t> fill = std::vector<uint32_t>(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t s = 0; s < ns; s++) {
+        if (left[s] >= 0) adjacency[fill[left[s]]++] = uint32_t(2 * s);
+        if (right[s] >= 0) adjacency[fill[right[s]]++] = uint32_t(2 * s + 1);
+    }
+    adjacencyDirty = false;
+}
+
+// ------------------------------------------------------------
+void CpuBackend::setAll() {
+// ------------------------------------------------------------
+    massRecords.clear();
+    springRecords.clear();
+    massIndex.clear();
+    springIndex.clear();
+    rebuild();
+}
+
+// ------------------------------------------------------------
+void CpuBackend::getAll() {
+// ------------------------------------------------------------
+    if (topologyChanged(true)) rebuild();
+    long nm = long(massRecords.size());
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < nm; i++) {
+        writeMass(size_t(i), massRecords[i]);
+    }
+    long ns = long(springRecords.size());
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < ns; i++) {
+        writeSpring(size_t(i), springRecords[i]);
+    }
+}
+
+// ------------------------------------------------------------
+void CpuBackend::get(Mass *m) {
+// ------------------------------------------------------------
+    if (topologyChanged(false)) rebuild();
+    auto found = massIndex.find(m);
+    if (found != massIndex.end()) writeMass(found->second, m);
+}
+
+// ------------------------------------------------------------
+void CpuBackend::set(Mass *m) {
+// ------------------------------------------------------------
+    if (topologyChanged(false)) rebuild();
+    auto found = massIndex.find(m);
+    if (found == massIndex.end()) return;
+    readMass(found->second, m);
+    dt = std::min(dt, m->dt);
+}
+
+// ------------------------------------------------------------
+void CpuBackend::set(Spring *s) {
+// ------------------------------------------------------------
+    if (topologyChanged(false)) rebuild();
+    auto found = springIndex.find(s);
+    if (found == springIndex.end()) return;
+    size_t i = found->second;
+    int64_t l = left[i], r = right[i];
+    readSpring(i, s);
+    if (left[i] != l || right[i] != r) adjacencyDirty = true;
+}
+
+// Hooke's law per spring, the force on its right mass. Broken springs and
+// springs with a mass outside the simulation carry no force
+// ------------------------------------------------------------
+void CpuBackend::springForces() {
+// ------------------------------------------------------------
+    long ns = long(springRecords.size());
+
+    #pragma omp parallel for schedule(static)
+    for (long s = 0; s < ns; s++) {
+        int64_t l = left[s], r = right[s];
+        if (broken[s] || l < 0 || r < 0) {
+            springForce.x[s] = springForce.y[s] = springForce.z[s] = 0;
+            currForce[s] = 0;
+            continue;
+        }
+        double dx = pos.x[r] - pos.x[l];
+        double dy = pos.y[r] - pos.y[l];
+        double dz = pos.z[r] - pos.z[l];
+        double length = std::sqrt(dx * dx + dy * dy + dz * dz);
+        double tension = k[s] * (length - rest[s]);
+        double scale = (length > 0) ? -tension / length : 0.0;
+
+        springForce.x[s] = scale * dx;
+        springForce.y[s] = scale * dy;
+        springForce.z[s] = scale * dz;
+        currForce[s] = tension;
+        maxStress[s] = std::max(maxStress[s], std::fabs(tension));
+        if (breakForce[s] > 0 && std::fabs(tension) > breakForce[s]) broken[s] = 1;
+    }
+}
+
+// Semi-implicit Euler over the arrays. Masses gather their spring forces
+// through the adjacency, then add gravity, external loads and plane contacts.
+// Fixed masses have zero inverse mass and keep their position
+// ------------------------------------------------------------
+void CpuBackend::integrate() {
+// ------------------------------------------------------------
+    long nm = long(massRecords.size());
+    const double gx = global[0], gy = global[1], gz = global[2];
+    const size_t np = planes.size();
+
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < nm; i++) {
+        double fx = 0, fy = 0, fz = 0;
+        for (uint32_t a = adjacencyStart[i]; a < adjacencyStart[i + 1]; a++) {
+            uint32_t e = adjacency[a];
+            double sign = (e & 1) ? 1.0 : -1.0;
+            fx += sign * springForce.x[e >> 1];
+            fy += sign * springForce.y[e >> 1];
+            fz += sign * springForce.z[e >> 1];
+        }
+        force.x[i] = fx;
+        force.y[i] = fy;
+        force.z[i] = fz;
+    }
+
+    #pragma omp parallel for simd schedule(static)
+    for (long i = 0; i < nm; i++) {
+        double loaded = (T < extDuration[i]) ? 1.0 : 0.0;
+        double fx = force.x[i] + mass[i] * gx + loaded * extForce.x[i];
+        double fy = force.y[i] + mass[i] * gy + loaded * extForce.y[i];
+        double fz = force.z[i] + mass[i] * gz + loaded * extForce.z[i];
+
+        for (size_t p = 0; p < np; p++) {
+            const Plane &plane = planes[p];
+            double depth = plane.offset - (pos.x[i] * plane.normal[0] + pos.y[i] * plane.normal[1]
+                                           + pos.z[i] * plane.normal[2]);
+            double push = (depth > 0) ? depth * PLANE_STIFFNESS * mass[i] : 0.0;
+            double vn = vel.x[i] * plane.normal[0] + vel.y[i] * plane.normal[1] + vel.z[i] * plane.normal[2];
+            double tx = vel.x[i] - vn * plane.normal[0];
+            double ty = vel.y[i] - vn * plane.normal[1];
+            double tz = vel.z[i] - vn * plane.normal[2];
+            double tangential = std::sqrt(tx * tx + ty * ty + tz * tz);
+            double slide = (tangential > FRICTION_EPSILON) ? plane.friction * push / tangential : 0.0;
+            fx += push * plane.normal[0] - slide * tx;
+            fy += push * plane.normal[1] - slide * ty;
+            fz += push * plane.normal[2] - slide * tz;
+        }
+
+        force.x[i] = fx;
+        force.y[i] = fy;
+        force.z[i] = fz;
+
+        double live = fixed[i] ? 0.0 : 1.0;
+        acc.x[i] = fx * invMass[i];
+        acc.y[i] = fy * invMass[i];
+        acc.z[i] = fz * invMass[i];
+        vel.x[i] += live * ((vel.x[i] + acc.x[i] * dt) * damping[i] - vel.x[i]);
+        vel.y[i] += live * ((vel.y[i] + acc.y[i] * dt) * damping[i] - vel.y[i]);
+        vel.z[i] += live * ((vel.z[i] + acc.z[i] * dt) * damping[i] - vel.z[i]);
+        pos.x[i] += live * vel.x[i] * dt;
+        pos.y[i] += live * vel.y[i] * dt;
+        pos.z[i] += live * vel.z[i] * dt;
+    }
+    T += dt;
+}
+
+// ------------------------------------------------------------
+void CpuBackend::step(double duration) {
+// ------------------------------------------------------------
+    if (topologyChanged(true)) rebuild();
+    if (adjacencyDirty) buildAdjacency();
+    if (!(dt > 0)) return;
+
+    // Actuations applied after start(), by a later loadcase
+    if (actuatedCount() > 0) {
+        qFatal("CPU backend cannot run actuated springs, use --backend titan");
+    }
+
+    long steps = std::max(1L, long(std::round(duration / dt)));
+    for (long n = 0; n < steps; n++) {
+        springForces();
+        integrate();
+    }
+}
+
+// Springs and masses are reduced in one parallel region, the spring loop
+// also tracks the largest force per thread
+// ------------------------------------------------------------
+void CpuBackend::reduceMetrics(const std::vector<Mass *> &deflectionMasses, StepMetrics &metrics) {
+// ------------------------------------------------------------
+    if (topologyChanged(true)) rebuild();
+    metrics = StepMetrics();
+
+    std::vector<long> loaded;
+    for (Mass *m : deflectionMasses) {
+        auto found = massIndex.find(m);
+        if (found != massIndex.end()) loaded.push_back(long(found->second));
+    }
+
+    long ns = long(springRecords.size());
+    long nm = long(massRecords.size());
+    double totalLength = 0, totalEnergy = 0, kineticEnergy = 0, deflection = 0;
+    Vec ref = nm ? pos.get(0) : Vec(0, 0, 0);
+    Vec origRef = nm ? origPos.get(0) : Vec(0, 0, 0);
+
+    #pragma omp parallel reduction(+:totalLength, totalEnergy, kineticEnergy, deflection)
+    {
+        double maxForce = 0;
+        long maxForceSpring = -1;
+
+        #pragma omp for schedule(static) nowait
+        for (long s = 0; s < ns; s++) {
+            if (k[s] == 0) continue;
+            double f = currForce[s];
+            totalLength += rest[s];
+            totalEnergy += f * f / k[s];
+            if (maxForce < fabs(f)) {
+                maxForce = fabs(f);
+                maxForceSpring = s;
+            }
+        }
+
+        #pragma omp for simd schedule(static) nowait
+        for (long i = 0; i < nm; i++) {
+            double vx = vel.x[i], vy = vel.y[i], vz = vel.z[i];
+            kineticEnergy += 0.5 * mass[i] * (vx * vx + vy * vy + vz * vz);
+        }
+
+        if (loaded.empty()) {
+            #pragma omp for simd schedule(static) nowait
+            for (long i = 0; i < nm; i++) {
+                double ox = origPos.x[i] - origRef[0], oy = origPos.y[i] - origRef[1], oz = origPos.z[i] - origRef[2];
+                double px = pos.x[i] - ref[0], py = pos.y[i] - ref[1], pz = pos.z[i] - ref[2];
+                deflection += fabs(sqrt(px * px + py * py + pz * pz) - sqrt(ox * ox + oy * oy + oz * oz));
+            }
+        }
+
+        #pragma omp critical
+        if (maxForceSpring >= 0 && (metrics.maxForce < maxForce
+                || (metrics.maxForce == maxForce && maxForceSpring < metrics.maxForceSpring))) {
+            metrics.maxForce = maxForce;
+            metrics.maxForceSpring = maxForceSpring;
+        }
+    }
+
+    if (!deflectionMasses.empty()) {
+        for (long i : loaded) {
+            double dx = origPos.x[i] - pos.x[i], dy = origPos.y[i] - pos.y[i], dz = origPos.z[i] - pos.z[i];
+            deflection += sqrt(dx * dx + dy * dy + dz * dz);
+        }
+        deflection /= deflectionMasses.size();
+    }
+
+    metrics.totalLength = totalLength;
+    metrics.totalEnergy = totalEnergy;
+    metrics.kineticEnergy = kineticEnergy;
+    metrics.deflection = deflection;
+}
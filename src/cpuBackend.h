@@ -0,0 +1,89 @@
+//
+// Host backend for a Titan simulation.
+// Masses and springs are kept as structure of arrays, spring forces are
+// computed per spring and gathered per mass, both in parallel without atomics.
+//
+
+#ifndef DMLIDE_CPUBACKEND_H
+#define DMLIDE_CPUBACKEND_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "simBackend.h"
+
+class CpuBackend : public SimBackend {
+
+public:
+    explicit CpuBackend(Simulation *sim);
+
+    bool start() override;
+    void step(double duration) override;
+    double time() override { return T; }
+    bool running() override { return false; } // Steps return when done
+    void pause(double t) override {}
+
+    void getAll() override;
+    void setAll() override;
+    void get(Mass *m) override;
+    void set(Mass *m) override;
+    void set(Spring *s) override;
+
+    // Reduces over the backend arrays, the host records are not read
+    void reduceMetrics(const std::vector<Mass *> &deflectionMasses, StepMetrics &metrics) override;
+
+private:
+    struct Vec3Array {
+        std::vector<double> x, y, z;
+        void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+        void set(size_t i, const Vec &v) { x[i] = v[0]; y[i] = v[1]; z[i] = v[2]; }
+        Vec get(size_t i) const { return Vec(x[i], y[i], z[i]); }
+    };
+
+    struct Plane {
+        Vec normal;
+        double offset;
+        double friction;
+    };
+
+    bool topologyChanged(bool thorough) const;
+    void rebuild();
+    void readMass(size_t i, const Mass *m);
+    void writeMass(size_t i, Mass *m) const;
+    void readSpring(size_t i, const Spring *s);
+    void writeSpring(size_t i, Spring *s) const;
+    void buildAdjacency();
+    size_t actuatedCount() const;
+
+    void springForces();
+    void integrate();
+
+    double T = 0;
+    double dt = 0; // Smallest mass timestep, one integration step
+    Vec global;
+    std::vector<Plane> planes;
+
+    // Masses in sim->masses order
+    std::vector<Mass *> massRecords;
+    std::unordered_map<Mass *, uint32_t> massIndex;
+    Vec3Array pos, vel, acc, force, extForce, origPos;
+    std::vector<double> invMass, mass, damping, extDuration, massDt;
+    std::vector<uint8_t> fixed;
+
+    // Springs in sim->springs order
+    std::vector<Spring *> springRecords;
+    std::unordered_map<Spring *, uint32_t> springIndex;
+    std::vector<int64_t> left, right; // Mass indices, -1 when the mass is not simulated
+    std::vector<double> k, rest, breakForce, currForce, maxStress;
+    std::vector<uint8_t> broken;
+    std::vector<uint8_t> actuated; // See actuatedCount()
+    Vec3Array springForce; // On the right mass, the left one gets the opposite
+
+    // Springs per mass as 2 * spring + 1 for the right end, 2 * spring for the left
+    std::vector<uint32_t> adjacencyStart;
+    std::vector<uint32_t> adjacency;
+    bool adjacencyDirty = true;
+};
+
+#endif //DMLIDE_CPUBACKEND_H
@@ -0,0 +1,29 @@
+//
+// Instruction set extensions picked at runtime.
+// AVX2 kernels are compiled with a function target attribute instead of
+// -mavx2, so the rest of the binary still runs on CPUs without AVX2.
+//
+
+#ifndef DMLIDE_CPUFEATURES_H
+#define DMLIDE_CPUFEATURES_H
+
+#if defined(USE_AVX2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DMLIDE_AVX2 1
+#define AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+namespace CpuFeatures {
+
+    // True when the AVX2 kernels are compiled in and the CPU supports them
+    inline bool avx2() {
+#ifdef DMLIDE_AVX2
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+#else
+        return false;
+#endif
+    }
+}
+
+#endif //DMLIDE_CPUFEATURES_H
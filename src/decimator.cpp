@@ -0,0 +1,352 @@
+//
+// Edge collapse mesh simplification driven by quadric error metrics.
+//
+
+#include "decimator.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Boundary edges are held in place by planes through the edge,
+// perpendicular to its triangle, weighted by this factor
+#define BOUNDARY_WEIGHT 100.0
+
+// Minimum cosine between a triangle normal before and after a collapse
+#define MIN_NORMAL_DOT 0.2
+
+// Adds plane n.p + d = 0 (n unit length) with weight w
+// ------------------------------------------------------------
+void Decimator::Quadric::addPlane(const Vec &n, double d, double w) {
+// ------------------------------------------------------------
+    a2 += w * n[0] * n[0]; ab += w * n[0] * n[1]; ac += w * n[0] * n[2]; ad += w * n[0] * d;
+    b2 += w * n[1] * n[1]; bc += w * n[1] * n[2]; bd += w * n[1] * d;
+    c2 += w * n[2] * n[2]; cd += w * n[2] * d;
+    d2 += w * d * d;
+}
+
+// ------------------------------------------------------------
+Decimator::Quadric &Decimator::Quadric::operator+=(const Quadric &q) {
+// ------------------------------------------------------------
+    a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+    b2 += q.b2; bc += q.bc; bd += q.bd;
+    c2 += q.c2; cd += q.cd;
+    d2 += q.d2;
+    area += q.area;
+    return *this;
+}
+
+// Area weighted mean squared distance of p to the planes
+// ------------------------------------------------------------
+double Decimator::Quadric::error(const Vec &p) const {
+// ------------------------------------------------------------
+    double x = p[0], y = p[1], z = p[2];
+    double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+             + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+             + c2 * z * z + 2 * cd * z
+             + d2;
+    return std::max(0.0, e) / std::max(area, DBL_MIN);
+}
+
+// Point of minimum error, false when the system is close to singular
+// (flat or cylindrical neighborhoods)
+// ------------------------------------------------------------
+bool Decimator::Quadric::minimizer(Vec &p) const {
+// ------------------------------------------------------------
+    double det = a2 * (b2 * c2 - bc * bc) - ab * (ab * c2 - bc * ac) + ac * (ab * bc - b2 * ac);
+    double scale = a2 + b2 + c2;
+    if (fabs(det) <= 1E-9 * scale * scale * scale) {
+        return false;
+    }
+
+    // Cramer's rule on A p = -b
+    double inv = 1.0 / det;
+    p[0] = -inv * (ad * (b2 * c2 - bc * bc) - ab * (bd * c2 - bc * cd) + ac * (bd * bc - b2 * cd));
+    p[1] = -inv * (a2 * (bd * c2 - cd * bc) - ad * (ab * c2 - bc * ac) + ac * (ab * cd - bd * ac));
+    p[2] = -inv * (a2 * (b2 * cd - bc * bd) - ab * (ab * cd - bd * ac) + ad * (ab * bc - b2 * ac));
+    return true;
+}
+
+// ------------------------------------------------------------
+Decimator::Decimator(Polygon &polygon) : polygon(polygon) {
+// ------------------------------------------------------------
+}
+
+// Unnormalized normal of triangle t from its current vertices
+// ------------------------------------------------------------
+Vec Decimator::faceNormal(uint32_t t) const {
+// ------------------------------------------------------------
+    Vec a = position(polygon.corner(t, 0));
+    Vec b = position(polygon.corner(t, 1));
+    Vec c = position(polygon.corner(t, 2));
+    return cross(b - a, c - a);
+}
+
+// Builds vertex quadrics from the triangle planes
+// plus constraint planes along boundary edges
+// ------------------------------------------------------------
+void Decimator::initQuadrics() {
+// ------------------------------------------------------------
+
+    size_t nv = polygon.vertexCount();
+    size_t nt = polygon.triangleCount();
+    quadrics = vector<Quadric>(nv);
+
+    for (uint32_t t = 0; t < nt; t++) {
+        if (polygon.removed[t]) continue;
+
+        Vec n = faceNormal(t);
+        double len = n.norm();
+        if (len <= 0) continue;
+        n = n / len;
+
+        Quadric q = Quadric();
+        q.addPlane(n, -dot(n, position(polygon.corner(t, 0))), 0.5 * len);
+        q.area = 0.5 * len;
+        for (int k = 0; k < 3; k++) {
+            quadrics[polygon.corner(t, k)] += q;
+        }
+    }
+
+    // Edges used by a single triangle
+    vector<uint64_t> edges = vector<uint64_t>();
+    edges.reserve(3 * nt);
+    for (uint32_t t = 0; t < nt; t++) {
+        if (polygon.removed[t]) continue;
+        for (int k = 0; k < 3; k++) {
+            uint32_t a = polygon.corner(t, k);
+            uint32_t b = polygon.corner(t, (k + 1) % 3);
+            if (a > b) std::swap(a, b);
+            edges.push_back(uint64_t(a) << 32 | b);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    for (size_t i = 0; i < edges.size(); i++) {
+        bool single = (i == 0 || edges[i - 1] != edges[i]) && (i + 1 == edges.size() || edges[i + 1] != edges[i]);
+        if (!single) continue;
+
+        auto a = uint32_t(edges[i] >> 32);
+        auto b = uint32_t(edges[i] & 0xFFFFFFFF);
+
+        // Triangle owning the edge
+        for (uint32_t t : vertexTris[a]) {
+            bool hasB = polygon.corner(t, 0) == b || polygon.corner(t, 1) == b || polygon.corner(t, 2) == b;
+            if (!hasB) continue;
+
+            Vec e = position(b) - position(a);
+            Vec n = cross(e, faceNormal(t));
+            double len = n.norm();
+            if (len <= 0) break;
+            n = n / len;
+
+            Quadric q = Quadric();
+            q.addPlane(n, -dot(n, position(a)), BOUNDARY_WEIGHT * dot(e, e));
+            quadrics[a] += q;
+            quadrics[b] += q;
+            break;
+        }
+    }
+
+    // Edge candidates, each unique edge once
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+    for (uint64_t e : edges) {
+        pushEdge(uint32_t(e >> 32), uint32_t(e & 0xFFFFFFFF));
+    }
+}
+
+// Queues the collapse of edge v0-v1 at its cheapest position
+// ------------------------------------------------------------
+void Decimator::pushEdge(uint32_t v0, uint32_t v1) {
+// ------------------------------------------------------------
+
+    Quadric q = quadrics[v0];
+    q += quadrics[v1];
+
+    Vec p0 = position(v0);
+    Vec p1 = position(v1);
+    Vec candidates[4] = {p0, p1, (p0 + p1) * 0.5, Vec()};
+    int n = q.minimizer(candidates[3]) ? 4 : 3;
+
+    Collapse c = Collapse();
+    c.cost = DBL_MAX;
+    for (int i = 0; i < n; i++) {
+        double e = q.error(candidates[i]);
+        if (e < c.cost) {
+            c.cost = e;
+            c.target = candidates[i];
+        }
+    }
+
+    c.v0 = v0;
+    c.v1 = v1;
+    c.stamp0 = stamps[v0];
+    c.stamp1 = stamps[v1];
+    heap.push(c);
+}
+
+// Vertices sharing a live triangle with v
+// ------------------------------------------------------------
+void Decimator::neighbors(uint32_t v, vector<uint32_t> &ns) const {
+// ------------------------------------------------------------
+    ns.clear();
+    for (uint32_t t : vertexTris[v]) {
+        for (int k = 0; k < 3; k++) {
+            uint32_t w = polygon.corner(t, k);
+            if (w != v) ns.push_back(w);
+        }
+    }
+    std::sort(ns.begin(), ns.end());
+    ns.erase(std::unique(ns.begin(), ns.end()), ns.end());
+}
+
+// Rejects collapses that would make the mesh non manifold
+// or fold triangles over
+// ------------------------------------------------------------
+bool Decimator::isValid(uint32_t v0, uint32_t v1, const Vec &target) {
+// ------------------------------------------------------------
+
+    // Link condition: common neighbors are exactly the opposite
+    // vertices of the triangles on the edge
+    vector<uint32_t> n0, n1;
+    neighbors(v0, n0);
+    neighbors(v1, n1);
+
+    size_t common = 0;
+    for (size_t i = 0, j = 0; i < n0.size() && j < n1.size();) {
+        if (n0[i] < n1[j]) i++;
+        else if (n1[j] < n0[i]) j++;
+        else { common++; i++; j++; }
+    }
+
+    size_t shared = 0;
+    for (uint32_t t : vertexTris[v0]) {
+        if (polygon.corner(t, 0) == v1 || polygon.corner(t, 1) == v1 || polygon.corner(t, 2) == v1) shared++;
+    }
+    if (shared == 0 || common != shared) return false;
+
+    // Normal flips on the triangles that stay
+    for (uint32_t v : {v0, v1}) {
+        uint32_t other = (v == v0) ? v1 : v0;
+        for (uint32_t t : vertexTris[v]) {
+            uint32_t c[3] = {polygon.corner(t, 0), polygon.corner(t, 1), polygon.corner(t, 2)};
+            if (c[0] == other || c[1] == other || c[2] == other) continue;
+
+            Vec p[3];
+            for (int k = 0; k < 3; k++) {
+                p[k] = (c[k] == v) ? target : position(c[k]);
+            }
+
+            Vec before = faceNormal(t);
+            Vec after = cross(p[1] - p[0], p[2] - p[0]);
+            double lb = before.norm(), la = after.norm();
+            if (la <= 1E-12 * lb) return false;
+            if (dot(before, after) < MIN_NORMAL_DOT * la * lb) return false;
+        }
+    }
+
+    return true;
+}
+
+// Moves v0 to target and merges v1 into it
+// ------------------------------------------------------------
+void Decimator::collapse(uint32_t v0, uint32_t v1, const Vec &target) {
+// ------------------------------------------------------------
+
+    polygon.px[v0] = target[0];
+    polygon.py[v0] = target[1];
+    polygon.pz[v0] = target[2];
+    quadrics[v0] += quadrics[v1];
+    collapsed[v1] = 1;
+    stamps[v0]++;
+    stamps[v1]++;
+
+    for (uint32_t t : vertexTris[v1]) {
+        uint32_t *c = &polygon.indices[3 * t];
+
+        if (c[0] == v0 || c[1] == v0 || c[2] == v0) {
+
+            // Triangle on the edge disappears
+            polygon.removeTriangle(t);
+            liveTriangles--;
+            for (int k = 0; k < 3; k++) {
+                if (c[k] == v1) continue;
+                vector<uint32_t> &ts = vertexTris[c[k]];
+                ts.erase(std::remove(ts.begin(), ts.end(), t), ts.end());
+            }
+        } else {
+            for (int k = 0; k < 3; k++) {
+                if (c[k] == v1) c[k] = v0;
+            }
+            vertexTris[v0].push_back(t);
+        }
+    }
+    vector<uint32_t>().swap(vertexTris[v1]);
+
+    for (uint32_t t : vertexTris[v0]) {
+        touched[t] = 1;
+    }
+
+    // Requeue edges around the moved vertex
+    vector<uint32_t> ns;
+    neighbors(v0, ns);
+    for (uint32_t w : ns) {
+        pushEdge(v0, w);
+    }
+}
+
+// ------------------------------------------------------------
+size_t Decimator::decimate(size_t targetTriangles, double maxError) {
+// ------------------------------------------------------------
+
+    polygon.compact();
+    polygon.buildAdjacency();
+
+    size_t nv = polygon.vertexCount();
+    size_t nt = polygon.triangleCount();
+    liveTriangles = nt;
+
+    vertexTris = vector<vector<uint32_t>>(nv);
+    for (uint32_t v = 0; v < nv; v++) {
+        vertexTris[v].assign(polygon.trisBegin(v), polygon.trisEnd(v));
+    }
+    stamps = vector<uint32_t>(nv, 0);
+    collapsed = vector<uint8_t>(nv, 0);
+    touched = vector<uint8_t>(nt, 0);
+    heap = std::priority_queue<Collapse, vector<Collapse>, std::greater<Collapse>>();
+
+    initQuadrics();
+
+    double maxCost = maxError * maxError;
+    while (liveTriangles > targetTriangles && !heap.empty()) {
+        Collapse c = heap.top();
+        heap.pop();
+
+        if (collapsed[c.v0] || collapsed[c.v1]) continue;
+        if (c.stamp0 != stamps[c.v0] || c.stamp1 != stamps[c.v1]) continue; // Stale entry
+        if (c.cost > maxCost) break;
+        if (!isValid(c.v0, c.v1, c.target)) continue;
+
+        collapse(c.v0, c.v1, c.target);
+    }
+
+    // Moved triangles get geometric normals, oriented like the originals
+    for (uint32_t t = 0; t < nt; t++) {
+        if (!touched[t] || polygon.removed[t]) continue;
+
+        Vec n = faceNormal(t);
+        double len = n.norm();
+        if (len <= 0) continue;
+        n = n / len;
+        polygon.normals[t] = (dot(n, polygon.normals[t]) < 0) ? -n : n;
+    }
+
+    polygon.compact();
+    polygon.removeUnusedNodes();
+
+    vector<Quadric>().swap(quadrics);
+    vector<vector<uint32_t>>().swap(vertexTris);
+    heap = std::priority_queue<Collapse, vector<Collapse>, std::greater<Collapse>>();
+
+    return liveTriangles;
+}
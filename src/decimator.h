@@ -0,0 +1,69 @@
+//
+// Edge collapse mesh simplification driven by quadric error metrics.
+// Garland and Heckbert "Surface Simplification Using Quadric Error Metrics" (1997)
+//
+
+#ifndef DMLIDE_DECIMATOR_H
+#define DMLIDE_DECIMATOR_H
+
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+#include "polygon.h"
+
+class Decimator {
+
+public:
+    explicit Decimator(Polygon &polygon);
+
+    // Collapses edges cheapest first until targetTriangles remain or the
+    // next collapse would move the surface by more than maxError.
+    // Returns the number of remaining triangles.
+    size_t decimate(size_t targetTriangles, double maxError);
+
+private:
+    // Symmetric 4x4 plane quadric, area weighted
+    struct Quadric {
+        double a2 = 0, ab = 0, ac = 0, ad = 0;
+        double b2 = 0, bc = 0, bd = 0;
+        double c2 = 0, cd = 0;
+        double d2 = 0;
+        double area = 0;
+
+        void addPlane(const Vec &n, double d, double w);
+        Quadric &operator+=(const Quadric &q);
+        double error(const Vec &p) const;
+        bool minimizer(Vec &p) const;
+    };
+
+    struct Collapse {
+        double cost;
+        uint32_t v0, v1;
+        uint32_t stamp0, stamp1;
+        Vec target;
+
+        bool operator>(const Collapse &c) const { return cost > c.cost; }
+    };
+
+    void initQuadrics();
+    void pushEdge(uint32_t v0, uint32_t v1);
+    bool isValid(uint32_t v0, uint32_t v1, const Vec &target);
+    void collapse(uint32_t v0, uint32_t v1, const Vec &target);
+    void neighbors(uint32_t v, vector<uint32_t> &ns) const;
+
+    Vec position(uint32_t v) const { return polygon.position(v); }
+    Vec faceNormal(uint32_t t) const;
+
+    Polygon &polygon;
+    size_t liveTriangles = 0;
+
+    vector<Quadric> quadrics;
+    vector<vector<uint32_t>> vertexTris; // Live triangles per vertex
+    vector<uint32_t> stamps; // Bumped whenever a vertex changes, invalidates queued collapses
+    vector<uint8_t> collapsed;
+    vector<uint8_t> touched; // Triangles whose normals need updating
+    std::priority_queue<Collapse, vector<Collapse>, std::greater<Collapse>> heap;
+};
+
+#endif //DMLIDE_DECIMATOR_H
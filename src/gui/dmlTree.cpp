@@ -63,6 +63,8 @@ static inline QString globalElement() { return QStringLiteral("global"); }
 
 // Lattice attributes
 static inline QString fillAttribute() { return QStringLiteral("fill"); }
+static inline QString samplingAttribute() { return QStringLiteral("sampling"); }
+static inline QString cellAttribute() { return QStringLiteral("cell"); }
 static inline QString unitAttribute() { return QStringLiteral("unit"); }
 static inline QString displayAttribute() { return QStringLiteral("display"); }
 static inline QString conformAttribute() { return QStringLiteral("conform"); }
@@ -387,6 +389,8 @@ void DMLTree::parseExpandElement(const QDomElement &element,
     if (element.tagName() == latticeElement()) {
         qDebug() << "in lattice loader";
         auto *fill = createAttributeItem(item, attrMap, fillAttribute());
+        auto *sampling = createAttributeItem(item, attrMap, samplingAttribute());
+        auto *cell = createAttributeItem(item, attrMap, cellAttribute());
         auto *unit = createAttributeItem(item, attrMap, unitAttribute());
         auto *display = createAttributeItem(item, attrMap, displayAttribute());
         auto *conform = createAttributeItem(item, attrMap, conformAttribute());
@@ -405,6 +409,9 @@ void DMLTree::parseExpandElement(const QDomElement &element,
         LatticeConfig *l = new LatticeConfig();
         l->fill = fill ? (fill->text(1) == "cubic"?
                              LatticeConfig::CUBIC_FILL : LatticeConfig::SPACE_FILL) : LatticeConfig::SPACE_FILL;
+        l->sampling = sampling ? (sampling->text(1) == "poisson"?
+                             LatticeConfig::POISSON_SAMPLING : LatticeConfig::FARTHEST_SAMPLING) : LatticeConfig::FARTHEST_SAMPLING;
+        l->cell = cell ? LatticeConfig::cellFromName(cell->text(1)) : LatticeConfig::GRID_CELL;
 
         l->unit = unit ? parseVec(unit->text(1)) : Vec(0, 0, 0);
         l->display = display ? display->text(1) : nullptr;
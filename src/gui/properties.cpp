@@ -204,6 +204,10 @@ void PropertiesTable::displaySimulation(QString id) {
         createValueItem(rowCount, 2, lattice->volume->id);
         createPropertyItem(++rowCount, 1, "fill");
         createValueItem(rowCount, 2, lattice->fillName());
+        createPropertyItem(++rowCount, 1, "sampling");
+        createValueItem(rowCount, 2, lattice->samplingName());
+        createPropertyItem(++rowCount, 1, "cell");
+        createValueItem(rowCount, 2, lattice->cellName());
         createPropertyItem(++rowCount, 1, "unit");
         createVecValueItem(rowCount, 2, lattice->unit);
         createPropertyItem(++rowCount, 1, "display");
@@ -426,6 +430,13 @@ void PropertiesTable::updateProp(int row, int col) {
                         simConfig->latticeMap[volId]->fill =
                                 item->text() == "cubic" ? LatticeConfig::CUBIC_FILL : LatticeConfig::SPACE_FILL;
                     }
+                    if (property->text() == "sampling") {
+                        simConfig->latticeMap[volId]->sampling =
+                                item->text() == "poisson" ? LatticeConfig::POISSON_SAMPLING : LatticeConfig::FARTHEST_SAMPLING;
+                    }
+                    if (property->text() == "cell") {
+                        simConfig->latticeMap[volId]->cell = LatticeConfig::cellFromName(item->text());
+                    }
                     if (property->text() == "unit") {
                         simConfig->latticeMap[volId]->unit = parseVecInput(item->text());
                     }
@@ -230,6 +230,7 @@ void Window::reloadSimulation() {
         ui->verticalLayout->removeWidget(simWidget);
 #endif
 
+    SimBackend::release(simulation);
     delete simulation;
     simulation = new Simulation();
     //loader->loadSimFromLattice(arrays_sim, simulation, 0.035);
@@ -0,0 +1,68 @@
+//
+// Flat binary archives shared by the on-disk caches.
+// Arrays are stored as a byte count followed by the raw elements,
+// padded to 8 bytes so every array starts aligned in a mapped file.
+//
+
+#ifndef DMLIDE_CACHEARCHIVE_H
+#define DMLIDE_CACHEARCHIVE_H
+
+#include <QByteArray>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// splitmix64 finalizer, spreads every input bit over the whole key
+inline uint64_t cacheMix(uint64_t x) {
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+inline size_t cachePadded(size_t bytes) {
+    return (bytes + 7) & ~size_t(7);
+}
+
+// Appends arrays to an in-memory entry
+struct CacheWriter {
+    QByteArray buffer;
+
+    void bytes(const void *data, size_t n) {
+        buffer.append(reinterpret_cast<const char *>(data), int(n));
+        buffer.append(int(cachePadded(n) - n), '\0');
+    }
+
+    template <typename T>
+    void operator()(const std::vector<T> &v) {
+        static_assert(std::is_trivially_copyable<T>::value, "Cached arrays must be plain data");
+        uint64_t n = v.size() * sizeof(T);
+        bytes(&n, sizeof(n));
+        bytes(v.data(), n);
+    }
+};
+
+// Reads arrays written by CacheWriter from a mapped entry
+struct CacheReader {
+    const uchar *pos;
+    const uchar *end;
+    bool ok = true;
+
+    template <typename T>
+    void operator()(std::vector<T> &v) {
+        static_assert(std::is_trivially_copyable<T>::value, "Cached arrays must be plain data");
+        uint64_t n = 0;
+        if (!ok || end - pos < qint64(sizeof(n))) { ok = false; return; }
+        memcpy(&n, pos, sizeof(n));
+        pos += sizeof(n);
+
+        if (n % sizeof(T) != 0 || uint64_t(end - pos) < n) { ok = false; return; }
+        v.resize(n / sizeof(T));
+        if (n > 0) memcpy(v.data(), pos, n);
+        pos += std::min(cachePadded(n), size_t(end - pos));
+    }
+};
+
+#endif //DMLIDE_CACHEARCHIVE_H
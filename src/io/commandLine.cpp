@@ -18,6 +18,9 @@ namespace CommandLine {
     args::ValueFlag<std::string> outputDataPath(parser, "PATH", "Output data directory", {'d', "data"});
     args::ValueFlag<std::string> outputModelPath(parser, "PATH", "Output 3D model file (STL supported)", {"model"});
     args::ValueFlag<std::string> outputVideoPath(parser, "PATH", "Output video of simulation", {"video"});
+    args::ValueFlag<uint64_t> seed(parser, "SEED", "Random seed (replays lattices and optimizer trials)", {"seed"});
+    args::ValueFlag<std::string> backend(parser, "NAME", "Simulation backend, titan (CUDA) or cpu",
+                                         {"backend"}, "titan");
 
     // Parse command line
     void parse(int argc, char **argv) {
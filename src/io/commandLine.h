@@ -6,6 +6,7 @@
 #define DMLIDE_COMMANDLINE_H
 
 #include <args.hxx>
+#include <cstdint>
 
 namespace CommandLine {
     extern args::ArgumentParser parser;
@@ -18,6 +19,8 @@ namespace CommandLine {
     extern args::ValueFlag<std::string> outputDataPath;
     extern args::ValueFlag<std::string> outputModelPath;
     extern args::ValueFlag<std::string> outputVideoPath;
+    extern args::ValueFlag<uint64_t> seed;
+    extern args::ValueFlag<std::string> backend;
 
     extern void parse(int argc, char **argv);
 };
@@ -0,0 +1,153 @@
+//
+// On-disk cache of generated simulation lattices.
+//
+
+#include "latticeCache.h"
+#include "cacheArchive.h"
+#include "meshCache.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSaveFile>
+
+static const char MAGIC[8] = {'D', 'M', 'L', 'L', 'A', 'T', 'T', '\0'};
+
+// ------------------------------------------------------------
+LatticeCache::LatticeCache(const std::string &directory) : directory(directory) {
+// ------------------------------------------------------------
+    key = cacheMix(VERSION);
+    valid = !directory.empty();
+}
+
+// ------------------------------------------------------------
+void LatticeCache::addValue(double value) {
+// ------------------------------------------------------------
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    addBits(bits);
+}
+
+// ------------------------------------------------------------
+void LatticeCache::addBits(uint64_t bits) {
+// ------------------------------------------------------------
+    key = cacheMix(key ^ bits);
+}
+
+// ------------------------------------------------------------
+void LatticeCache::addString(const QString &value) {
+// ------------------------------------------------------------
+    key = cacheMix(key ^ uint64_t(value.size()));
+    for (QChar c : value) {
+        key = cacheMix(key ^ c.unicode());
+    }
+}
+
+// ------------------------------------------------------------
+bool LatticeCache::addFile(const std::string &path) {
+// ------------------------------------------------------------
+    uint64_t hash, size;
+    if (!MeshCache::hashFile(path, hash, size)) {
+        valid = false;
+        return false;
+    }
+    key = cacheMix(key ^ hash);
+    key = cacheMix(key ^ size);
+    return true;
+}
+
+// ------------------------------------------------------------
+std::string LatticeCache::entryPath() const {
+// ------------------------------------------------------------
+    return directory + "/" + QString::number(qulonglong(key), 16).rightJustified(16, '0').toStdString() + ".lattice";
+}
+
+// ------------------------------------------------------------
+bool LatticeCache::load(Entry &entry) {
+// ------------------------------------------------------------
+    if (!valid) return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile file(QString::fromStdString(entryPath()));
+    if (!file.exists() || !file.open(QIODevice::ReadOnly)) return false;
+
+    const uchar *data = file.map(0, file.size());
+    if (data == nullptr || file.size() < qint64(sizeof(Header))) return false;
+
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.key != key) {
+        qDebug() << "Stale lattice cache entry" << file.fileName();
+        return false;
+    }
+
+    CacheReader ar = CacheReader();
+    ar.pos = data + sizeof(Header);
+    ar.end = data + file.size();
+
+    ar(entry.positions);
+    ar(entry.origins);
+    ar(entry.springs);
+    ar(entry.restLengths);
+    ar(entry.memberStart);
+    ar(entry.members);
+
+    size_t masses = header.masses;
+    bool ok = ar.ok && entry.positions.size() == 3 * masses && entry.origins.size() == masses
+              && entry.springs.size() == 2 * entry.restLengths.size()
+              && !entry.memberStart.empty() && entry.memberStart.back() == entry.members.size();
+    for (size_t i = 0; ok && i < entry.springs.size(); i++) {
+        ok = entry.springs[i] < masses;
+    }
+    for (size_t i = 0; ok && i + 1 < entry.memberStart.size(); i++) {
+        ok = entry.memberStart[i] <= entry.memberStart[i + 1];
+    }
+
+    if (!ok) {
+        qDebug() << "Corrupt lattice cache entry" << file.fileName();
+        entry = Entry();
+        return false;
+    }
+
+    qDebug() << "Loaded cached lattice" << file.fileName() << "in" << timer.elapsed() << "ms";
+    return true;
+}
+
+// ------------------------------------------------------------
+bool LatticeCache::save(const Entry &entry) {
+// ------------------------------------------------------------
+    if (!valid) return false;
+
+    if (!QDir().mkpath(QString::fromStdString(directory))) {
+        qDebug() << "Could not create lattice cache directory" << QString::fromStdString(directory);
+        return false;
+    }
+
+    Header header = Header();
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.masses = uint32_t(entry.origins.size());
+    header.key = key;
+
+    CacheWriter ar = CacheWriter();
+    ar.buffer.append(reinterpret_cast<const char *>(&header), int(sizeof(header)));
+    ar(entry.positions);
+    ar(entry.origins);
+    ar(entry.springs);
+    ar(entry.restLengths);
+    ar(entry.memberStart);
+    ar(entry.members);
+
+    // Written to a temporary and renamed, concurrent runs never see partial entries
+    QSaveFile file(QString::fromStdString(entryPath()));
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(ar.buffer) != ar.buffer.size()
+        || !file.commit()) {
+        qDebug() << "Could not write lattice cache entry" << file.fileName();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,63 @@
+//
+// On-disk cache of generated simulation lattices.
+// Entries hold the masses, springs and lattice of origin of every mass,
+// and the masses and springs each load acts on, keyed by a hash of the
+// lattice settings, the load volumes and the contents of their meshes,
+// so repeated runs of a design skip lattice generation and classification.
+//
+
+#ifndef DMLIDE_LATTICECACHE_H
+#define DMLIDE_LATTICECACHE_H
+
+#include <QString>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class LatticeCache {
+
+public:
+    struct Entry {
+        std::vector<double> positions;     // x, y, z per mass
+        std::vector<uint32_t> origins;     // Index into SimulationConfig::lattices per mass
+        std::vector<uint32_t> springs;     // Left and right mass per spring
+        std::vector<double> restLengths;   // Per spring
+        std::vector<uint32_t> memberStart; // Start of each load member list in members, one extra entry at the end
+        std::vector<uint32_t> members;     // Masses of anchors, forces and torques, springs of actuations
+    };
+
+    explicit LatticeCache(const std::string &directory);
+
+    // Key inputs, fed in the same order on every run
+    void addValue(double value);
+    void addBits(uint64_t bits); // Integers wider than a double mantissa, such as seeds
+    void addString(const QString &value);
+
+    // Adds the contents of a file to the key.
+    // False when it cannot be read, the cache is then disabled
+    bool addFile(const std::string &path);
+
+    // Fills entry from the entry for the key, false when there is none
+    bool load(Entry &entry);
+    bool save(const Entry &entry);
+
+    // Bumped whenever the entry layout or the lattice generators change
+    static const uint32_t VERSION = 1;
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t masses;
+        uint64_t key;
+    };
+
+    std::string entryPath() const;
+
+    std::string directory;
+    uint64_t key;
+    bool valid;
+};
+
+#endif //DMLIDE_LATTICECACHE_H
@@ -0,0 +1,219 @@
+//
+// On-disk cache of parsed volume meshes.
+//
+
+#include "meshCache.h"
+#include "cacheArchive.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <cstring>
+
+static const char MAGIC[8] = {'D', 'M', 'L', 'M', 'E', 'S', 'H', '\0'};
+
+// Polygon arrays go through the archive as plain doubles,
+// the node map is rebuilt by addNode() if nodes are added later
+// ------------------------------------------------------------
+static void writePolygon(CacheWriter &ar, Polygon &polygon) {
+// ------------------------------------------------------------
+    polygon.compact();
+
+    vector<double> ns = vector<double>();
+    ns.reserve(3 * polygon.normals.size());
+    for (const Vec &n : polygon.normals) {
+        ns.push_back(n[0]);
+        ns.push_back(n[1]);
+        ns.push_back(n[2]);
+    }
+
+    ar(polygon.px);
+    ar(polygon.py);
+    ar(polygon.pz);
+    ar(polygon.indices);
+    ar(ns);
+    polygon.bvh.serialize(ar);
+}
+
+// ------------------------------------------------------------
+static bool readPolygon(CacheReader &ar, Polygon &polygon) {
+// ------------------------------------------------------------
+    polygon.clearPolygon();
+
+    vector<double> ns = vector<double>();
+    ar(polygon.px);
+    ar(polygon.py);
+    ar(polygon.pz);
+    ar(polygon.indices);
+    ar(ns);
+    polygon.bvh.serialize(ar);
+
+    size_t nv = polygon.px.size();
+    size_t nt = polygon.indices.size() / 3;
+    if (!ar.ok || polygon.py.size() != nv || polygon.pz.size() != nv
+        || polygon.indices.size() != 3 * nt || ns.size() != 3 * nt || !polygon.bvh.valid()) {
+        return false;
+    }
+    for (uint32_t i : polygon.indices) {
+        if (i >= nv) return false;
+    }
+
+    polygon.normals.reserve(nt);
+    for (size_t t = 0; t < nt; t++) {
+        polygon.normals.emplace_back(ns[3 * t], ns[3 * t + 1], ns[3 * t + 2]);
+    }
+    polygon.removed = vector<uint8_t>(nt, 0);
+    return true;
+}
+
+// ------------------------------------------------------------
+MeshCache::MeshCache(const std::string &directory) : directory(directory) {
+// ------------------------------------------------------------
+}
+
+// ------------------------------------------------------------
+std::string MeshCache::directoryFor(const std::string &dmlPath) {
+// ------------------------------------------------------------
+    if (dmlPath.empty()) return "";
+    QFileInfo info(QString::fromStdString(dmlPath));
+    return (info.absolutePath() + "/.dmlcache").toStdString();
+}
+
+// Hashes the file in four independent 64 bit lanes
+// so the multiplies overlap, then folds in the size
+// ------------------------------------------------------------
+bool MeshCache::hashFile(const std::string &path, uint64_t &hash, uint64_t &size) {
+// ------------------------------------------------------------
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    size = uint64_t(file.size());
+    QByteArray fallback;
+    const uchar *data = (size > 0) ? file.map(0, file.size()) : nullptr;
+    if (data == nullptr && size > 0) {
+        fallback = file.readAll();
+        data = reinterpret_cast<const uchar *>(fallback.constData());
+    }
+
+    const uint64_t PRIME = 0x100000001B3ULL;
+    uint64_t h[4] = {0xCBF29CE484222325ULL, 0x84222325CBF29CE4ULL,
+                     0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL};
+
+    size_t blocks = size_t(size) / 32;
+    for (size_t b = 0; b < blocks; b++) {
+        uint64_t w[4];
+        memcpy(w, data + 32 * b, sizeof(w));
+        for (int k = 0; k < 4; k++) {
+            h[k] = (h[k] ^ w[k]) * PRIME;
+            h[k] ^= h[k] >> 32;
+        }
+    }
+    for (size_t i = 32 * blocks; i < size; i++) {
+        h[0] = (h[0] ^ data[i]) * PRIME;
+    }
+
+    hash = cacheMix(size);
+    for (int k = 0; k < 4; k++) {
+        hash = cacheMix(hash ^ h[k]);
+    }
+    return true;
+}
+
+// ------------------------------------------------------------
+std::string MeshCache::entryPath(uint64_t hash, uint64_t size, float scale) const {
+// ------------------------------------------------------------
+    uint32_t scaleBits;
+    memcpy(&scaleBits, &scale, sizeof(scaleBits));
+    uint64_t key = cacheMix(hash ^ cacheMix(size + scaleBits));
+    return directory + "/" + QString::number(qulonglong(key), 16).rightJustified(16, '0').toStdString() + ".mesh";
+}
+
+// ------------------------------------------------------------
+bool MeshCache::load(mesh_data &mesh, Key &key) {
+// ------------------------------------------------------------
+    QElapsedTimer timer;
+    timer.start();
+
+    key = Key();
+    if (directory.empty() || !hashFile(mesh.path, key.hash, key.size)) return false;
+    key.valid = true;
+    uint64_t hash = key.hash, size = key.size;
+
+    QFile file(QString::fromStdString(entryPath(hash, size, mesh.scale)));
+    if (!file.exists() || !file.open(QIODevice::ReadOnly)) return false;
+
+    const uchar *data = file.map(0, file.size());
+    if (data == nullptr || file.size() < qint64(sizeof(Header))) return false;
+
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION
+        || header.scale != mesh.scale || header.fileSize != size || header.contentHash != hash) {
+        qDebug() << "Stale mesh cache entry" << file.fileName();
+        return false;
+    }
+
+    CacheReader ar = CacheReader();
+    ar.pos = data + sizeof(Header);
+    ar.end = data + file.size();
+
+    ar(mesh.vertices);
+    ar(mesh.normals);
+    mesh.bvh.serialize(ar);
+    bool ok = readPolygon(ar, mesh.geometry) && ar.ok
+              && mesh.normals.size() == mesh.vertices.size()
+              && mesh.bvh.valid()
+              && mesh.bvh.triangleCount() == mesh.triangleCount();
+
+    if (!ok) {
+        qDebug() << "Corrupt mesh cache entry" << file.fileName();
+        mesh.vertices.clear();
+        mesh.normals.clear();
+        mesh.bvh.clear();
+        mesh.geometry.clearPolygon();
+        return false;
+    }
+
+    qDebug() << "Loaded cached mesh" << file.fileName() << "in" << timer.elapsed() << "ms";
+    return true;
+}
+
+// ------------------------------------------------------------
+bool MeshCache::save(mesh_data &mesh, const Key &key) {
+// ------------------------------------------------------------
+    if (directory.empty() || !key.valid) return false;
+    uint64_t hash = key.hash, size = key.size;
+
+    if (!QDir().mkpath(QString::fromStdString(directory))) {
+        qDebug() << "Could not create mesh cache directory" << QString::fromStdString(directory);
+        return false;
+    }
+
+    Header header = Header();
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.scale = mesh.scale;
+    header.fileSize = size;
+    header.contentHash = hash;
+
+    CacheWriter ar = CacheWriter();
+    ar.buffer.append(reinterpret_cast<const char *>(&header), int(sizeof(header)));
+    ar(mesh.vertices);
+    ar(mesh.normals);
+    mesh.bvh.serialize(ar);
+    writePolygon(ar, mesh.geometry);
+
+    // Written to a temporary and renamed, concurrent runs never see partial entries
+    QSaveFile file(QString::fromStdString(entryPath(hash, size, mesh.scale)));
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(ar.buffer) != ar.buffer.size()
+        || !file.commit()) {
+        qDebug() << "Could not write mesh cache entry" << file.fileName();
+        return false;
+    }
+    return true;
+}
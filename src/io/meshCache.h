@@ -0,0 +1,59 @@
+//
+// On-disk cache of parsed volume meshes.
+// Entries hold the scaled triangle soup, the welded Polygon and both BVHs,
+// keyed by a hash of the STL contents and the units scale, so repeated
+// runs on the same design skip parsing, welding and hierarchy builds.
+//
+
+#ifndef DMLIDE_MESHCACHE_H
+#define DMLIDE_MESHCACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include "model.h"
+
+class MeshCache {
+
+public:
+    explicit MeshCache(const std::string &directory);
+
+    // Cache directory for a design, .dmlcache next to the DML file.
+    // Empty when the design was not parsed from a file
+    static std::string directoryFor(const std::string &dmlPath);
+
+    // Contents of the mesh file an entry is stored under
+    struct Key {
+        uint64_t hash = 0;
+        uint64_t size = 0;
+        bool valid = false; // False when the file could not be read
+    };
+
+    // Fills mesh from the entry for mesh.path and mesh.scale.
+    // False when there is no valid entry. Sets key on a miss too, for save()
+    bool load(mesh_data &mesh, Key &key);
+
+    // Writes the entry for a fully built mesh under the key from load()
+    bool save(mesh_data &mesh, const Key &key);
+
+    // Hashes the contents of a file, false when it cannot be read
+    static bool hashFile(const std::string &path, uint64_t &hash, uint64_t &size);
+
+    // Bumped whenever the entry layout or the stored structures change
+    static const uint32_t VERSION = 1;
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        float scale;
+        uint64_t fileSize;
+        uint64_t contentHash;
+    };
+
+    std::string entryPath(uint64_t hash, uint64_t size, float scale) const;
+
+    std::string directory;
+};
+
+#endif //DMLIDE_MESHCACHE_H
@@ -0,0 +1,124 @@
+//
+// Unit cell templates for cubic lattice fills.
+//
+
+#include "latticeTemplate.h"
+
+#include <algorithm>
+
+// Node parities, one step grids have nodes at every parity
+#define CORNER 0x01
+#define FACE_XY 0x08
+#define FACE_XZ 0x20
+#define FACE_YZ 0x40
+#define BODY 0x80
+#define ANY 0xFF
+
+// Stencils only hold forward offsets (first nonzero step positive)
+// so every spring is emitted once, from its lower grid point
+
+// Edges, face and body diagonals of a one step grid,
+// what the old 1.9 unit cutoff search connected
+static const LatticeTemplate::Stencil GRID_STENCIL[] = {
+    {1, 0, 0, ANY}, {0, 1, 0, ANY}, {0, 0, 1, ANY},
+    {1, 1, 0, ANY}, {1, -1, 0, ANY}, {1, 0, 1, ANY}, {1, 0, -1, ANY}, {0, 1, 1, ANY}, {0, 1, -1, ANY},
+    {1, 1, 1, ANY}, {1, 1, -1, ANY}, {1, -1, 1, ANY}, {1, -1, -1, ANY}
+};
+
+// Edges and face diagonals
+static const LatticeTemplate::Stencil CUBIC_STENCIL[] = {
+    {1, 0, 0, ANY}, {0, 1, 0, ANY}, {0, 0, 1, ANY},
+    {1, 1, 0, ANY}, {1, -1, 0, ANY}, {1, 0, 1, ANY}, {1, 0, -1, ANY}, {0, 1, 1, ANY}, {0, 1, -1, ANY}
+};
+
+// Cube edges and struts from the body center to the corners, half unit steps
+static const LatticeTemplate::Stencil BCC_STENCIL[] = {
+    {2, 0, 0, CORNER}, {0, 2, 0, CORNER}, {0, 0, 2, CORNER},
+    {1, 1, 1, ANY}, {1, 1, -1, ANY}, {1, -1, 1, ANY}, {1, -1, -1, ANY}
+};
+
+// Cube edges and struts from the face centers to the corners of their face
+static const LatticeTemplate::Stencil FCC_STENCIL[] = {
+    {2, 0, 0, CORNER}, {0, 2, 0, CORNER}, {0, 0, 2, CORNER},
+    {1, 1, 0, CORNER | FACE_XY}, {1, -1, 0, CORNER | FACE_XY},
+    {1, 0, 1, CORNER | FACE_XZ}, {1, 0, -1, CORNER | FACE_XZ},
+    {0, 1, 1, CORNER | FACE_YZ}, {0, 1, -1, CORNER | FACE_YZ}
+};
+
+// Deshpande, Fleck and Ashby "Effective properties of the octet-truss lattice material" (2001)
+// Every node to its twelve nearest neighbors, face diagonals plus the inner octahedra
+static const LatticeTemplate::Stencil OCTET_STENCIL[] = {
+    {1, 1, 0, ANY}, {1, -1, 0, ANY}, {1, 0, 1, ANY}, {1, 0, -1, ANY}, {0, 1, 1, ANY}, {0, 1, -1, ANY}
+};
+
+#define USE_STENCIL(s) stencil = s; stencilSize = sizeof(s) / sizeof(s[0])
+
+// ------------------------------------------------------------
+LatticeTemplate::LatticeTemplate(LatticeConfig::LatticeCell cell) {
+// ------------------------------------------------------------
+    switch (cell) {
+        case LatticeConfig::CUBIC_CELL:
+            steps = 1; nodeParities = ANY; USE_STENCIL(CUBIC_STENCIL);
+            break;
+        case LatticeConfig::BCC_CELL:
+            steps = 2; nodeParities = CORNER | BODY; USE_STENCIL(BCC_STENCIL);
+            break;
+        case LatticeConfig::FCC_CELL:
+            steps = 2; nodeParities = CORNER | FACE_XY | FACE_XZ | FACE_YZ; USE_STENCIL(FCC_STENCIL);
+            break;
+        case LatticeConfig::OCTET_CELL:
+            steps = 2; nodeParities = CORNER | FACE_XY | FACE_XZ | FACE_YZ; USE_STENCIL(OCTET_STENCIL);
+            break;
+        default:
+            steps = 1; nodeParities = ANY; USE_STENCIL(GRID_STENCIL);
+            break;
+    }
+}
+
+// Numbers the nodes in grid order, then walks the stencil from every node
+// ------------------------------------------------------------
+void LatticeTemplate::connect(size_t nx, size_t ny, size_t nz, const std::vector<uint8_t> &inside,
+                              std::vector<uint32_t> &nodes, std::vector<std::pair<uint32_t, uint32_t>> &springs) const {
+// ------------------------------------------------------------
+
+    nodes.clear();
+    springs.clear();
+
+    // Node number per grid point, -1 when the point is not a node
+    std::vector<int32_t> number = std::vector<int32_t>(nx * ny * nz, -1);
+    size_t index = 0;
+    for (size_t k = 0; k < nz; k++) {
+        for (size_t j = 0; j < ny; j++) {
+            for (size_t i = 0; i < nx; i++, index++) {
+                if (inside[index] && isNode(i, j, k)) {
+                    number[index] = int32_t(nodes.size());
+                    nodes.push_back(uint32_t(index));
+                }
+            }
+        }
+    }
+
+    for (uint32_t n = 0; n < nodes.size(); n++) {
+        size_t i = nodes[n] % nx;
+        size_t j = (nodes[n] / nx) % ny;
+        size_t k = nodes[n] / (nx * ny);
+        uint8_t source = uint8_t(1 << parity(i, j, k));
+
+        for (size_t s = 0; s < stencilSize; s++) {
+            const Stencil &st = stencil[s];
+            if (!(st.sources & source)) continue;
+
+            // Unsigned wrap keeps steps below zero out of range
+            size_t ti = i + size_t(ptrdiff_t(st.dx));
+            size_t tj = j + size_t(ptrdiff_t(st.dy));
+            size_t tk = k + size_t(ptrdiff_t(st.dz));
+            if (ti >= nx || tj >= ny || tk >= nz) continue;
+
+            int32_t t = number[(tk * ny + tj) * nx + ti];
+            if (t < 0) continue;
+            springs.emplace_back(std::min(n, uint32_t(t)), std::max(n, uint32_t(t)));
+        }
+    }
+
+    std::sort(springs.begin(), springs.end());
+}
@@ -0,0 +1,53 @@
+//
+// Unit cell templates for cubic lattice fills.
+// Nodes sit on a grid of unit / divisions steps and springs follow a fixed
+// neighbor stencil per cell type, so connectivity comes straight from the
+// grid indices without any distance search.
+//
+
+#ifndef DMLIDE_LATTICETEMPLATE_H
+#define DMLIDE_LATTICETEMPLATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "model.h"
+
+class LatticeTemplate {
+
+public:
+    explicit LatticeTemplate(LatticeConfig::LatticeCell cell);
+
+    // Grid steps per unit cell edge
+    int divisions() const { return steps; }
+
+    // True when grid point (i, j, k) holds a node of the cell
+    bool isNode(size_t i, size_t j, size_t k) const { return (nodeParities & (1 << parity(i, j, k))) != 0; }
+
+    // Numbers the nodes of an nx x ny x nz grid that are set in inside (z, y, x order)
+    // and appends their grid indices to nodes. springs gets the stencil springs between
+    // them as pairs of node numbers, first < second, sorted
+    void connect(size_t nx, size_t ny, size_t nz, const std::vector<uint8_t> &inside,
+                 std::vector<uint32_t> &nodes, std::vector<std::pair<uint32_t, uint32_t>> &springs) const;
+
+    // Spring to the point at offset (dx, dy, dz), from the node parities set in sources
+    struct Stencil {
+        int8_t dx, dy, dz;
+        uint8_t sources;
+    };
+
+private:
+    // Odd x, y and z steps in bits 0, 1 and 2, telling corners, face and body centers apart
+    static int parity(size_t i, size_t j, size_t k) {
+        return int((i & 1) | ((j & 1) << 1) | ((k & 1) << 2));
+    }
+
+    int steps;
+    uint8_t nodeParities;
+    const Stencil *stencil;
+    size_t stencilSize;
+};
+
+#endif //DMLIDE_LATTICETEMPLATE_H
@@ -1,7 +1,15 @@
 #include "loader.h"
+#include "latticeTemplate.h"
+#include "sampler.h"
+#include "rng.h"
+
+#include <unordered_set>
 
 #define EPSILON 1E-5
 #define NUM_RAYS 1
+#define POISSON_SEEDS 64
+#define SPRING_CHUNK 1024
+#define LOAD_CELL_POINTS 4
 
 Loader::Loader(QObject *parent) : QObject(parent)
 {
@@ -17,6 +25,21 @@ Loader::~Loader() {
  * Creates OpenGL data for rendering
  */
 void Loader::loadDesignModels(Design *design) {
+    cacheDirectory = MeshCache::directoryFor(design->path);
+
+    // Users of each mesh, so the last one takes the parsed data instead of a copy
+    pair<string, float> key;
+    for (Volume *volume : design->volumes) {
+        if (!meshKey(volume, key)) continue;
+        SharedMesh &shared = meshCache[key];
+        shared.soupUsers++;
+        shared.normalUsers++;
+        shared.geometryUsers++;
+    }
+    for (SimulationConfig &simConfig : design->simConfigs) {
+        if (meshKey(design->simConfigMap[simConfig.id]->volume, key)) meshCache[key].soupUsers++;
+    }
+
     for (uint v = 0; v < design->volumes.size(); v++) {
         loadVolumeModel(design->volumes[v]);
         loadVolumeGeometry(design->volumes[v]);
@@ -29,6 +52,89 @@ void Loader::loadDesignModels(Design *design) {
         loadSimModel(&design->simConfigs[s]);
         design->simConfigMap[design->simConfigs[s].id] = &design->simConfigs[s];
     }
+
+    // Parsed meshes are only shared while loading
+    meshCache.clear();
+}
+
+/**
+ * @brief Loader::volumeScale
+ * Scale from the volume units to meters
+ */
+float Loader::volumeScale(Volume *volume) {
+    float scale = 1;
+    if (volume->units != nullptr) {
+        if (volume->units == "meters" || volume->units == "m") {
+            scale = 1;
+        } else if (volume->units == "centimeters" || volume->units == "cm") {
+            scale = 0.01;
+        } else if (volume->units == "millimeters" || volume->units == "mm") {
+            scale = 0.001;
+        }
+    }
+    return scale;
+}
+
+/**
+ * @brief Loader::meshKey
+ * Path and scale a volume mesh is shared under, false when the volume has no valid file
+ */
+bool Loader::meshKey(Volume *volume, pair<string, float> &key) {
+    if (volume == nullptr || volume->primitive != "stl" || volume->url.isEmpty() || !volume->url.isValid()) {
+        return false;
+    }
+    key = make_pair(volume->url.path().toStdString(), volumeScale(volume));
+    return true;
+}
+
+/**
+ * @brief Loader::loadMesh
+ * Parses the STL of a volume, once per file and scale, and builds
+ * its welded Polygon and BVHs. Volumes referencing the same file
+ * share the result, see takeMeshPart. Built meshes are kept in the
+ * on-disk cache (see MeshCache) and read back from it on later runs.
+ * Returns nullptr when the volume has no valid file
+ */
+Loader::SharedMesh *Loader::loadMesh(Volume *volume) {
+    pair<string, float> key;
+    if (!meshKey(volume, key)) return nullptr;
+
+    SharedMesh &shared = meshCache[key];
+    if (shared.loaded) return &shared;
+    shared.loaded = true;
+
+    string path = key.first;
+    mesh_data *mesh = &shared.mesh;
+    mesh->path = path;
+    mesh->scale = key.second;
+
+    MeshCache diskCache = MeshCache(cacheDirectory);
+    MeshCache::Key diskKey;
+    if (diskCache.load(*mesh, diskKey)) {
+        log(QString("Loaded %1 from mesh cache").arg(QString::fromStdString(path)));
+    } else {
+        Utils::createModelFromFile(path, mesh->scale, mesh->vertices, mesh->normals);
+        mesh->bvh.build(mesh->vertices.data(), mesh->triangleCount());
+        mesh->geometry.createPolygonFromTriangles(mesh->vertices.data(), mesh->normals.data(),
+                                                  mesh->triangleCount());
+        mesh->geometry.buildBVH();
+
+        if (!cacheDirectory.empty() && !mesh->empty() && diskCache.save(*mesh, diskKey)) {
+            log(QString("Cached %1 in %2").arg(QString::fromStdString(path), QString::fromStdString(cacheDirectory)));
+        }
+    }
+    return &shared;
+}
+
+// Copies a part of a shared mesh into out, or moves it for its last user.
+// users is what remains after this one, uncounted users always copy
+template <class T>
+static void takeMeshPart(T &part, int users, T &out) {
+    if (users == 0) {
+        out = std::move(part);
+    } else {
+        out = part;
+    }
 }
 
 /**
@@ -55,20 +161,16 @@ void Loader::loadVolumeModel(Volume *volume) {
 
         if (volume->url.isValid()) {
 
-            float scale = 1;
-            if (volume->units != nullptr) {
-                if (volume->units == "meters" || volume->units == "m") {
-                    scale = 1;
-                } else if (volume->units == "centimeters" || volume->units == "cm") {
-                    scale = 0.01;
-                } else if (volume->units == "millimeters" || volume->units == "mm") {
-                    scale = 0.001;
-                }
-            }
-
-            qDebug() << "Scale" << scale;
+            qDebug() << "Scale" << volumeScale(volume);
 
-            Utils::createModelFromFile(volume->url.path().toStdString(), scale, volume->model->vertices, volume->model->normals);
+            SharedMesh *shared = loadMesh(volume);
+            if (shared != nullptr) {
+                int soupUsers = --shared->soupUsers;
+                takeMeshPart(shared->mesh.vertices, soupUsers, volume->model->vertices);
+                takeMeshPart(shared->mesh.normals, --shared->normalUsers, volume->model->normals);
+                volume->model->bvh = vector<BVH>(1);
+                takeMeshPart(shared->mesh.bvh, soupUsers, volume->model->bvh[0]);
+            }
             cout << "Created model from" << volume->url.path().toStdString() << "\n";
 
         } else {
@@ -84,6 +186,7 @@ void Loader::loadVolumeModel(Volume *volume) {
     volume->model->n_normals = int(volume->model->normals.size());
     volume->model->model_indices[0] = volume->model->n_vertices;
     volume->model->bounds = boundingBox<vec3>(volume->model->vertices);
+    if (volume->model->bvh.empty()) volume->model->buildBVH();
 
     log(QString("Loaded %1 vertices").arg(volume->model->n_vertices));
 }
@@ -102,21 +205,12 @@ void Loader::loadVolumeGeometry(Volume *volume){
 
         if (volume->url.isValid()) {
 
-            // SCALE
-            float scale = 1;
-            if (volume->units != nullptr) {
-                if (volume->units == "meters" || volume->units == "m") {
-                    scale = 1;
-                } else if (volume->units == "centimeters" || volume->units == "cm") {
-                    scale = 0.01;
-                } else if (volume->units == "millimeters" || volume->units == "mm") {
-                    scale = 0.001;
-                }
+            // Welded when the volume mesh was loaded
+            SharedMesh *shared = loadMesh(volume);
+            if (shared != nullptr) {
+                takeMeshPart(shared->mesh.geometry, --shared->geometryUsers, *volume->geometry);
             }
 
-            // LOAD FROM INPUT FILE
-            volume->geometry->createPolygonFromFile(volume->url.path().toStdString(), scale);
-
             /**iUtils::iglMesh *mesh = new iUtils::iglMesh();
             iUtils::iglFromGeometry(*volume->geometry, *mesh);
             qDebug() << "Matrix";
@@ -129,18 +223,82 @@ void Loader::loadVolumeGeometry(Volume *volume){
         }
     }
 
-    log(QString("Loaded %1 vertices").arg(volume->geometry->nodeMap.size()));
+    if (volume->geometry->bvh.empty()) volume->geometry->buildBVH();
+
+    log(QString("Loaded %1 vertices").arg(volume->geometry->vertexCount()));
 }
 
 void Loader::loadSimModel(SimulationConfig *simConfig) {
     Volume *simVolume = simConfig->volume;
 
-    simConfig->model = new simulation_data(simVolume->model);
+    SharedMesh *shared = loadMesh(simVolume);
+    if (shared != nullptr) {
+        int soupUsers = --shared->soupUsers;
+        vector<vec3> vertices = vector<vec3>();
+        takeMeshPart(shared->mesh.vertices, soupUsers, vertices);
+        simConfig->model = new simulation_data(std::move(vertices));
+        takeMeshPart(shared->mesh.bvh, soupUsers, simConfig->model->bvh);
+    } else {
+        simConfig->model = new simulation_data(simVolume->model);
+        simConfig->model->buildBVH();
+    }
     //simConfig->model = new simulation_data(simVolume->geometry);
     qDebug() << "Loaded simulation data structure";
 }
 
 
+/**
+ * @brief Loader::buildOccupancy
+ * Voxelizes the simulation volume and every lattice and load volume
+ * at the resolution of the finest lattice unit, so membership tests
+ * in lattice generation and applyLoadcase are mostly table lookups
+ */
+void Loader::buildOccupancy(SimulationConfig *simConfig) {
+    if (simConfig->lattices.empty()) return;
+
+    float voxelSize = FLT_MAX;
+    for (LatticeConfig *lattice : simConfig->lattices) {
+        voxelSize = std::min(voxelSize, float(lattice->unit[0]));
+    }
+    if (voxelSize <= 0) return;
+
+    // Collect each distinct volume once
+    vector<Volume *> volumes = vector<Volume *>();
+    auto addVolume = [&volumes](Volume *volume) {
+        if (volume != nullptr && volume->model != nullptr &&
+            find(volumes.begin(), volumes.end(), volume) == volumes.end()) {
+            volumes.push_back(volume);
+        }
+    };
+
+    for (LatticeConfig *lattice : simConfig->lattices) addVolume(lattice->volume);
+
+    vector<Loadcase *> loads = simConfig->loadQueue;
+    if (simConfig->load != nullptr) loads.push_back(simConfig->load);
+    for (Loadcase *load : loads) {
+        for (Anchor *a : load->anchors) addVolume(a->volume);
+        for (Force *f : load->forces) addVolume(f->volume);
+        for (Torque *t : load->torques) addVolume(t->volume);
+        for (Actuation *a : load->actuations) addVolume(a->volume);
+    }
+
+    for (Volume *volume : volumes) {
+        // Reuse a grid that is already at least this fine
+        OccupancyGrid &grid = volume->model->occupancy;
+        if (!grid.empty() && grid.voxelSize() <= voxelSize) continue;
+
+        volume->model->buildOccupancy(voxelSize);
+        log(QString("Voxelized volume %1: %2 voxels of %3 m").arg(
+                volume->id).arg(
+                volume->model->occupancy.voxelCount()).arg(
+                volume->model->occupancy.voxelSize()));
+    }
+
+    if (simConfig->model != nullptr && simConfig->model->occupancy.empty()) {
+        simConfig->model->buildOccupancy(voxelSize);
+    }
+}
+
 void Loader::loadVolumes(model_data *arrays, Design *design) {
     arrays->model_indices = new int[design->volumes.size()];
     arrays->colors = vector<glm::vec4>(design->volumes.size());
@@ -193,58 +351,24 @@ void Loader::loadModel(model_data *arrays, Volume *volume, uint n_volume) {
 
 
 void Loader::readSTLFromFile(model_data *arrays, QString filePath, uint n_model) {
-    int n_vert = 0;
-    int n_norm = 0;
-    int n_tria = 0;
     log("Reading STL format from " + filePath);
     if(filePath.isEmpty()) {
         return;
     } else {
-        QFile file(filePath);
+        size_t n_before = arrays->vertices.size();
+        double mbps = 0;
 
-        if(!file.open(QIODevice::ReadOnly)) {
-            return;
-        }
-
-        QTextStream in(&file);
-        int vertex = -1;
-
-        while (!in.atEnd()) {
-            QString line = in.readLine();
-            if (line.trimmed().startsWith("facet")) {
-
-                QStringList nstring = line.trimmed().split(" ");
-                glm::vec3 nvector = glm::vec3(nstring.at(2).toDouble(),
-                                              nstring.at(3).toDouble(),
-                                              nstring.at(4).toDouble());
-                arrays->normals.push_back(nvector);
-                arrays->normals.push_back(nvector);
-                arrays->normals.push_back(nvector);
-                n_norm++;
-            }
-            if (line.trimmed() == "outer loop") {
-                vertex = 0;
-            }
-            if (line.trimmed().startsWith("vertex")) {
-
-                QStringList vstring = line.trimmed().split(" ");
-                glm::vec3 vvector = glm::vec3(vstring.at(1).toDouble(),
-                                              vstring.at(2).toDouble(),
-                                              vstring.at(3).toDouble());
-                arrays->vertices.push_back(vvector);
-                n_vert++;
-            }
-            if (line.trimmed() == "endloop") {
-                vertex = -1;
-            }
+        if (!Utils::readStl(filePath.toStdString(), 1, arrays->vertices, arrays->normals, &mbps)) {
+            log("Could not read STL from " + filePath);
         }
 
-        file.close();
-        n_tria = n_vert/3;
-        log(QString("Read %1 triangles: %2 vertices and %3 normals.").arg(
+        int n_vert = int(arrays->vertices.size() - n_before);
+        int n_tria = n_vert/3;
+        log(QString("Read %1 triangles: %2 vertices and %3 normals (%4 MB/s).").arg(
                 n_tria).arg(
                 n_vert).arg(
-                n_norm));
+                n_tria).arg(
+                mbps, 0, 'f', 1));
         arrays->n_vertices = arrays->vertices.size();
         arrays->n_normals = arrays->normals.size();
         arrays->model_indices[n_model] = arrays->n_vertices;
@@ -254,7 +378,20 @@ void Loader::readSTLFromFile(model_data *arrays, QString filePath, uint n_model)
     }
 }
 
-void Loader::loadSimulation(Simulation *sim, SimulationConfig *simConfig) {
+// Loadcases applied by loadSimulation, in order
+static vector<Loadcase *> appliedLoads(SimulationConfig *simConfig) {
+    if (simConfig->load != nullptr && simConfig->loadQueue.empty()) {
+        return vector<Loadcase *>(1, simConfig->load);
+    }
+    return simConfig->loadQueue;
+}
+
+/**
+ * @brief Loader::createLattice
+ * Fills the simulation volume with the configured lattice
+ * and creates its masses and springs
+ */
+void Loader::createLattice(Simulation *sim, SimulationConfig *simConfig) {
 
     int NUM_Y = 10, NUM_X = 10;
     float SIZE = 0.05, SPACE = 0.01;
@@ -354,6 +491,23 @@ void Loader::loadSimulation(Simulation *sim, SimulationConfig *simConfig) {
 
     //loadSimFromLattice(&simConfig->lattice, sim, simConfig->lattice.unit[0]*springMult);
     loadSimFromLattice(simConfig->model, sim, simConfig->lattices);
+}
+
+void Loader::loadSimulation(Simulation *sim, SimulationConfig *simConfig) {
+
+    buildOccupancy(simConfig);
+
+    // Lattice, springs and load members of an earlier run with the same inputs
+    LatticeCache latticeCache = LatticeCache(cacheDirectory);
+    addLatticeCacheKey(latticeCache, simConfig);
+    LatticeCache::Entry cached = LatticeCache::Entry();
+    bool restored = latticeCache.load(cached) && restoreLattice(cached, sim, simConfig);
+
+    if (restored) {
+        log(QString("Loaded lattice with %1 masses from lattice cache").arg(sim->masses.size()));
+    } else {
+        createLattice(sim, simConfig);
+    }
 
     // PLANE
     if (simConfig->plane != nullptr) {
@@ -377,11 +531,18 @@ void Loader::loadSimulation(Simulation *sim, SimulationConfig *simConfig) {
     qDebug() << "Set spring diameters";
 
     // LOADCASES
-    if (simConfig->load != nullptr && simConfig->loadQueue.empty()) {
-        applyLoadcase(sim, simConfig->load);
-    } else {
-        for (Loadcase *l : simConfig->loadQueue) {
-            applyLoadcase(sim, l);
+    if (!restored) indexLoadMembers(sim);
+    for (Loadcase *l : appliedLoads(simConfig)) {
+        if (!restored) findLoadMembers(sim, l);
+        applyLoadcase(sim, l);
+    }
+    clearLoadIndex();
+
+    if (!restored) {
+        LatticeCache::Entry entry = LatticeCache::Entry();
+        storeLattice(entry, sim, simConfig);
+        if (latticeCache.save(entry)) {
+            log(QString("Cached lattice in %1").arg(QString::fromStdString(cacheDirectory)));
         }
     }
 
@@ -580,6 +741,56 @@ void Loader::loadSimulation(simulation_data *arrays, Simulation *sim, uint n_vol
 }
 
 
+// Finds the mass pairs j < k with |positions[j] - positions[k]| <= min(cutoffs[j], cutoffs[k]),
+// in the order of the double loop over j and k it replaces. Masses are binned by the
+// largest cutoff, chunks of masses are searched in parallel and merged in chunk order.
+// With origins only pairs of masses from different lattices are kept
+static void findSpringPairs(const vector<Vec> &positions, const vector<double> &cutoffs,
+                            vector<std::pair<uint32_t, uint32_t>> &pairs, vector<double> &lengths,
+                            const vector<LatticeConfig *> *origins = nullptr) {
+    pairs.clear();
+    lengths.clear();
+    if (positions.empty()) return;
+
+    vector<glm::dvec3> points = vector<glm::dvec3>();
+    points.reserve(positions.size());
+    for (const Vec &p : positions) {
+        points.emplace_back(p[0], p[1], p[2]);
+    }
+
+    SpatialGrid grid = SpatialGrid();
+    grid.build(points, *std::max_element(cutoffs.begin(), cutoffs.end()));
+
+    long n = long(positions.size());
+    long chunks = (n + SPRING_CHUNK - 1) / SPRING_CHUNK;
+    vector<vector<std::pair<uint32_t, uint32_t>>> chunkPairs(chunks);
+    vector<vector<double>> chunkLengths(chunks);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (long c = 0; c < chunks; c++) {
+        vector<std::pair<uint32_t, double>> near = vector<std::pair<uint32_t, double>>();
+        for (long j = c * SPRING_CHUNK; j < std::min(n, (c + 1) * SPRING_CHUNK); j++) {
+            near.clear();
+            grid.forEachNear(points[j], [&](uint32_t k) {
+                if (k <= j || (origins != nullptr && (*origins)[j] == (*origins)[k])) return;
+                double dist = (positions[j] - positions[k]).norm();
+                if (dist <= std::min(cutoffs[j], cutoffs[k])) near.emplace_back(k, dist);
+            });
+            std::sort(near.begin(), near.end());
+
+            for (const std::pair<uint32_t, double> &k : near) {
+                chunkPairs[c].emplace_back(uint32_t(j), k.first);
+                chunkLengths[c].push_back(k.second);
+            }
+        }
+    }
+
+    for (long c = 0; c < chunks; c++) {
+        pairs.insert(pairs.end(), chunkPairs[c].begin(), chunkPairs[c].end());
+        lengths.insert(lengths.end(), chunkLengths[c].begin(), chunkLengths[c].end());
+    }
+}
+
 void Loader::loadSimFromLattice(simulation_data *arrays, Simulation *sim, vector <LatticeConfig *> lattices) {
     // Include varying springMult by looking at the type of the LatticeConfig
     float springCutoff = 0.0;
@@ -594,26 +805,38 @@ void Loader::loadSimFromLattice(simulation_data *arrays, Simulation *sim, vector
         //sim->getMassByIndex(i)->damping = 0.9999;
     }
 
-    for (int j = 0; j < sim->masses.size() - 1; j++) {
-        Mass *massj = sim->masses[j];
-
-        float jCutoff, kCutoff;
-
-        jCutoff = arrays->pointOrigins.at(j)->unit[0] * springMult;
-
-        for (int k = j+1; k < sim->masses.size(); k++) {
-            Mass *massk = sim->masses[k];
-            double dist = (massj->origpos - massk->origpos).norm();
-
-            kCutoff = arrays->pointOrigins.at(k)->unit[0] * springMult;
+    // Springs between masses closer than the smaller of their cutoffs
+    vector<Vec> positions = vector<Vec>();
+    vector<double> cutoffs = vector<double>();
+    for (ulong i = 0; i < sim->masses.size(); i++) {
+        positions.push_back(sim->masses[i]->origpos);
+        cutoffs.push_back(float(arrays->pointOrigins.at(i)->unit[0] * springMult));
+    }
 
-            springCutoff = std::min(jCutoff, kCutoff);
+    vector<std::pair<uint32_t, uint32_t>> pairs;
+    vector<double> lengths;
+    if (lattices[0]->fill == LatticeConfig::CUBIC_FILL) {
+        // Cubic fills come with their template springs, only the seams
+        // between lattices are left to the distance search
+        pairs = arrays->latticeSprings;
+        if (lattices.size() > 1) {
+            vector<std::pair<uint32_t, uint32_t>> seams;
+            findSpringPairs(positions, cutoffs, seams, lengths, &arrays->pointOrigins);
+            pairs.insert(pairs.end(), seams.begin(), seams.end());
+            std::sort(pairs.begin(), pairs.end());
+        }
 
-            if (dist <= springCutoff) {
-                sim->createSpring(massj, massk);
-                sim->springs.back()->setRestLength(dist);
-            }
+        lengths.clear();
+        for (const std::pair<uint32_t, uint32_t> &p : pairs) {
+            lengths.push_back((positions[p.first] - positions[p.second]).norm());
         }
+    } else {
+        findSpringPairs(positions, cutoffs, pairs, lengths);
+    }
+
+    for (ulong i = 0; i < pairs.size(); i++) {
+        sim->createSpring(sim->masses[pairs[i].first], sim->masses[pairs[i].second]);
+        sim->springs.back()->setRestLength(lengths[i]);
     }
     qDebug() << sim->springs.size();
 
@@ -698,19 +921,18 @@ void Loader::loadSimFromLattice(LatticeConfig *lattice, Simulation *sim, double
     }
 
     // Create springs
-    for (int j = 0; j < sim->masses.size() - 1; j++) {
-        for (int k = j+1; k < sim->masses.size(); k++) {
-
-            Mass *massj = sim->masses[j];
-            Mass *massk = sim->masses[k];
-            double dist = (massj->pos - massk->pos).norm();
+    vector<Vec> positions = vector<Vec>();
+    for (Mass *m : sim->masses) {
+        positions.push_back(m->pos);
+    }
 
-            if (dist <= springCutoff) {
+    vector<std::pair<uint32_t, uint32_t>> pairs;
+    vector<double> lengths;
+    findSpringPairs(positions, vector<double>(positions.size(), springCutoff), pairs, lengths);
 
-                sim->createSpring(massj, massk);
-                sim->springs.back()->setRestLength(dist);
-            }
-        }
+    for (ulong i = 0; i < pairs.size(); i++) {
+        sim->createSpring(sim->masses[pairs[i].first], sim->masses[pairs[i].second]);
+        sim->springs.back()->setRestLength(lengths[i]);
     }
 
     log(QString("Loaded simulation with %1 masses and %2 springs.")
@@ -831,38 +1053,167 @@ void Loader::loadBarsFromSim(Simulation *sim, bar_data *output, bool crossSectio
 
 }
 
+/**
+ * @brief Loader::indexLoadMembers
+ * Bins the masses and spring midpoints once for all loadcases,
+ * with about LOAD_CELL_POINTS of them per cell
+ */
+void Loader::indexLoadMembers(Simulation *sim) {
+
+    massPoints.resize(sim->masses.size());
+    for (ulong i = 0; i < sim->masses.size(); i++) {
+        Vec &pos = sim->masses[i]->pos;
+        massPoints[i] = glm::dvec3(pos[0], pos[1], pos[2]);
+    }
+    springPoints.resize(sim->springs.size());
+    for (ulong i = 0; i < sim->springs.size(); i++) {
+        Vec mid = 0.5 * (sim->springs[i]->_left->pos + sim->springs[i]->_right->pos);
+        springPoints[i] = glm::dvec3(mid[0], mid[1], mid[2]);
+    }
+
+    massGrid.build(massPoints, SpatialGrid::cellSizeFor(massPoints, LOAD_CELL_POINTS));
+    springGrid.build(springPoints, SpatialGrid::cellSizeFor(springPoints, LOAD_CELL_POINTS));
+}
+
+/**
+ * @brief Loader::clearLoadIndex
+ * Frees the load member grids once the loadcases are applied
+ */
+void Loader::clearLoadIndex() {
+    massGrid.clear();
+    springGrid.clear();
+    vector<glm::dvec3>().swap(massPoints);
+    vector<glm::dvec3>().swap(springPoints);
+}
+
+// Indices of the points within the bounds of volume, ascending.
+// Only these can be inside the volume
+static void volumeCandidates(Volume *volume, const SpatialGrid &grid, const vector<glm::dvec3> &points,
+                             vector<uint32_t> &candidates) {
+    glm::dvec3 lo, hi;
+    if (volume->model != nullptr) {
+        const boundingBox<glm::vec3> &bounds = volume->model->bounds;
+        lo = glm::dvec3(bounds.minCorner.x, bounds.minCorner.y, bounds.minCorner.z);
+        hi = glm::dvec3(bounds.maxCorner.x, bounds.maxCorner.y, bounds.maxCorner.z);
+    } else {
+        Vec minp, maxp;
+        volume->geometry->boundingPoints(minp, maxp);
+        lo = glm::dvec3(minp[0], minp[1], minp[2]);
+        hi = glm::dvec3(maxp[0], maxp[1], maxp[2]);
+    }
+    glm::dvec3 extent = hi - lo;
+    double pad = EPSILON * (1 + std::max(extent.x, std::max(extent.y, extent.z)));
+    lo = lo - glm::dvec3(pad);
+    hi = hi + glm::dvec3(pad);
+
+    candidates.clear();
+    grid.forEachInBox(lo, hi, [&](uint32_t i) {
+        const glm::dvec3 &p = points[i];
+        if (p.x >= lo.x && p.y >= lo.y && p.z >= lo.z && p.x <= hi.x && p.y <= hi.y && p.z <= hi.z) {
+            candidates.push_back(i);
+        }
+    });
+    std::sort(candidates.begin(), candidates.end());
+}
+
+/**
+ * @brief Loader::findLoadMembers
+ * Collects the masses inside each anchor, force and torque volume
+ * and the springs inside each actuation volume of a loadcase.
+ * Only masses and midpoints within the volume bounds get the inside tests
+ */
+void Loader::findLoadMembers(Simulation *sim, Loadcase *load) {
+
+    if (massPoints.size() != sim->masses.size() || springPoints.size() != sim->springs.size()) {
+        indexLoadMembers(sim);
+    }
+
+    vector<uint32_t> candidates = vector<uint32_t>();
+    vector<glm::vec3> candidatePos = vector<glm::vec3>();
+    vector<uint8_t> inside = vector<uint8_t>();
+
+    auto classifyMasses = [&](Volume *volume, vector<Mass *> &masses) {
+        volumeCandidates(volume, massGrid, massPoints, candidates);
+        ulong n = candidates.size();
+        if (volume->model != nullptr) {
+            candidatePos.resize(n);
+            for (ulong i = 0; i < n; i++) {
+                const glm::dvec3 &p = massPoints[candidates[i]];
+                candidatePos[i] = glm::vec3(p.x, p.y, p.z);
+            }
+            volume->model->classifyPoints(candidatePos, inside, 0);
+        } else {
+            inside.resize(n);
+            for (ulong i = 0; i < n; i++) {
+                inside[i] = volume->geometry->isInside(sim->masses[candidates[i]]->pos);
+            }
+        }
+
+        masses.clear(); // Clear mass ptr cache
+        for (ulong i = 0; i < n; i++) {
+            if (inside[i]) masses.push_back(sim->masses[candidates[i]]);
+        }
+    };
+
+    for (Anchor *anchor : load->anchors) {
+        //if (anchor->type == "surface") { nToFix = surfacePoints; }
+        classifyMasses(anchor->volume, anchor->masses);
+    }
+    for (Force *force : load->forces) {
+        classifyMasses(force->volume, force->masses);
+    }
+    for (Torque *torque : load->torques) {
+        classifyMasses(torque->volume, torque->masses);
+    }
+
+    for (Actuation *actuation : load->actuations) {
+        Volume *actVol = actuation->volume;
+        actuation->springs.clear();
+
+        if (actVol->model != nullptr) {
+            // The midpoint has to be inside, so springs are culled by midpoint
+            volumeCandidates(actVol, springGrid, springPoints, candidates);
+            ulong n = candidates.size();
+            vector<glm::vec3> leftPos = vector<glm::vec3>(n);
+            vector<glm::vec3> rightPos = vector<glm::vec3>(n);
+            vector<glm::vec3> midPos = vector<glm::vec3>(n);
+            for (ulong i = 0; i < n; i++) {
+                Spring *s = sim->springs[candidates[i]];
+                leftPos[i] = glm::vec3(s->_left->pos[0], s->_left->pos[1], s->_left->pos[2]);
+                rightPos[i] = glm::vec3(s->_right->pos[0], s->_right->pos[1], s->_right->pos[2]);
+                midPos[i] = 0.5f * (rightPos[i] + leftPos[i]);
+            }
+
+            vector<uint8_t> leftInside, rightInside, midInside;
+            actVol->model->classifyPoints(leftPos, leftInside, 0);
+            actVol->model->classifyPoints(rightPos, rightInside, 0);
+            actVol->model->classifyPoints(midPos, midInside, 0);
+
+            for (ulong i = 0; i < n; i++) {
+                if (midInside[i] && (leftInside[i] || rightInside[i])) {
+                    actuation->springs.push_back(sim->springs[candidates[i]]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Loader::applyLoadcase
+ * Applies the anchors, forces, torques and actuations of a loadcase
+ * to the members found by findLoadMembers
+ */
 void Loader::applyLoadcase(Simulation *sim, Loadcase *load) {
 
     for (Anchor *anchor : load->anchors) {
         Volume *anchorVol = anchor->volume;
-        anchor->masses.clear(); // Clear mass ptr cache
 
         int fixedMasses = 0;
-        int nToFix = sim->masses.size();
-        //if (anchor->type == "surface") { nToFix = surfacePoints; }
-        
-        for (int i = 0; i < nToFix; i++) {
-            Mass* mass = sim->masses[i];
-            if (anchorVol->model != nullptr) {
-                glm::vec3 massPos = glm::vec3(mass->pos[0], mass->pos[1], mass->pos[2]);
-
-                // Check for anchor constraint
-                if (anchorVol->model->isInside(massPos, 0)) {
-
-                    mass->fix();
-                    anchor->masses.push_back(mass);
-                    fixedMasses++;
-                }
-            } else {
-                if (anchorVol->geometry->isInside(mass->pos)) {
-                    mass->fix();
-                    anchor->masses.push_back(mass);
-                    fixedMasses++;
-                }
-            }
+        for (Mass *mass : anchor->masses) {
+            mass->fix();
+            fixedMasses++;
         }
 
-        
         log(tr("Anchored %1 masses with volume '%2'").arg(fixedMasses).arg(anchorVol->id));
         cout << "Anchored " << fixedMasses << " masses with volume " << anchorVol->id.toStdString() << ".\n";
     }
@@ -871,39 +1222,14 @@ void Loader::applyLoadcase(Simulation *sim, Loadcase *load) {
         Volume *forceVol = force->volume;
         qDebug() << "Applying" << force->magnitude[0] << force->magnitude[1] << force->magnitude[2];
 
-        force->masses.clear(); // Clear mass ptr cache
-
         int forceMasses = 0;
-        for (Mass *mass : sim->masses) {
-            glm::vec3 massPos = glm::vec3(mass->pos[0], mass->pos[1], mass->pos[2]);
-
-            // Check for force constraint
-            if (forceVol->model != nullptr) {
-                if (forceVol->model->isInside(massPos, 0)) {
-
-                    mass->extduration += force->duration;
-
-                    if (mass->extduration < 0) {
-                        mass->extduration = DBL_MAX;
-                    }
-
-                    force->masses.push_back(mass);
-                    forceMasses++;
-                }
+        for (Mass *mass : force->masses) {
+            mass->extduration += force->duration;
 
-            } else {
-                if (forceVol->geometry->isInside(mass->pos)) {
-
-                    mass->extduration += force->duration;
-
-                    if (mass->extduration < 0) {
-                        mass->extduration = DBL_MAX;
-                    }
-
-                    force->masses.push_back(mass);
-                    forceMasses++;
-                }
+            if (mass->extduration < 0) {
+                mass->extduration = DBL_MAX;
             }
+            forceMasses++;
         }
         if (forceMasses > 0) {
             Vec distributedForce = force->magnitude / forceMasses;
@@ -921,39 +1247,14 @@ void Loader::applyLoadcase(Simulation *sim, Loadcase *load) {
         Volume *torqueVol = torque->volume;
         qDebug() << "Applying Torque: " << torque->magnitude[0] << torque->magnitude[1] << torque->magnitude[2];
 
-        torque->masses.clear(); // Clear mass ptr cache
-
         int torqueMasses = 0;
-        for (Mass *mass : sim->masses) {
-            glm::vec3 massPos = glm::vec3(mass->pos[0], mass->pos[1], mass->pos[2]);
-
-            // Check for force constraint
-            if (torqueVol->model != nullptr) {
-                if (torqueVol->model->isInside(massPos, 0)) {
-
-                    mass->extduration += torque->duration;
-
-                    if (mass->extduration < 0) {
-                        mass->extduration = DBL_MAX;
-                    }
+        for (Mass *mass : torque->masses) {
+            mass->extduration += torque->duration;
 
-                    torque->masses.push_back(mass);
-                    torqueMasses++;
-                }
-
-            } else {
-                if (torqueVol->geometry->isInside(mass->pos)) {
-
-                    mass->extduration += torque->duration;
-
-                    if (mass->extduration < 0) {
-                        mass->extduration = DBL_MAX;
-                    }
-
-                    torque->masses.push_back(mass);
-                    torqueMasses++;
-                }
+            if (mass->extduration < 0) {
+                mass->extduration = DBL_MAX;
             }
+            torqueMasses++;
         }
         if (torqueMasses > 0) {
             Vec torqueMag = torque->magnitude;
@@ -974,22 +1275,7 @@ void Loader::applyLoadcase(Simulation *sim, Loadcase *load) {
     for (Actuation *actuation : load->actuations) {
         Volume *actVol = actuation->volume;
 
-        int actSprings = 0;
-        for (Spring *s : sim->springs) {
-            glm::vec3 massPos1 = glm::vec3(s->_left->pos[0], s->_left->pos[1], s->_left->pos[2]);
-            glm::vec3 massPos2 = glm::vec3(s->_right->pos[0], s->_right->pos[1], s->_right->pos[2]);
-
-            if (actVol->model != nullptr) {
-                glm::vec3 springMid = 0.5f * (massPos2 + massPos1);
-                bool leftInside = actVol->model->isInside(massPos1, 0);
-                bool rightInside = actVol->model->isInside(massPos2, 0);
-                bool midInside = actVol->model->isInside(springMid, 0);
-                if (midInside && (leftInside || rightInside)) {
-                    actuation->springs.push_back(s);
-                    actSprings++;
-                }
-            }
-        }
+        int actSprings = int(actuation->springs.size());
         if (actSprings > 0) {
             int type = 3;
             switch(actuation->wave) {
@@ -1020,6 +1306,218 @@ void Loader::applyLoadcase(Simulation *sim, Loadcase *load) {
     //sim->masses.front()->force = Vec(100, 0, 0);
 }
 
+/**
+ * @brief Loader::addLatticeCacheKey
+ * Feeds everything the lattice and the load members depend on into
+ * the lattice cache key: lattice settings and every volume involved,
+ * with the contents of its mesh file, and the random seed for space fill lattices
+ */
+void Loader::addLatticeCacheKey(LatticeCache &cache, SimulationConfig *simConfig) {
+    if (cacheDirectory.empty()) return;
+
+    auto addVolume = [&](Volume *volume) {
+        cache.addString(volume->primitive);
+        cache.addString(volume->url.path());
+        cache.addValue(volumeScale(volume));
+        if (volume->primitive == "stl") {
+            cache.addFile(volume->url.path().toStdString());
+        }
+    };
+
+    addVolume(simConfig->volume);
+    cache.addValue(simConfig->lattices.size());
+    for (LatticeConfig *lattice : simConfig->lattices) {
+        addVolume(lattice->volume);
+        cache.addValue(lattice->fill);
+        cache.addValue(lattice->sampling);
+        cache.addValue(lattice->cell);
+        cache.addValue(lattice->hull);
+        cache.addValue(lattice->unit[0]);
+        cache.addValue(lattice->unit[1]);
+        cache.addValue(lattice->unit[2]);
+        // Space fill points are drawn from Rng, the seed replays them
+        if (lattice->fill == LatticeConfig::SPACE_FILL) {
+            cache.addBits(Rng::currentSeed());
+        }
+    }
+
+    for (Loadcase *load : appliedLoads(simConfig)) {
+        cache.addValue(load->anchors.size());
+        for (Anchor *anchor : load->anchors) addVolume(anchor->volume);
+        cache.addValue(load->forces.size());
+        for (Force *force : load->forces) addVolume(force->volume);
+        cache.addValue(load->torques.size());
+        for (Torque *torque : load->torques) addVolume(torque->volume);
+        cache.addValue(load->actuations.size());
+        for (Actuation *actuation : load->actuations) addVolume(actuation->volume);
+    }
+}
+
+/**
+ * @brief Loader::storeLattice
+ * Copies the masses, springs and load members of a loaded simulation into a cache entry
+ */
+void Loader::storeLattice(LatticeCache::Entry &entry, Simulation *sim, SimulationConfig *simConfig) {
+    simulation_data *arrays = simConfig->model;
+
+    unordered_map<Mass *, uint32_t> massIds;
+    for (ulong i = 0; i < sim->masses.size(); i++) {
+        Mass *m = sim->masses[i];
+        massIds[m] = uint32_t(i);
+        entry.positions.push_back(m->origpos[0]);
+        entry.positions.push_back(m->origpos[1]);
+        entry.positions.push_back(m->origpos[2]);
+
+        ulong origin = find(simConfig->lattices.begin(), simConfig->lattices.end(), arrays->pointOrigins.at(i))
+                       - simConfig->lattices.begin();
+        entry.origins.push_back(uint32_t(origin));
+    }
+
+    unordered_map<Spring *, uint32_t> springIds;
+    for (ulong i = 0; i < sim->springs.size(); i++) {
+        Spring *s = sim->springs[i];
+        springIds[s] = uint32_t(i);
+        entry.springs.push_back(massIds.at(s->_left));
+        entry.springs.push_back(massIds.at(s->_right));
+        entry.restLengths.push_back(s->_rest);
+    }
+
+    auto addMasses = [&](const vector<Mass *> &masses) {
+        entry.memberStart.push_back(uint32_t(entry.members.size()));
+        for (Mass *m : masses) entry.members.push_back(massIds.at(m));
+    };
+    for (Loadcase *load : appliedLoads(simConfig)) {
+        for (Anchor *anchor : load->anchors) addMasses(anchor->masses);
+        for (Force *force : load->forces) addMasses(force->masses);
+        for (Torque *torque : load->torques) addMasses(torque->masses);
+        for (Actuation *actuation : load->actuations) {
+            entry.memberStart.push_back(uint32_t(entry.members.size()));
+            for (Spring *s : actuation->springs) entry.members.push_back(springIds.at(s));
+        }
+    }
+    entry.memberStart.push_back(uint32_t(entry.members.size()));
+}
+
+/**
+ * @brief Loader::restoreLattice
+ * Creates the masses and springs of a cached entry and sets the load members.
+ * False, with nothing created, when the entry does not fit the configuration
+ */
+bool Loader::restoreLattice(const LatticeCache::Entry &entry, Simulation *sim, SimulationConfig *simConfig) {
+    simulation_data *arrays = simConfig->model;
+    vector<Loadcase *> loads = appliedLoads(simConfig);
+    ulong nMasses = entry.origins.size();
+    ulong nSprings = entry.restLengths.size();
+
+    // Member lists have to line up with the loads, mass lists first then spring lists
+    vector<ulong> limits = vector<ulong>();
+    for (Loadcase *load : loads) {
+        limits.insert(limits.end(), load->anchors.size() + load->forces.size() + load->torques.size(), nMasses);
+        limits.insert(limits.end(), load->actuations.size(), nSprings);
+    }
+    if (entry.memberStart.size() != limits.size() + 1) return false;
+    for (ulong l = 0; l < limits.size(); l++) {
+        for (uint32_t m = entry.memberStart[l]; m < entry.memberStart[l + 1]; m++) {
+            if (entry.members[m] >= limits[l]) return false;
+        }
+    }
+    for (uint32_t origin : entry.origins) {
+        if (origin >= simConfig->lattices.size()) return false;
+    }
+
+    arrays->lattice.clear();
+    arrays->pointOrigins.clear();
+    arrays->latticeSprings.clear();
+    for (ulong i = 0; i < nMasses; i++) {
+        arrays->lattice.emplace_back(entry.positions[3 * i], entry.positions[3 * i + 1], entry.positions[3 * i + 2]);
+        arrays->pointOrigins.push_back(simConfig->lattices[entry.origins[i]]);
+        sim->createMass(Vec(entry.positions[3 * i], entry.positions[3 * i + 1], entry.positions[3 * i + 2]));
+    }
+    for (ulong i = 0; i < nSprings; i++) {
+        arrays->latticeSprings.emplace_back(entry.springs[2 * i], entry.springs[2 * i + 1]);
+        sim->createSpring(sim->masses[entry.springs[2 * i]], sim->masses[entry.springs[2 * i + 1]]);
+        sim->springs.back()->setRestLength(entry.restLengths[i]);
+    }
+
+    ulong list = 0;
+    auto setMasses = [&](vector<Mass *> &masses) {
+        masses.clear();
+        for (uint32_t m = entry.memberStart[list]; m < entry.memberStart[list + 1]; m++) {
+            masses.push_back(sim->masses[entry.members[m]]);
+        }
+        list++;
+    };
+    for (Loadcase *load : loads) {
+        for (Anchor *anchor : load->anchors) setMasses(anchor->masses);
+        for (Force *force : load->forces) setMasses(force->masses);
+        for (Torque *torque : load->torques) setMasses(torque->masses);
+        for (Actuation *actuation : load->actuations) {
+            actuation->springs.clear();
+            for (uint32_t m = entry.memberStart[list]; m < entry.memberStart[list + 1]; m++) {
+                actuation->springs.push_back(sim->springs[entry.members[m]]);
+            }
+            list++;
+        }
+    }
+    return true;
+}
+
+// Marks the grid points (xLines[x], yLines[y], zLines[z]) inside bvh, in z, y, x order,
+// with one parity ray per (y, z) row. Rows the ray cannot decide go to classify
+static void classifyGrid(const BVH &bvh, const vector<float> &xLines, const vector<float> &yLines,
+                         const vector<float> &zLines,
+                         const std::function<void(const vector<glm::vec3> &, vector<uint8_t> &)> &classify,
+                         vector<uint8_t> &inside) {
+    size_t nx = xLines.size();
+    long ny = long(yLines.size());
+    long rows = ny * long(zLines.size());
+
+    inside.assign(nx * size_t(rows), 0);
+    vector<uint8_t> ambiguous = vector<uint8_t>(size_t(rows), 1);
+
+    if (!bvh.empty()) {
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (long row = 0; row < rows; row++) {
+            ambiguous[row] = !bvh.insideRow(yLines[row % ny], zLines[row / ny], xLines, &inside[size_t(row) * nx]);
+        }
+    }
+
+    vector<glm::vec3> batch = vector<glm::vec3>();
+    for (long row = 0; row < rows; row++) {
+        if (!ambiguous[row]) continue;
+        for (size_t x = 0; x < nx; x++) {
+            batch.emplace_back(xLines[x], yLines[row % ny], zLines[row / ny]);
+        }
+    }
+    if (batch.empty()) return;
+
+    vector<uint8_t> batchInside;
+    classify(batch, batchInside);
+
+    size_t b = 0;
+    for (long row = 0; row < rows; row++) {
+        if (!ambiguous[row]) continue;
+        std::copy(batchInside.begin() + b, batchInside.begin() + b + nx, inside.begin() + size_t(row) * nx);
+        b += nx;
+    }
+    qDebug() << "Classified" << batch.size() / nx << "of" << rows << "grid rows point by point";
+}
+
+// Splits every step between consecutive lines into divisions equal steps
+static void subdivideLines(vector<float> &lines, int divisions) {
+    if (divisions <= 1 || lines.size() < 2) return;
+
+    vector<float> fine = vector<float>();
+    fine.reserve((lines.size() - 1) * divisions + 1);
+    for (ulong i = 0; i + 1 < lines.size(); i++) {
+        for (int s = 0; s < divisions; s++) {
+            fine.push_back(lines[i] + s * (lines[i + 1] - lines[i]) / divisions);
+        }
+    }
+    fine.push_back(lines.back());
+    lines = fine;
+}
+
 // Creates a lattice with a grid split dimX x dimY x dimZ
 void Loader::createGridLattice(simulation_data *arrays, int dimX, int dimY, int dimZ) {
     float *grid;
@@ -1042,15 +1540,16 @@ void Loader::createGridLattice(simulation_data *arrays, SimulationConfig *simCon
     vector<glm::vec3> grid = vector<glm::vec3>();
     vector<LatticeConfig *> latticeConfigs = simConfig->lattices;
     vector<LatticeConfig *> pointOrigins = vector<LatticeConfig *>();
+    vector<std::pair<uint32_t, uint32_t>> springs = vector<std::pair<uint32_t, uint32_t>>();
 
     for (LatticeConfig *latticeBox : latticeConfigs) {
         model_data *latticeVol = latticeBox->volume->model;
+        LatticeTemplate cell = LatticeTemplate(latticeBox->cell);
         float cutoff = float(latticeBox->unit[0]);
         vector<glm::vec3> gridTemp = vector<glm::vec3>();
 
         glm::vec3 startCorner = latticeVol->bounds.minCorner;
         glm::vec3 endCorner = latticeVol->bounds.maxCorner;
-        glm::vec3 gridPoint;
 
         vector<float> xLines = vector<float>();
         vector<float> yLines = vector<float>();
@@ -1092,31 +1591,55 @@ void Loader::createGridLattice(simulation_data *arrays, SimulationConfig *simCon
         qDebug() << "Lattice bottom corner " << xLines[0] << "," << yLines[0] << "," << zLines[0];
         qDebug() << "Lattice top corner " << xLines.back() << "," << yLines.back() << "," << zLines.back();
 
-        vector <glm::vec3> model = vector<glm::vec3>();
+        // Cells with face or body center nodes use half unit steps
+        subdivideLines(xLines, cell.divisions());
+        subdivideLines(yLines, cell.divisions());
+        subdivideLines(zLines, cell.divisions());
+
+        // Check inside with one ray per grid row and volume
+        vector<uint8_t> inSim, inLattice;
+        classifyGrid(arrays->bvh, xLines, yLines, zLines,
+                     [arrays](const vector<glm::vec3> &points, vector<uint8_t> &inside) {
+                         arrays->classifyPoints(points, inside);
+                     }, inSim);
+        BVH noBVH = BVH();
+        const BVH &latticeBVH = latticeVol->bvh.empty() ? noBVH : latticeVol->bvh[0];
+        classifyGrid(latticeBVH, xLines, yLines, zLines,
+                     [latticeVol](const vector<glm::vec3> &points, vector<uint8_t> &inside) {
+                         latticeVol->classifyPoints(points, inside, 0);
+                     }, inLattice);
+
+        for (ulong i = 0; i < inSim.size(); i++) {
+            inSim[i] = inSim[i] && inLattice[i];
+        }
 
-        // Populate grid and check inside
-        for (ulong z = 0; z < zLines.size(); z++) {
-            for (ulong y = 0; y < yLines.size(); y++) {
-                for (ulong x = 0; x < xLines.size(); x++) {
-                    gridPoint = glm::vec3(xLines[x], yLines[y], zLines[z]);
+        // Nodes and springs straight from the cell stencil
+        vector<uint32_t> nodes;
+        vector<std::pair<uint32_t, uint32_t>> cellSprings;
+        cell.connect(xLines.size(), yLines.size(), zLines.size(), inSim, nodes, cellSprings);
+
+        for (uint32_t n : nodes) {
+            // Add to lattice
+            gridTemp.emplace_back(xLines[n % xLines.size()],
+                                  yLines[(n / xLines.size()) % yLines.size()],
+                                  zLines[n / (xLines.size() * yLines.size())]);
+            pointOrigins.push_back(latticeBox);
+        }
 
-                    if (arrays->isInside(gridPoint) && latticeVol->isInside(gridPoint, 0)) {
-                        // Add to lattice
-                        gridTemp.push_back(gridPoint);
-                        pointOrigins.push_back(latticeBox);
-                    }
-                }
-            }
+        uint32_t base = uint32_t(grid.size());
+        for (const std::pair<uint32_t, uint32_t> &s : cellSprings) {
+            springs.emplace_back(base + s.first, base + s.second);
         }
 
-        qDebug() << "Found all points in lattice" << latticeBox->volume->id;
+        qDebug() << "Found all points in lattice" << latticeBox->volume->id << latticeBox->cellName() << "cells";
         grid.insert(grid.end(), gridTemp.begin(), gridTemp.end());
     }
 
     // Set lattice property
     arrays->lattice = grid;
     arrays->pointOrigins = pointOrigins;
-    qDebug() << "Created grid lattice" << arrays->lattice.size();
+    arrays->latticeSprings = springs;
+    qDebug() << "Created grid lattice" << arrays->lattice.size() << "with" << springs.size() << "springs";
 }
 
 // Creates a lattice with a grid based on a cutoff edge length
@@ -1132,7 +1655,6 @@ void Loader::createGridLattice(Polygon *geometryBound, LatticeConfig &lattice, f
     vector<float> yLines = vector<float>();
     vector<float> zLines = vector<float>();
 
-    Vec gridPoint;
     float endDiff;
 
     for (float x = startCorner[0]; x <= endCorner[0]; x += cutoff) {
@@ -1167,15 +1689,25 @@ void Loader::createGridLattice(Polygon *geometryBound, LatticeConfig &lattice, f
     qDebug() << "Lattice bottom corner " << xLines[0] << "," << yLines[0] << "," << zLines[0];
     qDebug() << "Lattice top corner " << xLines.back() << "," << yLines.back() << "," << zLines.back();
 
-    // Populate grid and check inside
+    // Check inside with one ray per grid row
+    if (geometryBound->bvh.empty()) geometryBound->buildBVH();
+    vector<uint8_t> inside;
+    classifyGrid(geometryBound->bvh, xLines, yLines, zLines,
+                 [geometryBound](const vector<glm::vec3> &points, vector<uint8_t> &flags) {
+                     flags.resize(points.size());
+                     for (ulong i = 0; i < points.size(); i++) {
+                         flags[i] = geometryBound->isInside(Vec(points[i].x, points[i].y, points[i].z));
+                     }
+                 }, inside);
+
+    // Populate grid
+    ulong i = 0;
     for (ulong z = 0; z < zLines.size(); z++) {
         for (ulong y = 0; y < yLines.size(); y++) {
-            for (ulong x = 0; x < xLines.size(); x++) {
-                gridPoint = Vec(xLines[x], yLines[y], zLines[z]);
-
-                if (geometryBound->isInside(gridPoint)) {
+            for (ulong x = 0; x < xLines.size(); x++, i++) {
+                if (inside[i]) {
                     // Add to lattice
-                    grid.push_back(gridPoint);
+                    grid.push_back(Vec(xLines[x], yLines[y], zLines[z]));
                 }
             }
         }
@@ -1186,6 +1718,60 @@ void Loader::createGridLattice(Polygon *geometryBound, LatticeConfig &lattice, f
     qDebug() << "Created grid lattice" << lattice.vertices.size();
 }
 
+// Draws n uniform random points inside both the simulation volume and the
+// lattice volume, and farther than cutoff from the hull when requested.
+// Points come from voxels of the lattice volume bounds, see
+// LatticeSampler::stratified, so only voxels crossed by a surface test points.
+void Loader::sampleInteriorPoints(simulation_data *arrays, model_data *latticeVol, float cutoff,
+                                  bool includeHull, int n, vector<glm::vec3> &points) {
+
+    points.clear();
+    points.reserve(n);
+
+    // Voxels away from both surfaces take the state of their center
+    auto classify = [&](const vector<glm::vec3> &centers, float radius, vector<uint8_t> &states) {
+        vector<uint8_t> inSim, inLattice;
+        arrays->classifyPoints(centers, inSim);
+        latticeVol->classifyPoints(centers, inLattice, 0);
+        states.assign(centers.size(), OccupancyGrid::OUTSIDE);
+
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (long i = 0; i < long(centers.size()); i++) {
+            bool nearSim = arrays->isCloseToEdge(centers[i], radius);
+            if (!nearSim && !inSim[i]) continue;
+            bool nearLattice = latticeVol->isCloseToEdge(centers[i], radius, 0);
+            if (!nearLattice && !inLattice[i]) continue;
+
+            OccupancyGrid::Cell state = (nearSim || nearLattice) ? OccupancyGrid::BOUNDARY : OccupancyGrid::INSIDE;
+            if (includeHull) {
+                // Whole voxel within cutoff of the hull, or partly
+                if (cutoff > radius && arrays->isCloseToEdge(centers[i], cutoff - radius)) continue;
+                if (arrays->isCloseToEdge(centers[i], cutoff + radius)) state = OccupancyGrid::BOUNDARY;
+            }
+            states[i] = state;
+        }
+    };
+
+    auto valid = [&](const vector<glm::vec3> &batch, vector<uint8_t> &accepted) {
+        vector<uint8_t> inSim, inLattice;
+        arrays->classifyPoints(batch, inSim);
+        latticeVol->classifyPoints(batch, inLattice, 0);
+        accepted.assign(batch.size(), 0);
+
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (long i = 0; i < long(batch.size()); i++) {
+            accepted[i] = inSim[i] && inLattice[i] && !(includeHull && arrays->isCloseToEdge(batch[i], cutoff));
+        }
+    };
+
+    LatticeSampler sampler = LatticeSampler(latticeVol->bounds.minCorner, latticeVol->bounds.maxCorner, cutoff);
+    sampler.stratified(size_t(n), classify, valid, points);
+
+    if (int(points.size()) < n) {
+        log("Could not place lattice points inside the volume");
+    }
+}
+
 // Creates a lattice with random pseudo-evenly-spacedd interal points
 void Loader::createSpaceLattice(simulation_data *arrays, SimulationConfig *simConfig) {
     log("Creating space lattice.");
@@ -1200,31 +1786,43 @@ void Loader::createSpaceLattice(simulation_data *arrays, SimulationConfig *simCo
     
     if (includeHull) {
 		
-        // Add hull vertices
+        // Add hull vertices, duplicates found by exact position
+        unordered_map<Vec, uint32_t, vec_hash> hullIndex = unordered_map<Vec, uint32_t, vec_hash>();
+        hullIndex.reserve(arrays->vertices.size());
         for (uint i = 0; i < arrays->vertices.size(); i++) {
-            bool existsInLattice = false;
-
-            for (uint l = 0; l < lattice.size(); l++) {
-                if (arrays->vertices[i] == lattice[l]) {
-                    existsInLattice = true;
-                    arrays->hull.push_back(l);
-                }
+            const glm::vec3 &v = arrays->vertices[i];
+            auto found = hullIndex.emplace(Vec(v.x, v.y, v.z), uint32_t(lattice.size()));
+            arrays->hull.push_back(found.first->second);
+            if (found.second) {
+                lattice.push_back(v);
+                surfacePoints++;
             }
-            if (!existsInLattice) {
-                arrays->hull.push_back(lattice.size());
-                lattice.push_back(arrays->vertices[i]);
-				surfacePoints++;
-                for(LatticeConfig *latticeBox : latticeConfigs) {
-                    if (latticeBox->volume->model->isInside(arrays->vertices[i], 0)) {
-                        pointOrigins.push_back(latticeBox);
-                        break;
-                    }
+        }
+
+        // Each hull point belongs to the first lattice box containing it,
+        // the first box when it is in none of them
+        pointOrigins = vector<LatticeConfig *>(lattice.size(), nullptr);
+        vector<glm::vec3> pending = lattice;
+        vector<uint32_t> pendingIndex = vector<uint32_t>(lattice.size());
+        for (uint32_t i = 0; i < pendingIndex.size(); i++) pendingIndex[i] = i;
+        vector<uint8_t> inside = vector<uint8_t>();
+
+        for (LatticeConfig *latticeBox : latticeConfigs) {
+            if (pending.empty()) break;
+            latticeBox->volume->model->classifyPoints(pending, inside, 0);
+            size_t kept = 0;
+            for (size_t i = 0; i < pending.size(); i++) {
+                if (inside[i]) {
+                    pointOrigins[pendingIndex[i]] = latticeBox;
+                } else {
+                    pending[kept] = pending[i];
+                    pendingIndex[kept++] = pendingIndex[i];
                 }
-                // Just in case the hull point wasn't in any of the lattice boxes
-                if (lattice.size() != pointOrigins.size())
-                    pointOrigins.push_back(latticeConfigs.at(0));
             }
+            pending.resize(kept);
+            pendingIndex.resize(kept);
         }
+        for (uint32_t i : pendingIndex) pointOrigins[i] = latticeConfigs.at(0);
         // Interpolate edges based on cutoff
     }
 
@@ -1244,6 +1842,32 @@ void Loader::createSpaceLattice(simulation_data *arrays, SimulationConfig *simCo
         qDebug() << "Start corner" << startCorner.x << startCorner.y << startCorner.z;
         qDebug() << "End corner" << endCorner.x << endCorner.y << endCorner.z;
 
+        if (latticeBox->sampling == LatticeConfig::POISSON_SAMPLING) {
+            time_t tpoisson = time(0);
+
+            // A few interior seeds, later ones only start fronts in parts the first missed
+            vector<glm::vec3> seeds = vector<glm::vec3>();
+            sampleInteriorPoints(arrays, latticeVol, cutoff, includeHull, POISSON_SEEDS, seeds);
+            if (seeds.empty()) {
+                log("No interior points found for lattice in volume " + latticeBox->volume->id);
+                continue;
+            }
+
+            auto inside = [&](const glm::vec3 &p) {
+                return arrays->isInside(p) && latticeVol->isInside(p, 0)
+                       && !(includeHull && arrays->isCloseToEdge(p, cutoff));
+            };
+
+            LatticeSampler sampler = LatticeSampler(startCorner, endCorner, cutoff);
+            sampler.poissonDisk(seeds, inside, latticeTemp);
+
+            pointOrigins.insert(pointOrigins.end(), latticeTemp.size(), latticeBox);
+            lattice.insert(lattice.end(), latticeTemp.begin(), latticeTemp.end());
+            qDebug() << "Poisson sampled" << latticeTemp.size() << "points in lattice" << latticeBox->volume->id
+                     << "in" << difftime(time(0), tpoisson) << "second(s)";
+            continue;
+        }
+
         // Get point estimate to calculate k
         int xLines = int((endCorner.x - startCorner.x) / cutoff) + 1;
         int yLines = int((endCorner.y - startCorner.y) / cutoff) + 1;
@@ -1253,68 +1877,22 @@ void Loader::createSpaceLattice(simulation_data *arrays, SimulationConfig *simCo
 
         qDebug() << "Generating" << kNewPoints << "random point candidates with cutoff" << cutoff;
 
-        glm::vec3 point = Utils::randPoint(startCorner, endCorner);
-
-
-        if (includeHull) {
-            while (arrays->isCloseToEdge(point, cutoff) || !arrays->isInside(point) || !latticeVol->isInside(point, 0)) {
-
-                // Generate a new point if its within the cutoff of the model edge
-                //   or its not inside the model
-                point = Utils::randPoint(startCorner, endCorner);
-            }
-        } else {
-            while (!arrays->isInside(point) || !latticeVol->isInside(point, 0)) {
-                // Generate a new point if its within the cutoff of the model edge
-                //   or its not inside the model
-                point = Utils::randPoint(startCorner, endCorner);
-            }
-        }
-        // Add point to lattice
-        latticeTemp.push_back(point);
-        pointOrigins.push_back(latticeBox);
-        float maxLength = cutoff;
-        int k;
-        qDebug() << "First point" << point.x << point.y << point.z;
-
-        vector<glm::vec3> candidates =  vector<glm::vec3>(kNewPoints);
-
-    	time_t tinit = time(0);
-		#pragma omp parallel for
-        for (k = 0; k < kNewPoints; k++) {
-
-                glm::vec3 newPoint = Utils::randPoint(startCorner, endCorner);
-
-                if (includeHull) {
-                    while (arrays->isCloseToEdge(newPoint, cutoff) || !arrays->isInside(newPoint) || !latticeVol->isInside(newPoint, 0)) {
-                        // Generate a new point if its within the cutoff of the model edge
-                        //   or its not inside the model
-                        newPoint = Utils::randPoint(startCorner, endCorner);
-                    }
-                } else {
-
-                    while (!arrays->isInside(newPoint) || !latticeVol->isInside(newPoint, 0)) {
-                        // Generate a new point if its within the cutoff of the model edge
-                        //   or its not inside the model
-                        newPoint = Utils::randPoint(startCorner, endCorner);
-                    }
-                }
-            candidates[k] = newPoint;
-        }
-
-        vector<float> sumDistsStore = vector<float>();
-        for (auto c: candidates) {
-            sumDistsStore.push_back(0.0f);
+        // First point followed by the candidates, drawn in batches
+        time_t tinit = time(0);
+        vector<glm::vec3> samples = vector<glm::vec3>();
+        sampleInteriorPoints(arrays, latticeVol, cutoff, includeHull, kNewPoints + 1, samples);
+        if (samples.empty()) {
+            log("No interior points found for lattice in volume " + latticeBox->volume->id);
+            continue;
         }
 
+        glm::vec3 point = samples.front();
+        qDebug() << "First point" << point.x << point.y << point.z;
 
-        int latticePrintFrequency = 1000;
-        time_t tstart,tend;
-        tstart = time(0);
+        vector<glm::vec3> candidates = vector<glm::vec3>(samples.begin() + 1, samples.end());
+        qDebug() << "cutoff " << cutoff << " size " << candidates.size();
 
-        qDebug() << "maxL" << maxLength << " cutoff " << cutoff << " size " << candidates.size();
-        while (maxLength >= cutoff && candidates.size() > 0) {
-            // Find point furthest from existing points
+        // Farthest point sampling, same output as the original loop below
         	// THIS IS THE ORIGINAL LOOP DONT DELETE IT
         	/*
         	  // Find point furthest from existing points
@@ -1347,84 +1925,10 @@ void Loader::createSpaceLattice(simulation_data *arrays, SimulationConfig *simCo
         	            }
 */
 
-            uint iFarthest = 0;
-            float maxDistFromPoints = 0.0f;
-/*
-            vec3 l = latticeTemp.back();
-            float distFromPoint;
-            int nToRemove = 0;
-            int candidateSize = candidates.size();
-            qDebug() << "Candidates: " << candidateSize;
-            for (uint i = 0; i < candidateSize; i++) {
-                if (candidateSize-nToRemove > i) { /*do nothing}
-                else {
-                    distFromPoint = length(candidates[i] - l);
-                	if (distFromPoint < cutoff) {
-                		nToRemove++;
-                		candidates[i] = candidates[candidates.size()-nToRemove];
-                		sumDistsStore[i] = sumDistsStore[sumDistsStore.size()-nToRemove];
-						i--;
-                	}
-                	else {
-						sumDistsStore[i] += distFromPoint;
-						if (sumDistsStore[i] > maxDistFromPoints) {
-							maxDistFromPoints = sumDistsStore[i];
-							iFarthest = i;
-						}
-                	}
-                }
-            }
-
-            candidates.erase(candidates.end()-nToRemove,candidates.end());
-            sumDistsStore.erase(sumDistsStore.end()-nToRemove,sumDistsStore.end());
-            assert(sumDistsStore.size() == candidates.size());
-*/
-            vec3 l = latticeTemp.back();
-            for (uint i = 0; i < candidates.size(); i++) {
-                float distFromPoint = length(candidates[i] - l);
-
-                if (distFromPoint < cutoff) {
-                    candidates.erase(candidates.begin() + i);
-                    sumDistsStore.erase(sumDistsStore.begin() + i);
-                    i--;
-                }
-                else {
-                    assert(sumDistsStore.size() == candidates.size());
-                    sumDistsStore[i] += distFromPoint;
-
-                    if (sumDistsStore[i] > maxDistFromPoints) {
-                            maxDistFromPoints = sumDistsStore[i];
-                            iFarthest = i;
-                    }
-
-                    }
-            }
-
-            if (candidates.size() > 0) {
-                maxLength = maxDistFromPoints;
-                // Update maxLength to minimum distance between
-                //   an existing point and the point chosen
-
-				#pragma omp parallel for
-                for (int i = 0; i < latticeTemp.size(); i++) {
-                    maxLength = std::min(maxLength, length(candidates[iFarthest] - latticeTemp[i]));
-                }
-                assert(iFarthest <= candidates.size());
-                // Add point to lattice
-                latticeTemp.push_back(candidates[iFarthest]);
-                pointOrigins.push_back(latticeBox);
-                candidates.erase(candidates.begin() + iFarthest);
-                sumDistsStore.erase(sumDistsStore.begin() + iFarthest);
-            }
-
-            if (latticePrintFrequency == 0) {
-            	tend = time(0);
-                qDebug() << "Added to lattice" << latticeTemp.size() << " Time: " << difftime(tend, tstart) << " second(s)";
-                latticePrintFrequency = 1000;
-                tstart = time(0);
-            }
-            latticePrintFrequency--;
-        }
+        LatticeSampler sampler = LatticeSampler(startCorner, endCorner, cutoff);
+        sampler.farthestPoint(point, candidates, latticeTemp);
+        pointOrigins.insert(pointOrigins.end(), latticeTemp.size(), latticeBox);
+        time_t tend = time(0);
 
         // PROBLEM HERE
         lattice.insert(lattice.end(), latticeTemp.begin(), latticeTemp.end());
@@ -1435,6 +1939,7 @@ void Loader::createSpaceLattice(simulation_data *arrays, SimulationConfig *simCo
 
     arrays->lattice = lattice;
     arrays->pointOrigins = pointOrigins;
+    arrays->latticeSprings.clear();
     qDebug() << "Set lattice";
 }
 
@@ -1460,139 +1965,67 @@ void Loader::createSpaceLattice(Polygon *geometryBound, LatticeConfig &lattice,
 
     qDebug() << "Generating" << kNewPoints << "random point candidates with cutoff" << cutoff;
 
-    Vec point = Utils::randPointVec(startCorner, endCorner);
-
     if (includeHull) {
 
-        // Add hull vertices
-        for (auto n : geometryBound->nodeMap) {
-            bool existsInLattice = false;
-
-            for (uint l = 0; l < space.size(); l++) {
-                if (n.first == space[l]) {
-                    existsInLattice = true;
-                }
-            }
-            if (!existsInLattice) {
-                space.push_back(n.first);
+        // Add hull vertices, duplicates found by exact position
+        unordered_set<Vec, vec_hash> hullPoints = unordered_set<Vec, vec_hash>();
+        hullPoints.reserve(geometryBound->vertexCount());
+        for (uint32_t v = 0; v < geometryBound->vertexCount(); v++) {
+            Vec hullPoint = geometryBound->position(v);
+            if (hullPoints.insert(hullPoint).second) {
+                space.push_back(hullPoint);
             }
-            // save number of hull points 
-        }
-        // Interpolate edges based on cutoff
-        while (geometryBound->isCloseToEdge(point, cutoff) || !geometryBound->isInside(point)) {
-
-            // Generate a new point if its within the cutoff of the model edge
-            //   or its not inside the model
-            point = Utils::randPointVec(startCorner, endCorner);
-
-        }
-
-    } else {
-
-        while (!geometryBound->isInside(point)) {
-
-            // Generate a new point if its within the cutoff of the model edge
-            //   or its not inside the model
-            point = Utils::randPointVec(startCorner, endCorner);
         }
     }
 
+    // First point followed by the candidates, inside the geometry
+    // and away from its surface when the hull is included
+    if (geometryBound->bvh.empty()) geometryBound->buildBVH();
+    const BVH &bvh = geometryBound->bvh;
+    glm::vec3 dir = Utils::randDirection();
 
-    // Add point to lattice
-    space.push_back(point);
-    float maxLength = cutoff;
-    int k;
+    auto classify = [&](const vector<glm::vec3> &centers, float radius, vector<uint8_t> &states) {
+        states.assign(centers.size(), OccupancyGrid::OUTSIDE);
 
-    vector<Vec> candidates = vector<Vec>();
-
-    // Spawn k new points
-    int threads = 64;
-
-
-#pragma omp parallel for
-    for (int t = 0; t < threads; t++) {
-        for (k = 0; k < kNewPoints/threads; k++) {
-
-            Vec newPoint = Utils::randPointVec(startCorner, endCorner);
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (long i = 0; i < long(centers.size()); i++) {
+            bool near = bvh.withinDistance(centers[i], radius);
+            if (!near && !bvh.isInside(centers[i], dir)) continue;
 
+            OccupancyGrid::Cell state = near ? OccupancyGrid::BOUNDARY : OccupancyGrid::INSIDE;
             if (includeHull) {
-                while (geometryBound->isCloseToEdge(newPoint, cutoff) || !geometryBound->isInside(newPoint)) {
-                    // Generate a new point if its within the cutoff of the model edge
-                    //   or its not inside the model
-                    newPoint = Utils::randPointVec(startCorner, endCorner);
-                }
-            } else {
-
-                while (!geometryBound->isInside(newPoint)) {
-                    // Generate a new point if its within the cutoff of the model edge
-                    //   or its not inside the model
-                    newPoint = Utils::randPointVec(startCorner, endCorner);
-                }
+                if (cutoff > radius && bvh.withinDistance(centers[i], cutoff - radius)) continue;
+                if (bvh.withinDistance(centers[i], cutoff + radius)) state = OccupancyGrid::BOUNDARY;
             }
-
-    #pragma omp critical
-            candidates.push_back(newPoint);
+            states[i] = state;
         }
+    };
 
-        qDebug() << "Lattice Thread" << t << "done";
-    }
-
-int latticePrintFrequency = 100; 
-
-    while (maxLength >= cutoff && !candidates.empty()) {
+    auto valid = [&](const vector<glm::vec3> &batch, vector<uint8_t> &accepted) {
+        accepted.assign(batch.size(), 0);
 
-        // Find point furthest from original point
-        uint iFarthest = 0;
-        float maxDistFromPoints = 0.0f;
-        vector<float> sumDistsStore(candidates.size());
-
-		#pragma omp parallel for
-        for (size_t i = 0; i < sumDistsStore.size(); ++i) {
-            sumDistsStore[i]= maxDistFromPoints;
-        }
-
-        vector<int> candidatesToErase();
-        Vec l_temp = space.back();
-
-		#pragma omp parallel for
-        for (uint i = 0; i < candidates.size(); i++) {
-        	// this is defined but never used?
-
-            if (space.size() > 0) {
-                float distFromPoint = (candidates[i] - l_temp).norm();
-
-                if (distFromPoint < cutoff ) {
-					#pragma omp critical
-                   candidates.erase(candidates.begin() + i);
-                    i--;
-                    continue;
-                }
-                sumDistsStore[i] += distFromPoint;
-            }
-
-            if (sumDistsStore[i] > maxDistFromPoints) {
-                maxDistFromPoints = sumDistsStore[i];
-                iFarthest = i;
-            }
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (long i = 0; i < long(batch.size()); i++) {
+            accepted[i] = bvh.isInside(batch[i], dir) && !(includeHull && bvh.withinDistance(batch[i], cutoff));
         }
+    };
+
+    LatticeSampler sampler = LatticeSampler(vec3(startCorner[0], startCorner[1], startCorner[2]),
+                                            vec3(endCorner[0], endCorner[1], endCorner[2]), cutoff);
+    vector<glm::vec3> samples = vector<glm::vec3>();
+    sampler.stratified(size_t(kNewPoints) + 1, classify, valid, samples);
+    if (samples.empty()) {
+        log("No interior points found for space lattice");
+        return;
+    }
 
-        if (!candidates.empty()) {
-            maxLength = maxDistFromPoints;
-            // Update maxLength to minimum distance between
-            //   an existing point and the point chosen
-			#pragma omp parallel for
-            for (size_t i = 0; i <space.size(); ++i) {
-                maxLength = std::min(maxLength, float((candidates[iFarthest] - space[i]).norm()));
-            }
-            // Add point to lattice
-            space.push_back(candidates[iFarthest]);
-            candidates.erase(candidates.begin() + iFarthest);
-        }
-        if (latticePrintFrequency == 0) {
-   	        qDebug() << "Added to lattice" << space.size();
- 	       latticePrintFrequency = 100;
-        }
-        latticePrintFrequency--;
+    // Farthest point selection from the first sample, same as the volume lattices
+    vector<glm::vec3> candidates = vector<glm::vec3>(samples.begin() + 1, samples.end());
+    vector<glm::vec3> points = vector<glm::vec3>();
+    sampler.farthestPoint(samples[0], candidates, points);
+    space.reserve(space.size() + points.size());
+    for (const glm::vec3 &p : points) {
+        space.push_back(Vec(p.x, p.y, p.z));
     }
 
     // Set lattice property
@@ -10,6 +10,9 @@
 #include <Spectra/SymGEigsSolver.h>
 #include <Spectra/MatOp/SparseCholesky.h>
 #include "model.h"
+#include "spatialGrid.h"
+#include "io/latticeCache.h"
+#include "io/meshCache.h"
 #include "utils.h"
 #include <ctime>
 
@@ -28,28 +31,61 @@ public:
     void createGridLattice(simulation_data *arrays, int dimX, int dimY, int dimZ);
     void createGridLattice(simulation_data *arrays, SimulationConfig *simConfig);
     void createSpaceLattice(simulation_data *arrays, SimulationConfig *simConfig);
+    void sampleInteriorPoints(simulation_data *arrays, model_data *latticeVol, float cutoff,
+                              bool includeHull, int n, vector<glm::vec3> &points);
     void createGridLattice(Polygon *geometryBound, LatticeConfig &lattice, float cutoff);
     void createSpaceLattice(Polygon *geometryBound, LatticeConfig &lattice, float cutoff, bool includeHull);
 
     void loadDesignModels(Design *design);
+    float volumeScale(Volume *volume);
+    struct SharedMesh;
+    bool meshKey(Volume *volume, pair<string, float> &key);
+    SharedMesh *loadMesh(Volume *volume);
     void loadVolumeModel(Volume *volume);
     void loadVolumeGeometry(Volume *volume);
     void loadSimModel(SimulationConfig *simConfig);
+    void buildOccupancy(SimulationConfig *simConfig);
     void loadVolumes(model_data *arrays, Design *design);
     void loadModel(model_data *arrays, Volume *volume, uint n_volume);
     void readSTLFromFile(model_data *arrays, QString filePath, uint n_model);
+    void createLattice(Simulation *sim, SimulationConfig *simConfig);
     void loadSimulation(Simulation *sim, SimulationConfig *simConfig);
     void loadSimulation(simulation_data *arrays, Simulation *sim, uint n_volume);
     void loadSimFromLattice(simulation_data *arrays, Simulation *sim, vector <LatticeConfig *> lattices);
     void loadSimFromLattice(LatticeConfig *lattice, Simulation *sim, double springCutoff);
     void loadBarsFromSim(Simulation *sim, bar_data *output, bool crossSection, bool markers);
+    void indexLoadMembers(Simulation *sim);
+    void clearLoadIndex();
+    void findLoadMembers(Simulation *sim, Loadcase *load);
     void applyLoadcase(Simulation *sim, Loadcase *load);
+    void addLatticeCacheKey(LatticeCache &cache, SimulationConfig *simConfig);
+    void storeLattice(LatticeCache::Entry &entry, Simulation *sim, SimulationConfig *simConfig);
+    bool restoreLattice(const LatticeCache::Entry &entry, Simulation *sim, SimulationConfig *simConfig);
 
     double calculateNaturalPeriod(Simulation *sim);
     void suggestParams(Simulation *sim, SimulationConfig *simConfig);
 
 	  int surfacePoints;
 
+    // Meshes parsed during loadDesignModels, by path and scale. Each part is
+    // copied for its users and moved to the last one, counted up front
+    struct SharedMesh {
+        mesh_data mesh;
+        bool loaded = false;
+        int soupUsers = 0;     // Triangles and BVH: volume models and simulation models
+        int normalUsers = 0;   // Volume models
+        int geometryUsers = 0; // Volume geometries
+    };
+    map<pair<string, float>, SharedMesh> meshCache;
+    string cacheDirectory; // On-disk mesh and lattice caches, empty when disabled
+
+    // Mass positions and spring midpoints binned by indexLoadMembers,
+    // shared by the loadcases of one loadSimulation
+    SpatialGrid massGrid;
+    SpatialGrid springGrid;
+    vector<glm::dvec3> massPoints;
+    vector<glm::dvec3> springPoints;
+
 signals:
     void log(const QString &message);
 
@@ -2,6 +2,8 @@
 #include <QSurfaceFormat>
 #include "io/commandLine.h"
 #include "parser.h"
+#include "rng.h"
+#include "simBackend.h"
 #include "gui/window.h"
 
 void qtNoDebugMessageOutput(QtMsgType type, const QMessageLogContext &context, const QString &msg)
@@ -63,6 +65,14 @@ int main(int argc, char *argv[]) {
     QSurfaceFormat::setDefaultFormat(format);
 
     CommandLine::parse(argc, argv);
+    Rng::seed(CommandLine::seed? CommandLine::seed.Get() : Rng::randomSeed());
+    cout << "Random seed: " << Rng::currentSeed() << "\n";
+    SimBackend::Kind backend;
+    if (!SimBackend::kindFromName(CommandLine::backend.Get(), backend)) {
+        cerr << "Unknown backend " << CommandLine::backend.Get() << ", use titan or cpu\n";
+        return 1;
+    }
+    SimBackend::select(backend);
     string dmlInput = CommandLine::inputPath.Get();
 
     if (!dmlInput.empty()) {
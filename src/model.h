@@ -1,6 +1,8 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include "bvh.h"
+#include "occupancy.h"
 #include "polygon.h"
 #include "utils.h"
 
@@ -96,6 +98,25 @@ struct boundingBox {
 };
 
 
+/**
+ * @brief The mesh_data struct
+ * Triangle soup parsed once from a mesh file at a given scale.
+ * Its parts are copied to every volume that references the file
+ * and moved to the last one (see Loader::loadMesh).
+ */
+struct mesh_data {
+    string path;
+    float scale = 1;
+    vector<vec3> vertices; // Every 3 vertices constitutes a triangle
+    vector<vec3> normals; // Normals are copied to correspond to vertices
+
+    BVH bvh; // Over the triangle soup, used by the volume and simulation models
+    Polygon geometry; // Welded indexed mesh with its own BVH
+
+    size_t triangleCount() const { return vertices.size() / 3; }
+    bool empty() const { return vertices.empty(); }
+};
+
 /**
  * @brief The model_data struct
  * Stores the data in model arrays where math functions
@@ -124,6 +145,8 @@ struct model_data {
     int m_colCount = 0;
 
     boundingBox<glm::vec3> bounds;
+    vector<BVH> bvh; // One hierarchy per model, see buildBVH()
+    OccupancyGrid occupancy; // Optional voxel classification of model 0
 
   #ifdef USE_OpenGL
     const GLfloat *constData() const { return m_data.constData(); }
@@ -137,37 +160,24 @@ struct model_data {
 
     // Loads graphics data from Polygon
     void createPolygonGraphicsData(const Polygon &polygon, glm::vec4 color) {
-        n_triangles = polygon.triangles->size();
+        n_triangles = polygon.triangleCount() - polygon.n_removed;
         n_vertices = 3 * n_triangles;
         m_data.resize(n_vertices * 6);
 
-        for (ulong a = 0; a < n_triangles; a++) {
-            shared_ptr<Tri> t = polygon.triangles->at(a);
+        for (uint32_t t = 0; t < polygon.triangleCount(); t++) {
+            if (polygon.removed[t]) continue;
 
             GLfloat *p = m_data.data() + m_count;
-            *p++ = t->v1->p[0];
-            *p++ = t->v1->p[1];
-            *p++ = t->v1->p[2];
-            *p++ = t->n[0];
-            *p++ = t->n[1];
-            *p++ = t->n[2];
-            m_count += 6;
-
-            *p++ = t->v2->p[0];
-            *p++ = t->v2->p[1];
-            *p++ = t->v2->p[2];
-            *p++ = t->n[0];
-            *p++ = t->n[1];
-            *p++ = t->n[2];
-            m_count += 6;
-
-            *p++ = t->v3->p[0];
-            *p++ = t->v3->p[1];
-            *p++ = t->v3->p[2];
-            *p++ = t->n[0];
-            *p++ = t->n[1];
-            *p++ = t->n[2];
-            m_count += 6;
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = polygon.corner(t, k);
+                *p++ = polygon.px[v];
+                *p++ = polygon.py[v];
+                *p++ = polygon.pz[v];
+                *p++ = polygon.normals[t][0];
+                *p++ = polygon.normals[t][1];
+                *p++ = polygon.normals[t][2];
+                m_count += 6;
+            }
         }
 
         // Fill colors for each model
@@ -267,8 +277,40 @@ struct model_data {
     }
   #endif
 
+    /**
+     * @brief buildBVH Builds a hierarchy over the triangles of each model
+     * so isInside costs O(log n) instead of a scan over every triangle
+     */
+    void buildBVH() {
+        bvh = vector<BVH>(n_models);
+
+        uint modelStart = 0;
+        for (int i = 0; i < n_models; i++) {
+            bvh[i].build(vertices.data() + modelStart, (model_indices[i] - modelStart) / 3);
+            modelStart = model_indices[i];
+        }
+    }
+
+    /**
+     * @brief buildOccupancy Voxelizes model 0 so isInside only runs
+     * exact ray tests for points in voxels touching the surface
+     */
+    void buildOccupancy(float voxelSize) {
+        if (bvh.empty() || bvh[0].empty()) buildBVH();
+        occupancy.build(bvh[0], bounds.minCorner, bounds.maxCorner, voxelSize);
+    }
+
     bool isInside(glm::vec3 point, int n_model) {
 
+        if (n_model == 0 && !occupancy.empty()) {
+            OccupancyGrid::Cell cell = occupancy.lookup(point);
+            if (cell != OccupancyGrid::BOUNDARY) return cell == OccupancyGrid::INSIDE;
+        }
+
+        if (n_model < int(bvh.size()) && !bvh[n_model].empty())
+            return bvh[n_model].isInside(point, Utils::randDirection());
+
+        // Brute force over all triangles when no BVH has been built
         uint modelStart = 0;
         uint modelEnd = 0;
         int intersections = 0;
@@ -304,6 +346,36 @@ struct model_data {
     }
 
 
+    /**
+     * @brief classifyPoints Batched isInside for model n_model
+     * Sets inside[i] to 1 when points[i] is inside. Points are tested in
+     * parallel against the occupancy grid, then the BVH for boundary voxels.
+     */
+    void classifyPoints(const vector<glm::vec3> &points, vector<uint8_t> &inside, int n_model = 0) {
+        inside.resize(points.size());
+
+        bool useGrid = (n_model == 0 && !occupancy.empty());
+        bool useBVH = (n_model < int(bvh.size()) && !bvh[n_model].empty());
+        glm::vec3 dir = Utils::randDirection();
+        long n = long(points.size());
+
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (long i = 0; i < n; i++) {
+            if (useGrid) {
+                OccupancyGrid::Cell cell = occupancy.lookup(points[i]);
+                if (cell != OccupancyGrid::BOUNDARY) {
+                    inside[i] = (cell == OccupancyGrid::INSIDE);
+                    continue;
+                }
+            }
+            if (useBVH) {
+                inside[i] = bvh[n_model].isInside(points[i], dir);
+            } else {
+                inside[i] = isInside(points[i], n_model);
+            }
+        }
+    }
+
     // make something that checks for the ray of the spring
     // this tells us if a spring is spanning a point outside the model
     // THIS IS STILL A WIP -> NOT IMPLEMENTED ANYWHERE
@@ -342,13 +414,18 @@ struct model_data {
 
 
     // Check if a point is too close to the hull of a model
+    // Uses the true distance to the surface when a BVH is built
     bool isCloseToEdge(glm::vec3 point, float cutoff, int n_model) {
 
+        if (n_model < int(bvh.size()) && !bvh[n_model].empty())
+            return bvh[n_model].withinDistance(point, cutoff);
+
+        // Distance to the closest vertex otherwise
         uint modelStart = 0;
         uint modelEnd = 0;
         if (n_model != 0)
             modelStart = model_indices[n_model-1];
-        modelEnd = model_indices[0];
+        modelEnd = model_indices[n_model];
 
         for (uint i = modelStart; i < modelEnd; i ++) {
             if (length(vertices[i] - point) <= cutoff)
@@ -358,12 +435,13 @@ struct model_data {
         return false;
     }
 
-    void indexVertices(int n_model) {
+    // Collapses duplicate vertices of model n_model into an index buffer.
+    // Vertices closer than tolerance are merged, exact duplicates by default.
+    void indexVertices(int n_model, float tolerance = 0) {
         vector<glm::vec3> v_collapse = vector<glm::vec3>();
         vector<glm::vec3> n_collapse = vector<glm::vec3>();
         vector<uint> i_model = vector<uint>();
-        map<uint, vector<uint>> vi_map = map<uint, vector<uint>>();
-        map<uint, vector<glm::vec3>> n_map = map<uint, vector<glm::vec3>>();
+        vector<uint> firsts = vector<uint>();
 
         uint modelStart = 0;
         uint modelEnd = 0;
@@ -372,67 +450,15 @@ struct model_data {
             modelStart = model_indices[n_model-1];
         modelEnd = model_indices[n_model];
 
-        for (uint i = modelStart; i < modelEnd; i++) {
-
-            bool foundMatch = false;
-
-            for (uint j = 0; j < v_collapse.size(); j++) {
-                if (vertices[i] == v_collapse[j]) {
-                    // Vertex already exists
-                    foundMatch = true;
-
-                    // Add index
-                    i_model.push_back(j);
-                    vi_map[j].push_back(i);
+        Utils::weldVertices(vertices.data() + modelStart, modelEnd - modelStart, tolerance, i_model, firsts);
 
-                    // Update normal map
-                    if (n_map.find(j) == n_map.end()) {
-                        // Doesn't exist in map; add new entry
-                        n_map[j] = vector<glm::vec3>(1, normals[i]);
-
-                        // Original vertex normal
-                        uint oi = vi_map[j].front();
-                        n_map[j].push_back(normals[oi]);
-                    } else {
-                        // Exists in map
-                        n_map[j].push_back(normals[i]);
-                    }
-                    break;
-                }
-            }
-
-            if (!foundMatch) {
-                // Vertex does not already exist
-                v_collapse.push_back(vertices[i]);
-
-                // Add index
-                i_model.push_back(v_collapse.size()-1);
-                vi_map[v_collapse.size()-1].push_back(i);
-            }
+        v_collapse.reserve(firsts.size());
+        for (uint first : firsts) {
+            v_collapse.push_back(vertices[modelStart + first]);
         }
 
-        // Resolve normals
-        n_collapse = vector<glm::vec3>(v_collapse.size());
-
-        for (uint j = 0;  j < v_collapse.size(); j++) {
-
-            // Average normals for single vertex
-            if (n_map.find(j) != n_map.end()) {
-                // Mutiple normals to average for vertex
-
-                glm::vec3 n_average = glm::vec3(0.0f, 0.0f, 0.0f);
-
-                for (uint k = 0; k < n_map[j].size(); k++) {
-                    n_average += n_map[j][k];
-                }
-
-                n_collapse.at(j) = (1.0f / n_map[j].size()) * n_average;
-            } else {
-                // One normal, no average
-                n_collapse.at(j) = normals.at(vi_map[j].front());
-            }
-
-        }
+        // Resolve normals, averaged over every welded vertex
+        Utils::averageWelded(normals.data() + modelStart, i_model, firsts, n_collapse);
 
         vertices.erase(vertices.begin() + modelStart, vertices.begin() + modelEnd);
         vertices.insert(vertices.begin() + modelStart, v_collapse.begin(), v_collapse.end());
@@ -468,6 +494,7 @@ struct simulation_data {
     vector<uint> indices = vector<uint>();
     vector<glm::vec3> lattice = std::vector<glm::vec3>();
     vector<LatticeConfig *> pointOrigins = std::vector<LatticeConfig *>(); // Tracks the lattice each point is associated with
+    vector<std::pair<uint32_t, uint32_t>> latticeSprings = vector<std::pair<uint32_t, uint32_t>>(); // Template springs between lattice points, cubic fills only
     vector<uint> hull = std::vector<uint>();
     // vec3 *d_vertices; //CUDA memory
 
@@ -480,6 +507,8 @@ struct simulation_data {
     int m_indexCount = 0;
 
     boundingBox<vec3> bounds;
+    BVH bvh;
+    OccupancyGrid occupancy;
 
   #ifdef USE_OpenGL
     const GLfloat *constData() const { return m_data.constData(); }
@@ -511,42 +540,26 @@ struct simulation_data {
     }
 #endif
 
-    void indexVertices(int n_model) {
+    // Collapses duplicate vertices into an index buffer,
+    // see model_data::indexVertices
+    void indexVertices(int n_model, float tolerance = 0) {
         qDebug() << "Indexing vertices for model " << n_model;
         vector<glm::vec3> v_collapse = vector<glm::vec3>();
         vector<uint> i_model = vector<uint>();
+        vector<uint> firsts = vector<uint>();
 
         uint modelStart = 0;
         uint modelEnd = n_vertices;
 
         qDebug() << "Start index: " << modelStart << " End index: " << modelEnd;
 
-        for (uint i = modelStart; i < modelEnd; i++) {
-
-            bool foundMatch = false;
-
-            for (uint j = 0; j < v_collapse.size(); j++) {
-                if (vertices[i] == v_collapse[j]) {
-                    // Vertex already exists
-                    foundMatch = true;
+        Utils::weldVertices(vertices.data() + modelStart, modelEnd - modelStart, tolerance, i_model, firsts);
 
-                    // Add index
-                    i_model.push_back(j);
-
-                    break;
-                }
-            }
-
-            if (!foundMatch) {
-                // Vertex does not already exist
-                v_collapse.push_back(vertices[i]);
-
-                // Add index
-                i_model.push_back(v_collapse.size()-1);
-            }
+        v_collapse.reserve(firsts.size());
+        for (uint first : firsts) {
+            v_collapse.push_back(vertices[modelStart + first]);
         }
 
-
         vertices.erase(vertices.begin() + modelStart, vertices.begin() + modelEnd);
         vertices.insert(vertices.begin() + modelStart, v_collapse.begin(), v_collapse.end());
 
@@ -561,14 +574,55 @@ struct simulation_data {
     }
 
 
-    // Cuda version of below function
-    bool isInsideCuda(glm::vec3 point, int n_model);
+    // Batched version of isInside, see model_data::classifyPoints
+    void classifyPoints(const vector<glm::vec3> &points, vector<uint8_t> &inside) {
+        inside.resize(points.size());
+
+        glm::vec3 dir = Utils::randDirection();
+        long n = long(points.size());
+
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (long i = 0; i < n; i++) {
+            if (!occupancy.empty()) {
+                OccupancyGrid::Cell cell = occupancy.lookup(points[i]);
+                if (cell != OccupancyGrid::BOUNDARY) {
+                    inside[i] = (cell == OccupancyGrid::INSIDE);
+                    continue;
+                }
+            }
+            if (!bvh.empty()) {
+                inside[i] = bvh.isInside(points[i], dir);
+            } else {
+                inside[i] = isInside(points[i]);
+            }
+        }
+    }
+
+    // Builds a hierarchy over the triangle vertices for isInside
+    void buildBVH() {
+        bvh.build(vertices.data(), n_vertices / 3);
+    }
+
+    // Voxelizes the volume, see model_data::buildOccupancy
+    void buildOccupancy(float voxelSize) {
+        if (bvh.empty()) buildBVH();
+        occupancy.build(bvh, bounds.minCorner, bounds.maxCorner, voxelSize);
+    }
 
     //
     // Returns true if point is inside model n
     //
     bool isInside(glm::vec3 point) {
 
+        if (!occupancy.empty()) {
+            OccupancyGrid::Cell cell = occupancy.lookup(point);
+            if (cell != OccupancyGrid::BOUNDARY) return cell == OccupancyGrid::INSIDE;
+        }
+
+        if (!bvh.empty())
+            return bvh.isInside(point, Utils::randDirection());
+
+        // Brute force over all triangles when no BVH has been built
         uint modelStart = 0;
         uint modelEnd = n_vertices;
         int intersections = 0;
@@ -600,8 +654,13 @@ struct simulation_data {
     }
 
     // Check if a point is too close to the hull of a model
+    // Uses the true distance to the surface when a BVH is built
     bool isCloseToEdge(glm::vec3 point, float cutoff) {
 
+        if (!bvh.empty())
+            return bvh.withinDistance(point, cutoff);
+
+        // Distance to the closest vertex otherwise
         uint modelStart = 0;
         uint modelEnd = n_vertices;
 
@@ -631,13 +690,20 @@ struct simulation_data {
         qDebug() << "CUDA vertex:" << d_vertices[25].x;**/
     }
 
+    simulation_data(vector<glm::vec3> &&vertices) {
+        this->n_vertices = int(vertices.size());
+        this->vertices = std::move(vertices);
+
+        this->bounds = boundingBox<vec3>(this->vertices);
+    }
+
     simulation_data(Polygon *polygon) {
-        this->n_vertices = polygon->nodeMap.size();
+        this->n_vertices = polygon->vertexCount();
         qDebug() << "Set variables";
 
-        for (const auto n : polygon->nodeMap) {
-            vec3 v = vec3(n.first[0],n.first[1],n.first[2]);
-            this->vertices.push_back(v);
+        this->vertices.reserve(n_vertices);
+        for (uint32_t v = 0; v < n_vertices; v++) {
+            this->vertices.emplace_back(polygon->px[v], polygon->py[v], polygon->pz[v]);
         }
         qDebug() << "Copied vertices";
 
@@ -876,8 +942,12 @@ public:
 
     enum LatticeFill { CUBIC_FILL, SPACE_FILL };
     enum LatticeStructure { BARS, FULL };
+    enum LatticeSampling { FARTHEST_SAMPLING, POISSON_SAMPLING };
+    enum LatticeCell { GRID_CELL, CUBIC_CELL, BCC_CELL, FCC_CELL, OCTET_CELL };
 
     LatticeFill fill;
+    LatticeSampling sampling = FARTHEST_SAMPLING; // Point placement for space fills
+    LatticeCell cell = GRID_CELL; // Unit cell for cubic fills, see LatticeTemplate
     Vec unit;
     QString display;
     bool conform;
@@ -907,6 +977,38 @@ public:
         }
     }
 
+    QString samplingName() {
+        switch(sampling) {
+        case FARTHEST_SAMPLING:
+            return "farthest";
+        case POISSON_SAMPLING:
+            return "poisson";
+        }
+    }
+
+    QString cellName() {
+        switch(cell) {
+        case GRID_CELL:
+            return "grid";
+        case CUBIC_CELL:
+            return "cubic";
+        case BCC_CELL:
+            return "bcc";
+        case FCC_CELL:
+            return "fcc";
+        case OCTET_CELL:
+            return "octet";
+        }
+    }
+
+    static LatticeCell cellFromName(const QString &name) {
+        if (name == "cubic") return CUBIC_CELL;
+        if (name == "bcc") return BCC_CELL;
+        if (name == "fcc") return FCC_CELL;
+        if (name == "octet") return OCTET_CELL;
+        return GRID_CELL;
+    }
+
     vector<Vec> vertices;
     vector<Spring *> simSprings;
 };
@@ -1107,6 +1209,8 @@ public:
         delete optConfig;
     }
 
+    string path; // DML file the design was parsed from
+
     vector<Volume *> volumes;
     map<QString, Volume *> volumeMap;
 
@@ -3,6 +3,7 @@
 //
 
 #include "oUtils.h"
+#include "rng.h"
 
 
 void oUtils::generateMassesPoisson(double minCut, map<Mass *, vector<Spring *> > mToS, vector<Vec> &lattice) {
@@ -38,8 +39,11 @@ void oUtils::generateMassesPoisson(double minCut, map<Mass *, vector<Spring *> >
     lattice.push_back(Utils::randPointVec(minPos, maxPos));
     double maxLength = minCut;
 
+    vector<Vec> draws = vector<Vec>(kNewPoints);
+    Rng::local().fillPoints(minPos, maxPos, draws.data(), draws.size());
+
     for (int k = 0; k < kNewPoints; k++) {
-        Vec p = Utils::randPointVec(minPos, maxPos);
+        const Vec &p = draws[k];
 
         bool close = false;
         for (auto &m: mToS) {
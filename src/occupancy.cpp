@@ -0,0 +1,115 @@
+//
+// Voxel inside/outside classification of a closed mesh.
+//
+
+#include "occupancy.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Fractional offsets of the scanline inside each voxel column.
+// Keeps the axis aligned rays off the edges of CAD meshes.
+#define ROW_OFFSET_Y 0.5173f
+#define ROW_OFFSET_Z 0.4791f
+
+// Marks voxels touched by the surface, then fills every voxel row
+// with a parity scanline along +x
+// ------------------------------------------------------------
+void OccupancyGrid::build(const BVH &bvh, const glm::vec3 &bmin, const glm::vec3 &bmax, float voxelSize) {
+// ------------------------------------------------------------
+
+    clear();
+    if (bvh.empty() || voxelSize <= 0) return;
+
+    glm::vec3 extent = bmax - bmin;
+    float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+    size = std::max(voxelSize, maxExtent / float(MAX_DIM - 2));
+    invSize = 1.0f / size;
+
+    // One voxel of padding on every side
+    origin = bmin - glm::vec3(size);
+    nx = uint32_t(std::ceil(extent.x * invSize)) + 2;
+    ny = uint32_t(std::ceil(extent.y * invSize)) + 2;
+    nz = uint32_t(std::ceil(extent.z * invSize)) + 2;
+    cells = std::vector<uint8_t>(size_t(nx) * ny * nz, OUTSIDE);
+
+    // Boundary voxels: triangle bounding box overlap plus triangle plane overlap
+    float half = 0.5f * size;
+    for (size_t t = 0; t < bvh.triangleCount(); t++) {
+        glm::vec3 a, b, c;
+        bvh.triangle(t, a, b, c);
+
+        // Slightly inflated so surfaces on voxel faces mark both sides
+        glm::vec3 n = glm::cross(b - a, c - a);
+        float r = 1.001f * half * (fabs(n.x) + fabs(n.y) + fabs(n.z));
+
+        glm::vec3 lo = (glm::min(a, glm::min(b, c)) - origin) * invSize - glm::vec3(1E-3f);
+        glm::vec3 hi = (glm::max(a, glm::max(b, c)) - origin) * invSize + glm::vec3(1E-3f);
+        uint32_t i0 = uint32_t(std::max(0.0f, lo.x)), i1 = std::min(nx - 1, uint32_t(hi.x));
+        uint32_t j0 = uint32_t(std::max(0.0f, lo.y)), j1 = std::min(ny - 1, uint32_t(hi.y));
+        uint32_t k0 = uint32_t(std::max(0.0f, lo.z)), k1 = std::min(nz - 1, uint32_t(hi.z));
+
+        for (uint32_t k = k0; k <= k1; k++) {
+            for (uint32_t j = j0; j <= j1; j++) {
+                for (uint32_t i = i0; i <= i1; i++) {
+                    glm::vec3 center = origin + glm::vec3(i + 0.5f, j + 0.5f, k + 0.5f) * size;
+                    if (fabs(glm::dot(n, center - a)) <= r) {
+                        cells[(size_t(k) * ny + j) * nx + i] = BOUNDARY;
+                    }
+                }
+            }
+        }
+    }
+
+    // Parity fill, rows are independent
+    glm::vec3 dir = glm::vec3(1, 0, 0);
+    float tolerance = 1E-5f * (maxExtent + 1.0f);
+    int rows = int(ny * nz);
+
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int row = 0; row < rows; row++) {
+        uint32_t j = uint32_t(row) % ny;
+        uint32_t k = uint32_t(row) / ny;
+
+        // Ray starts one voxel before the grid so t = 0 is outside the mesh
+        glm::vec3 start = origin + glm::vec3(-size, (j + ROW_OFFSET_Y) * size, (k + ROW_OFFSET_Z) * size);
+        std::vector<float> ts = std::vector<float>();
+        bvh.rayHits(start, dir, ts);
+        if (ts.empty()) continue;
+        std::sort(ts.begin(), ts.end());
+
+        // Hits on shared edges and vertices or duplicated facets count once
+        size_t n = 0;
+        for (size_t h = 0; h < ts.size(); h++) {
+            if (n > 0 && ts[h] - ts[n - 1] < tolerance) continue;
+            ts[n++] = ts[h];
+        }
+
+        uint8_t *line = &cells[(size_t(k) * ny + j) * nx];
+
+        // Parity is unreliable on an odd count (open mesh, grazing ray),
+        // leave the whole row to the exact test
+        if (n % 2 == 1) {
+            std::fill(line, line + nx, uint8_t(BOUNDARY));
+            continue;
+        }
+
+        size_t crossed = 0;
+        for (uint32_t i = 0; i < nx; i++) {
+            float t = (i + 1.5f) * size; // Voxel center
+            while (crossed < n && ts[crossed] < t) crossed++;
+            if (line[i] != BOUNDARY && crossed % 2 == 1) {
+                line[i] = INSIDE;
+            }
+        }
+    }
+}
+
+// Frees the voxel table
+// ------------------------------------------------------------
+void OccupancyGrid::clear() {
+// ------------------------------------------------------------
+    std::vector<uint8_t>().swap(cells);
+    nx = ny = nz = 0;
+    size = invSize = 0;
+}
@@ -0,0 +1,56 @@
+//
+// Voxel inside/outside classification of a closed mesh.
+// Built once per volume, answers most membership queries
+// with a single table lookup.
+//
+
+#ifndef DMLIDE_OCCUPANCY_H
+#define DMLIDE_OCCUPANCY_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+
+class OccupancyGrid {
+
+public:
+    enum Cell : uint8_t {
+        OUTSIDE = 0,
+        INSIDE = 1,
+        BOUNDARY = 2 // Voxel touches the surface, needs an exact test
+    };
+
+    OccupancyGrid() = default;
+
+    // Voxelizes the mesh held by bvh over [bmin, bmax] with cubic voxels
+    void build(const BVH &bvh, const glm::vec3 &bmin, const glm::vec3 &bmax, float voxelSize);
+    void clear();
+
+    bool empty() const { return cells.empty(); }
+    float voxelSize() const { return size; }
+    size_t voxelCount() const { return cells.size(); }
+
+    // Cell state containing p, OUTSIDE beyond the grid
+    Cell lookup(const glm::vec3 &p) const {
+        glm::vec3 g = (p - origin) * invSize;
+        if (g.x < 0 || g.y < 0 || g.z < 0) return OUTSIDE;
+        uint32_t i = uint32_t(g.x), j = uint32_t(g.y), k = uint32_t(g.z);
+        if (i >= nx || j >= ny || k >= nz) return OUTSIDE;
+        return Cell(cells[(size_t(k) * ny + j) * nx + i]);
+    }
+
+    // Voxels per axis are capped to keep memory bounded on fine lattices
+    static const uint32_t MAX_DIM = 512;
+
+private:
+    glm::vec3 origin;
+    float size = 0;
+    float invSize = 0;
+    uint32_t nx = 0, ny = 0, nz = 0;
+    std::vector<uint8_t> cells;
+};
+
+#endif //DMLIDE_OCCUPANCY_H
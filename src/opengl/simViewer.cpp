@@ -1100,7 +1100,7 @@ void SimViewer::initializeGL() {
     qDebug() << "OpenGL Version: " << QLatin1String((const char *) glGetString(GL_VERSION));
     qDebug() << "GSLS version: " << QLatin1String((const char *) glGetString(GL_SHADING_LANGUAGE_VERSION));
 
-    simulator->sim->initCudaParameters();
+    simulator->backend->start();
     qDebug() << "Initializing OpenGL";
 
     updateColors();
@@ -122,8 +122,8 @@ int Optimizer::settleSim(double eps, bool use_cap, double cap) {
         prevTotalEnergy = totalEnergy;
 
         // Step simulation
-        sim->step(sim->masses.front()->dt * 100);
-        sim->getAll();
+        backend->step(sim->masses.front()->dt * 100);
+        backend->getAll();
         steps++;
     }
 
@@ -424,7 +424,7 @@ void SpringRemover::resetHalfLastRemoval() {
 //---------------------------------------------------------------------------
 
     qDebug() << "Resetting" << removedSprings.size() << "Springs";
-    sim->getAll();
+    backend->getAll();
 
     if (removedSprings.empty()) return;
 
@@ -457,7 +457,7 @@ void SpringRemover::resetHalfLastRemoval() {
     }
 
     fillMassSpringMap();
-    sim->setAll();
+    backend->setAll();
 }
 
 
@@ -465,7 +465,7 @@ void SpringRemover::regenerateShift() {
 
     qDebug() << "REGENERATING LATTICE";
 
-    sim->getAll();
+    backend->getAll();
 
     qDebug() << massToSpringMap.size();
     fillMassSpringMap();
@@ -516,14 +516,14 @@ void SpringRemover::regenerateShift() {
     }
     fillMassSpringMap();
 
-    sim->setAll();
+    backend->setAll();
 }
 
 
 void SpringRemover::regenerateLattice(SimulationConfig *config) {
 
     qDebug() << "REGENERATING LATTICE";
-    sim->getAll();
+    backend->getAll();
 
     double minCut = 2 * config->lattices.front()->unit[0];
 
@@ -642,14 +642,14 @@ void SpringRemover::regenerateLattice(SimulationConfig *config) {
 
     //deleteGhostSprings();
 
-    sim->setAll();
-    sim->step(sim->masses.front()->dt * 40000);
-    sim->getAll();
+    backend->setAll();
+    backend->step(sim->masses.front()->dt * 40000);
+    backend->getAll();
 
     for (Spring *s : sim->springs) {
         s->_max_stress = 0;
     }
-    sim->setAll();
+    backend->setAll();
 
 }
 
@@ -687,7 +687,7 @@ void SpringRemover::splitSprings() {
 	}
       }
     }
-    sim->setAll();
+    backend->setAll();
 }
 
 
@@ -696,7 +696,7 @@ void SpringRemover::splitSprings() {
 void SpringRemover::optimize() {
 //---------------------------------------------------------------------------
 
-    sim->getAll();
+    backend->getAll();
     fillMassSpringMap();
     n_springs = validSprings.size();
     qDebug() << "n_springs" << n_springs;
@@ -790,7 +790,7 @@ void SpringRemover::optimize() {
         }
         qDebug() << "Reindexed masses";
 
-        sim->setAll(); // Set spring stresses and mass value updates on GPU
+        backend->setAll(); // Set spring stresses and mass value updates on GPU
 
         n_springs = int(validSprings.size());
         qDebug() << "Springs" << n_springs << "Percent springs left" << 100 * n_springs / n_springs_start;
@@ -827,7 +827,7 @@ void SpringResizer::optimize() {
     double avgObjectDiam = 0;
     map<Spring *, bool> springsToDelete = map<Spring *, bool>();
 
-    sim->getAll();
+    backend->getAll();
     n_springs = sim->springs.size();
     int toResize = int(ratio * n_springs);
 
@@ -880,7 +880,7 @@ void SpringResizer::optimize() {
             t->_k *= 1 / (t->_diam * t->_diam);
             t->_diam -= e;
             t->_k *= t->_diam * t->_diam;
-            sim->setAll();
+            backend->setAll();
 
             if (t->_diam < this->removeCutoff) {
                 springsToDelete[t] = true;
@@ -899,7 +899,7 @@ void SpringResizer::optimize() {
                 t->_diam += e;
                 t->_k *= t->_diam * t->_diam;
                 t->_max_stress = 0;
-                sim->setAll();
+                backend->setAll();
             }
         }
     }
@@ -916,7 +916,7 @@ void SpringResizer::optimize() {
         i++;
     }
 
-    sim->setAll(); // Set spring stresses and mass value updates on GPU
+    backend->setAll(); // Set spring stresses and mass value updates on GPU
 
     n_springs = int(sim->springs.size());
     qDebug() << "Springs" << n_springs << "Percent springs left" << 100 * n_springs / n_springs_start;
@@ -1208,6 +1208,7 @@ void MassDisplacer::mergeMasses(Simulation *sim, Mass *m1, Mass *m2, Spring *c)
                 s->setLeft(m1);
                 s->_rest = (s->_right->origpos - m2->origpos).norm();
                 s->_k *= origLen / s->_rest;
+                sync.mark(s);
             }
         }
         if (s->_right == m2) {
@@ -1220,14 +1221,16 @@ void MassDisplacer::mergeMasses(Simulation *sim, Mass *m1, Mass *m2, Spring *c)
                 s->setRight(m1);
                 s->_rest = (s->_left->origpos - m2->origpos).norm();
                 s->_k *= origLen / s->_rest;
+                sync.mark(s);
             }
         }
     }
 
     // Set mass
     m1->m += m2->m;
-
-    sim->setAll();
+    sync.mark(m1);
+    sync.mark(m2);
+    sync.push();
 }
 
 
@@ -1255,6 +1258,7 @@ int MassDisplacer::shiftMassPos(Simulation *sim, int index, const Vec &dx, vecto
                 return 0;
             }
             s->_k *= origLen / s->_rest;
+            sync.mark(s);
 
             //double massDiff = massFactor * (s->_rest - origLen);
             //s->_left->m += massDiff / 2;
@@ -1276,6 +1280,7 @@ int MassDisplacer::shiftMassPos(Simulation *sim, int index, const Vec &dx, vecto
                 return 0;
             }
             s->_k *= origLen / s->_rest;
+            sync.mark(s);
 
             //double massDiff = massFactor * (s->_rest - origLen);
             //s->_left->m += massDiff / 2;
@@ -1286,7 +1291,8 @@ int MassDisplacer::shiftMassPos(Simulation *sim, int index, const Vec &dx, vecto
     mt->origpos += dx;
     mt->pos += dx;
     mt->vel = Vec(0, 0, 0);
-    sim->setAll();
+    sync.mark(mt);
+    sync.push();
     return 1;
 }
 
@@ -1310,6 +1316,7 @@ void MassDisplacer::shiftMassPos(Simulation *sim, Mass *mt, const Vec &dx) {
                 return;
             }
             s->_k *= origLen / s->_rest;
+            sync.mark(s);
             //s->_mass *= s->_rest / origLen;
         }
         if (s->_right == mt) {
@@ -1322,6 +1329,7 @@ void MassDisplacer::shiftMassPos(Simulation *sim, Mass *mt, const Vec &dx) {
                 return;
             }
             s->_k *= origLen / s->_rest;
+            sync.mark(s);
             //s->_mass *= s->_rest / origLen;
         }
         //s->_left->m += s->_mass / 2;
@@ -1331,7 +1339,8 @@ void MassDisplacer::shiftMassPos(Simulation *sim, Mass *mt, const Vec &dx) {
     mt->origpos += dx;
     mt->pos += dx;
     mt->vel = Vec(0, 0, 0);
-    sim->setAll();
+    sync.mark(mt);
+    sync.push();
 }
 
 
@@ -1363,7 +1372,7 @@ double MassDisplacer::calcOrigDist(Mass *m1, Mass *m2) {
 int MassDisplacer::displaceSingleMass(double displacement, double chunkCutoff, int metricOrder) {
 //---------------------------------------------------------------------------
     qDebug() << "Displacing mass";
-    sim->getAll();
+    backend->getAll();
 
     n_springs = sim->springs.size();
     n_masses = sim->masses.size();
@@ -1550,9 +1559,9 @@ int MassDisplacer::displaceSingleMass(double displacement, double chunkCutoff, i
             s->_max_stress = 0;
         }
 
-        sim->setAll();
+        backend->setAll();
     } else {
-        sim->setAll();
+        backend->setAll();
         qDebug() << "Moved" << i;
         lastMetric = totalMetricTest;
         return 1;
@@ -1569,7 +1578,7 @@ int MassDisplacer::displaceGroupMass(double displacement) {
     int result = 0;
     int attempts = 0;
     qDebug() << "Displacing mass";
-    sim->getAll();
+    backend->getAll();
 
     n_springs = sim->springs.size();
     n_masses = sim->masses.size();
@@ -1606,7 +1615,7 @@ int MassDisplacer::displaceGroupMass(double displacement) {
 
     n_springs = sim->springs.size();
 
-    sim->setAll();
+    backend->setAll();
 
     // Equilibrate simulation
     if (relaxation == 0) {
@@ -1719,7 +1728,7 @@ int MassDisplacer::displaceGroupMass(double displacement) {
         sim->masses[j]->pos = startPos[j];
         sim->masses[j]->m = startMass[j];
     }
-    sim->setAll();
+    backend->setAll();
 
     return result;
 
@@ -2197,8 +2206,8 @@ int MassDisplacer::settleSim(Simulation *sim, double eps, bool use_cap, double c
         prevTotalEnergy = totalEnergy;
 
         // Step simulation
-        sim->step(sim->masses.front()->dt * 100);
-        sim->getAll();
+        backend->step(sim->masses.front()->dt * 100);
+        backend->getAll();
         steps++;
     }
 
@@ -2213,10 +2222,10 @@ void MassDisplacer::relaxSim(Simulation *sim, int steps, vector<Mass *> track) {
 
         if (track.empty()) {
             // Step simulation
-            sim->step(sim->masses.front()->dt * steps);
-            sim->getAll();
+            backend->step(sim->masses.front()->dt * steps);
+            backend->getAll();
         } else {
-            sim->getAll();
+            backend->getAll();
             QTextStream metricStream(&customMetric);
             int n = 0;
             for (Mass *m : track) {
@@ -2227,9 +2236,12 @@ void MassDisplacer::relaxSim(Simulation *sim, int steps, vector<Mass *> track) {
                 metricStream << n << '\n';
                 n++;
             }
+            // Only the tracked masses are read back between steps
             for (int i = 0; i < steps; i++) {
-                sim->step(sim->masses.front()->dt);
-                sim->getAll();
+                backend->step(sim->masses.front()->dt);
+                for (Mass *m : track) {
+                    sync.pull(m);
+                }
                 QTextStream metricStream(&customMetric);
                 n = 0;
                 for (Mass *m : track) {
@@ -2241,6 +2253,7 @@ void MassDisplacer::relaxSim(Simulation *sim, int steps, vector<Mass *> track) {
                     n++;
                 }
             }
+            sync.pullAll();
         }
 }
 
@@ -2280,7 +2293,7 @@ SpringInserter::SpringInserter(Simulation *sim, double addRatio)
 void SpringInserter::optimize() {
 //---------------------------------------------------------------------------
 
-    sim->getAll();
+    backend->getAll();
     n_springs = sim->springs.size();
 
     vector<uint> springIndicesToSort;
@@ -2315,11 +2328,11 @@ void SpringInserter::optimize() {
         sim->createSpring(s);
         sim->springs.back()->_k = kFactor / sim->springs.back()->_rest;
         sim->springs.back()->_max_stress = 0;
-        sim->setAll();
+        backend->setAll();
     }**/
     qDebug() << "Inserted" << added << "Springs";
 
-    sim->setAll();
+    backend->setAll();
     n_springs = int(sim->springs.size());
 }
 
@@ -2435,7 +2448,7 @@ void SpringInserter::braceSpring(Spring *stressedSpring, vector<Mass *> &locatio
         omids.push_back(Utils::bisect(so->_left->origpos, so->_right->origpos));
     }
 
-    sim->pause(sim->time());
+    backend->pause(backend->time());
 
     // Create connections
     double halfcutoff = stressedSpring->_rest / 2;
@@ -2451,7 +2464,7 @@ void SpringInserter::braceSpring(Spring *stressedSpring, vector<Mass *> &locatio
 
                 Mass *n = nullptr;
                 Mass *o = nullptr;
-                sim->getAll();
+                backend->getAll();
                 for (Mass *m : sim->masses) {
                     if (m->pos == mids[i]) {
                         n = m;
@@ -2494,7 +2507,7 @@ void SpringInserter::braceSpring(Spring *stressedSpring, vector<Mass *> &locatio
                 b->_k *= tmp->_rest / b->_rest;
                 sim->createSpring(b);
 
-                sim->setAll();
+                backend->setAll();
                 added++;
 
             }
@@ -2516,7 +2529,7 @@ void SpringInserter::braceSpring(Spring *stressedSpring, vector<Mass *> &locatio
                     s->_rest = v.norm();
                     s->_k *= tmp->_rest / s->_rest;
                     sim->createSpring(s);
-                    sim->setAll();
+                    backend->setAll();
                     added++;
                 }
             }
@@ -2602,7 +2615,12 @@ qDebug() << "Bisecting spring";
     sim->createSpring(rs);
     qDebug() << "Created spring 2";
 
-    sim->setAll();
+    sync.mark(l);
+    sync.mark(r);
+    sync.mark(mid);
+    sync.mark(s);
+    sync.mark(rs);
+    sync.push();
 }
 
 // Joins two springs sharing a mass
@@ -2655,5 +2673,5 @@ void SpringInserter::joinSprings(Spring *s1, Spring *s2) {
     assert(sep1->spring_count == sc1);
     assert(sep2->spring_count == sc2);
 
-    sim->setAll();
+    backend->setAll();
 }
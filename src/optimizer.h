@@ -13,6 +13,8 @@
 #include "oUtils.h"
 #include "utils.h"
 #include "model.h"
+#include "simSync.h"
+#include "simBackend.h"
 
 /**
  * Optimizer base class
@@ -21,8 +23,9 @@ class Optimizer {
 
 public:
 
-    explicit Optimizer(Simulation *sim) {
+    explicit Optimizer(Simulation *sim) : sync(sim) {
         this->sim = sim;
+        backend = SimBackend::of(sim);
         n_masses = sim->masses.size();
         n_masses_start = n_masses;
         n_springs = sim->springs.size();
@@ -30,6 +33,8 @@ public:
     }
 
     Simulation *sim;
+    SimBackend *backend; // Steps and full uploads
+    SimSync sync; // Uploads for edits that touch a few masses and springs
     int n_masses;
     int n_masses_start;
     int n_springs;
@@ -31,6 +31,8 @@ void Parser::parseDesign(Design *design) {
 //---------------------------------------------------------------------------
 
     auto root = doc.child("dml");
+    design->path = filepath;
+
     // VOLUMES
     for (pugi::xml_node vol : root.children("volume")) {
         Volume * volume = new Volume();
@@ -218,6 +220,8 @@ void Parser::parseSimulation(pugi::xml_node dml_sim, SimulationConfig *simConfig
     LatticeConfig *lattice = new LatticeConfig();
     auto dml_lat = dml_sim.child("lattice");
     QString fill = dml_lat.attribute("fill").value();
+    QString sampling = dml_lat.attribute("sampling").value();
+    QString cell = dml_lat.attribute("cell").value();
     Vec unit = parseVec(dml_lat.attribute("unit").value());
     Vec bardiam = parseVec(dml_lat.attribute("bardiam").value());
     QString material = dml_lat.attribute("material").value();
@@ -231,6 +235,11 @@ void Parser::parseSimulation(pugi::xml_node dml_sim, SimulationConfig *simConfig
         lattice->fill = LatticeConfig::SPACE_FILL;
     else
         lattice->fill = LatticeConfig::CUBIC_FILL;
+    if (sampling == "poisson")
+        lattice->sampling = LatticeConfig::POISSON_SAMPLING;
+    else
+        lattice->sampling = LatticeConfig::FARTHEST_SAMPLING;
+    lattice->cell = LatticeConfig::cellFromName(cell);
     lattice->unit = unit;
     lattice->barDiameter = bardiam;
     lattice->material = design->materialMap[material];
@@ -5,34 +5,35 @@
 //
 
 #include "polygon.h"
+#include "decimator.h"
 
-// == operator for Nodes
-// ------------------------------------------------------------
-bool Node::operator==(const Node &node) {
-// ------------------------------------------------------------
-    return (this->p == node.p);
-}
+const uint32_t Polygon::NONE;
 
-// < operator for Nodes
+// Add node to polygon, returns index of existing node
+// at the same position
 // ------------------------------------------------------------
-bool Node::operator<(const Node &node) {
+uint32_t Polygon::addNode(Vec p) {
 // ------------------------------------------------------------
-    return (this->p[0] < node.p[0] || (this->p[0] <= node.p[0] && this->p[1] < node.p[1]))
-    || (this->p[0] <= node.p[0] && this->p[1] <= node.p[1] && this->p[2] < node.p[2]);
-}
 
-// Add node to polygon, returns ptr if existing
-// ------------------------------------------------------------
-shared_ptr<Node> Polygon::addNode(Vec p) {
-// ------------------------------------------------------------
+    // Map was released after construction, index the current nodes again
+    if (nodeMap.empty() && !px.empty()) {
+        nodeMap.reserve(px.size());
+        for (uint32_t v = 0; v < vertexCount(); v++) {
+            nodeMap.emplace(position(v), v);
+        }
+    }
 
-    if (nodeMap.find(p) == nodeMap.end()) {
-        shared_ptr<Node> n = make_shared<Node>(Node(p));
-        n->index = nodeMap.size(); // Update index
-        nodeMap[p] = move(n);
+    auto it = nodeMap.find(p);
+    if (it != nodeMap.end()) {
+        return it->second;
     }
-    return nodeMap[p];
 
+    auto index = uint32_t(px.size());
+    px.push_back(p[0]);
+    py.push_back(p[1]);
+    pz.push_back(p[2]);
+    nodeMap.emplace(p, index);
+    return index;
 }
 
 
@@ -41,12 +42,10 @@ shared_ptr<Node> Polygon::addNode(Vec p) {
 void Polygon::addTriangle(Vec v1, Vec v2, Vec v3, Vec n) {
 // ------------------------------------------------------------
 
-    shared_ptr<Node> n1 = nullptr, n2 = nullptr, n3 = nullptr;
-
     // Add or find nodes
-    n1 = addNode(v1);
-    n2 = addNode(v2);
-    n3 = addNode(v3);
+    uint32_t n1 = addNode(v1);
+    uint32_t n2 = addNode(v2);
+    uint32_t n3 = addNode(v3);
 
     // Add triangle
     addTriangle(n1, n2, n3, n);
@@ -54,314 +53,317 @@ void Polygon::addTriangle(Vec v1, Vec v2, Vec v3, Vec n) {
 
 
 // Add triangle to polygon from existing nodes
+// Adjacency is not updated until the next buildAdjacency()
 // ------------------------------------------------------------
-void Polygon::addTriangle(shared_ptr<Node> n1, shared_ptr<Node> n2, shared_ptr<Node> n3, Vec n) {
+void Polygon::addTriangle(uint32_t n1, uint32_t n2, uint32_t n3, Vec n) {
 // ------------------------------------------------------------
 
-    // Add triangle
-    shared_ptr<Tri> tri = make_shared<Tri>(Tri());
-    tri->v1 = n1;
-    tri->v2 = n2;
-    tri->v3 = n3;
-    tri->n = n;
-    triangles->push_back(move(tri));
-    tri = triangles->back();
-
-    // Add triangle to nodes
-    n1->tris.push_back(tri);
-    n2->tris.push_back(tri);
-    n3->tris.push_back(tri);
+    indices.push_back(n1);
+    indices.push_back(n2);
+    indices.push_back(n3);
+    normals.push_back(n);
+    removed.push_back(0);
 }
 
-// Remove triangle from polygon
+// Marks triangle for removal, dropped by compact()
 // -----------------------------------------------------------
-void Polygon::removeTriangle(shared_ptr<Tri> t) {
+void Polygon::removeTriangle(uint32_t t) {
+// ------------------------------------------------------------
+
+    if (!removed[t]) {
+        removed[t] = 1;
+        n_removed++;
+    }
+}
+
+// Drops removed triangles, keeping the order of the rest
+// Invalidates triangle indices and adjacency
+// ------------------------------------------------------------
+void Polygon::compact() {
 // ------------------------------------------------------------
 
-    qDebug() << "Going to remove" << t->v1->p[0] << t->v1->p[1] << t->v1->p[2] << t->v2->p[0] << t->v2->p[1] << t->v2->p[2] << t->v3->p[0] << t->v3->p[1] << t->v3->p[2];
-    t->v1->removeTri(t);
-    t->v2->removeTri(t);
-    t->v3->removeTri(t);
-    qDebug() << "Removed node tris" << t->v1->p[0] << t->v1->p[1] << t->v1->p[2];
+    if (n_removed == 0) return;
 
-    triangles->erase(remove(triangles->begin(), triangles->end(), t), triangles->end());
-    qDebug() << "Removed triangle";
+    size_t nt = triangleCount();
+    size_t kept = 0;
+    for (size_t t = 0; t < nt; t++) {
+        if (removed[t]) continue;
+        if (kept != t) {
+            indices[3 * kept] = indices[3 * t];
+            indices[3 * kept + 1] = indices[3 * t + 1];
+            indices[3 * kept + 2] = indices[3 * t + 2];
+            normals[kept] = normals[t];
+        }
+        kept++;
+    }
+
+    indices.resize(3 * kept);
+    normals.resize(kept);
+    removed.assign(kept, 0);
+    n_removed = 0;
 
+    adjStart.clear();
+    adjTris.clear();
 }
 
-// Merges current polygon with given polygon
-// Uses current polygon as combined model
+// Builds vertex to triangle adjacency with a counting sort
+// Triangles of each vertex are listed in increasing order
 // ------------------------------------------------------------
-void Polygon::mergePolygons(const Polygon &polygon) {
+void Polygon::buildAdjacency() {
 // ------------------------------------------------------------
 
-    auto nodesToAdd = vector<shared_ptr<Node>>();
-    for (auto nodePair : polygon.nodeMap) {
+    size_t nv = vertexCount();
+    size_t nt = triangleCount();
 
-        // Get node in this Polygon's node map
-        shared_ptr<Node> nodeInMap = nodeMap[nodePair.first];
+    adjStart.assign(nv + 1, 0);
+    for (size_t t = 0; t < nt; t++) {
+        if (removed[t]) continue;
+        adjStart[indices[3 * t] + 1]++;
+        adjStart[indices[3 * t + 1] + 1]++;
+        adjStart[indices[3 * t + 2] + 1]++;
+    }
+    for (size_t v = 0; v < nv; v++) {
+        adjStart[v + 1] += adjStart[v];
+    }
 
-        if (nodeInMap != nullptr) {
+    adjTris.resize(adjStart[nv]);
+    vector<uint32_t> next = vector<uint32_t>(adjStart.begin(), adjStart.end() - 1);
+    for (size_t t = 0; t < nt; t++) {
+        if (removed[t]) continue;
+        for (int k = 0; k < 3; k++) {
+            adjTris[next[indices[3 * t + k]]++] = uint32_t(t);
+        }
+    }
+}
 
-            // Set triangle connections
-            for (const auto &tri : nodePair.second->tris) {
-                if (tri->v1 == nodePair.second) {
-                    tri->v1 = nodeInMap;
-                }
-                if (tri->v2 == nodePair.second) {
-                    tri->v2 = nodeInMap;
-                }
-                if (tri->v3 == nodePair.second) {
-                    tri->v3 = nodeInMap;
-                }
-                nodeInMap->tris.push_back(tri);
-            }
-        } else {
+// Drops vertices no triangle refers to and releases the node map
+// Invalidates vertex indices and adjacency
+// ------------------------------------------------------------
+void Polygon::removeUnusedNodes() {
+// ------------------------------------------------------------
 
-            // Add node
-            this->nodeMap[nodePair.first] = move(nodePair.second);
+    size_t nv = vertexCount();
+    vector<uint32_t> remap = vector<uint32_t>(nv, NONE);
+    for (size_t t = 0; t < triangleCount(); t++) {
+        if (removed[t]) continue;
+        for (int k = 0; k < 3; k++) {
+            remap[indices[3 * t + k]] = 0;
         }
     }
 
+    uint32_t kept = 0;
+    for (size_t v = 0; v < nv; v++) {
+        if (remap[v] == NONE) continue;
+        px[kept] = px[v];
+        py[kept] = py[v];
+        pz[kept] = pz[v];
+        remap[v] = kept++;
+    }
+    px.resize(kept);
+    py.resize(kept);
+    pz.resize(kept);
+
+    for (uint32_t &i : indices) {
+        i = remap[i];
+    }
+
+    releaseNodeMap();
+
+    adjStart.clear();
+    adjTris.clear();
+}
+
+// Merges current polygon with given polygon
+// Uses current polygon as combined model
+// ------------------------------------------------------------
+void Polygon::mergePolygons(const Polygon &polygon) {
+// ------------------------------------------------------------
+
+    // Nodes at the same position are shared
+    vector<uint32_t> remap = vector<uint32_t>(polygon.vertexCount());
+    for (uint32_t v = 0; v < polygon.vertexCount(); v++) {
+        remap[v] = addNode(polygon.position(v));
+    }
+
     // Add triangles
-    triangles->insert(triangles->end(), polygon.triangles->begin(), polygon.triangles->end());
+    size_t nt = polygon.triangleCount();
+    indices.reserve(indices.size() + 3 * nt);
+    normals.reserve(normals.size() + nt);
+    removed.reserve(removed.size() + nt);
+
+    for (uint32_t t = 0; t < nt; t++) {
+        if (polygon.removed[t]) continue;
+        addTriangle(remap[polygon.corner(t, 0)], remap[polygon.corner(t, 1)], remap[polygon.corner(t, 2)],
+                    polygon.normals[t]);
+    }
 }
 
 
-// Checks normal consistency and fixes bad normals
+// Finds the triangle across each edge, across[3 * t + k] is the
+// neighbor over edge (corner k, corner k + 1) or NONE on boundaries
+// Requires current adjacency
 // ------------------------------------------------------------
-int Polygon::fixNormals() {
+void Polygon::edgeNeighbors(vector<uint32_t> &across) {
 // ------------------------------------------------------------
 
-    int flipcnt = 0;
+    size_t nt = triangleCount();
+    across.assign(3 * nt, NONE);
 
-    for (int k = 0; k  < 10; k++) {
-        int fixed = 0;
+    #pragma omp parallel for schedule(static)
+    for (long t = 0; t < long(nt); t++) {
+        if (removed[t]) continue;
 
-        for (auto t : *triangles) {
-            int neighbors = 0;
-            int inconsistent = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t a = indices[3 * t + k];
+            uint32_t b = indices[3 * t + (k + 1) % 3];
 
-            // Remove if degenerate
-            if (t == nullptr || t->v1 == nullptr || t->v2 == nullptr || t->v3 == nullptr) {
-                triangles->erase(remove(triangles->begin(), triangles->end(), t), triangles->end());
-                continue;
-            }
-
-            /**for (auto t1 : t->v1->tris) {
-                if (t1 != t && sharedNodes(*t, *t1) == 2) {
-                    neighbors++;
-                    if (!isNormalConsistent(t, t1)) {
-                        inconsistent++;
-                    }
-                }
-            }
-            for (auto t2 : t->v2->tris) {
-                if (t2 != t && sharedNodes(*t, *t2) == 2) {
-                    neighbors++;
-                    if (!isNormalConsistent(t, t2)) {
-                        inconsistent++;
-                    }
-                }
-            }
-            for (auto t3 : t->v3->tris) {
-                if (t3 != t && sharedNodes(*t, *t3) == 2) {
-                    neighbors++;
-                    if (!isNormalConsistent(t, t3)) {
-                        inconsistent++;
-                    }
+            for (const uint32_t *it = trisBegin(a); it != trisEnd(a); it++) {
+                if (*it == uint32_t(t)) continue;
+                const uint32_t *c = &indices[3 * *it];
+                if (c[0] == b || c[1] == b || c[2] == b) {
+                    across[3 * t + k] = *it;
+                    break;
                 }
             }
-
-            // If inconsistent with most neighbors, flip
-            if (neighbors > 1 && (inconsistent > neighbors / 4)) {
-                t->n = -t->n;
-                flipcnt++;
-                fixed++;
-            }**/
-        }
-        qDebug() << "Fixed" << fixed;
-        if (fixed == 0) {
-            break;
         }
     }
+}
 
-    // Make sure triangles are arranged clockwise
-    for (auto t : *triangles) {
-        Vec ax1 = (t->v2->p - t->v1->p).normalized();
-        Vec ax2 = (t->v3->p - t->v2->p).normalized();
-        Vec norm = cross(ax1, ax2).normalized();
-        if (dot(norm, t->n) < 0) {
-            shared_ptr<Node> c = t->v1;
-            t->v1 = t->v3;
-            t->v3 = c;
-            c.reset();
-        }
-    }
+// Orients triangles consistently within each connected component
+// Flood fills the winding from a seed triangle, then points each
+// component outward by its signed volume (inward for cavities).
+// Normals are reset to match the winding, returns flipped triangles
+// ------------------------------------------------------------
+int Polygon::fixNormals() {
+// ------------------------------------------------------------
 
     // Remove degenerates
-    for (auto t : *triangles) {
-        if (t == nullptr) {
-            qDebug() << "Found null degenerate";
-            triangles->erase(remove(triangles->begin(), triangles->end(), t), triangles->end());
-            continue;
-        }
-        if (t->v1 == t->v2 || t->v2 == t->v3 || t->v3 == t->v1) {
+    for (uint32_t t = 0; t < triangleCount(); t++) {
+        if (removed[t]) continue;
+
+        if (corner(t, 0) == corner(t, 1) || corner(t, 1) == corner(t, 2) || corner(t, 2) == corner(t, 0)) {
             removeTriangle(t);
-            qDebug() << "Found degenerate";
         }
     }
-    qDebug() << "End of fix normals";
-    return flipcnt;
-}
-
-// Finds coplanar triangles and attempts to combine them
-// ------------------------------------------------------------
-void Polygon::reduceMesh(double eps, double factor) {
-// ------------------------------------------------------------
+    if (n_removed > 0) qDebug() << "Removed" << n_removed << "degenerate triangles";
+    compact();
 
-    int origSize = this->triangles->size();
-    int totalReduced = 0;
-    shared_ptr<Node> n0;
+    size_t nt = triangleCount();
+    if (nt == 0) return 0;
 
-    RESTART:
-    int simplified = 0;
-    flipTriangleEdges(eps);
+    buildAdjacency();
+    vector<uint32_t> across = vector<uint32_t>();
+    edgeNeighbors(across);
 
-    for (const auto &nodePair : this->nodeMap) {
+    // Component id and winding relative to the component seed
+    vector<uint32_t> component = vector<uint32_t>(nt, NONE);
+    vector<uint8_t> flip = vector<uint8_t>(nt, 0);
+    vector<uint32_t> queue = vector<uint32_t>();
+    queue.reserve(nt);
+    vector<uint32_t> seeds = vector<uint32_t>();
+    vector<double> volumes = vector<double>();
 
-        vector<shared_ptr<Node>> nodeQuad = vector<shared_ptr<Node>>();
-        vector<shared_ptr<Tri>> triQuad = vector<shared_ptr<Tri>>(4);
-        vector<int> nodeCounts = vector<int>(5);
+    for (uint32_t seed = 0; seed < nt; seed++) {
+        if (component[seed] != NONE) continue;
 
-        // Find nodes attached to 4 triangles
-        if (nodePair.second->tris.size() == 4) {
+        auto c = uint32_t(seeds.size());
+        seeds.push_back(seed);
+        double volume = 0;
 
-            n0 = nodePair.second;
-            nodeQuad.push_back(n0);
-            nodeCounts[0] = 4;
+        size_t head = queue.size();
+        queue.push_back(seed);
+        component[seed] = c;
 
-            for (int i = 0; i < 4; i++) {
-                shared_ptr<Tri> t = n0->tris[i];
-                triQuad[i] = t;
+        while (head < queue.size()) {
+            uint32_t t = queue[head++];
 
-                auto i1 = find(nodeQuad.begin(), nodeQuad.end(), t->v1);
-                auto i2 = find(nodeQuad.begin(), nodeQuad.end(), t->v2);
-                auto i3 = find(nodeQuad.begin(), nodeQuad.end(), t->v3);
+            for (int k = 0; k < 3; k++) {
+                uint32_t t2 = across[3 * t + k];
+                if (t2 == NONE || component[t2] != NONE) continue;
 
-                if (i1 == nodeQuad.end() || i1 - nodeQuad.begin() >= nodeQuad.size()) {
-                    nodeCounts[nodeQuad.size()]++;
-                    nodeQuad.push_back(t->v1);
-                } else {
-                    nodeCounts[i1 - nodeQuad.begin()]++;
+                // Consistent neighbors traverse the shared edge in opposite directions
+                uint32_t a = corner(t, k);
+                uint32_t b = corner(t, (k + 1) % 3);
+                bool same = false;
+                for (int j = 0; j < 3; j++) {
+                    if (corner(t2, j) == a && corner(t2, (j + 1) % 3) == b) same = true;
                 }
-                if (i2 == nodeQuad.end() || i2 - nodeQuad.begin() >= nodeQuad.size()) {
-                    nodeCounts[nodeQuad.size()]++;
-                    nodeQuad.push_back(t->v2);
-                } else {
-                    nodeCounts[i2 - nodeQuad.begin()]++;
-                }
-                if (i3 == nodeQuad.end() || i3 - nodeQuad.begin() >= nodeQuad.size()) {
-                    nodeCounts[nodeQuad.size()]++;
-                    nodeQuad.push_back(t->v3);
-                } else {
-                    nodeCounts[i3 - nodeQuad.begin()]++;
-                }
-
-            }
-
-            // Check that we found 5 nodes, one attached to all 4 triangles,
-            // and the rest attached to 2 relevant triangles each
-            int scnt = 0;
 
-            for (int i = 0; i < 5; i++) {
-                if (nodeCounts[i] != 2 && nodeCounts[i] != 4) {
-                    continue;
-                }
-                scnt += nodeCounts[i];
-            }
-            if (scnt != 12) {
-                // Sum should be 12
-                //qDebug() << "Total node count" << scnt;
-                continue;
+                flip[t2] = flip[t] ^ uint8_t(same);
+                component[t2] = c;
+                queue.push_back(t2);
             }
 
-            qDebug() << "Found quad node";
-
-            // Attempt to consolidate triangles
-            if (sharedNodes(*triQuad[0], *triQuad[1]) == 2 && sharedNodes(*triQuad[2], *triQuad[3]) == 2) {
-                if (consolidateTriangle(triQuad[0], triQuad[1], n0, eps)) simplified++;
-                if (consolidateTriangle(triQuad[2], triQuad[3], n0, eps)) simplified++;
-            } else if (sharedNodes(*triQuad[0], *triQuad[2]) == 2 && sharedNodes(*triQuad[1], *triQuad[3]) == 2) {
-                if (consolidateTriangle(triQuad[0], triQuad[2], n0, eps)) simplified++;
-                if (consolidateTriangle(triQuad[1], triQuad[3], n0, eps)) simplified++;
+            // Signed volume of the tetrahedron to the origin, in component winding
+            Vec p0 = position(corner(t, 0)), p1 = position(corner(t, 1)), p2 = position(corner(t, 2));
+            double v = dot(p0, cross(p1, p2)) / 6.0;
+            volume += flip[t] ? -v : v;
+        }
+        volumes.push_back(volume);
+    }
+
+    // Orient each component outward
+    vector<uint8_t> reverse = vector<uint8_t>(seeds.size(), 0);
+    for (size_t c = 0; c < seeds.size(); c++) {
+        reverse[c] = volumes[c] < 0;
+    }
+
+    // Components enclosed by an odd number of others bound cavities
+    if (seeds.size() > 1) {
+        buildBVH();
+        Vec minp, maxp;
+        boundingPoints(minp, maxp);
+        double offset = 1E-6 * (maxp - minp).norm();
+
+        for (size_t c = 0; c < seeds.size(); c++) {
+            uint32_t t = seeds[c];
+            Vec p0 = position(corner(t, 0)), p1 = position(corner(t, 1)), p2 = position(corner(t, 2));
+            Vec n = cross(p1 - p0, p2 - p0);
+            if (n.norm() <= 0) continue;
+            n = n.normalized();
+            if (flip[t] != reverse[c]) n = -n;
+
+            // Just outside this component, crossings of it cancel out
+            Vec q = (p0 + p1 + p2) / 3.0 + n * offset;
+            vec3 dir = Utils::randDirection();
+            if (bvh.countCrossings(vec3(q[0], q[1], q[2]), dir) % 2 == 1) {
+                reverse[c] = !reverse[c];
             }
-
-            qDebug() << "Simplified" << simplified;
         }
-
     }
 
-    totalReduced += simplified*2;
+    int flipcnt = 0;
+    for (uint32_t t = 0; t < nt; t++) {
+        uint32_t *c = &indices[3 * t];
+        if (flip[t] != reverse[component[t]]) {
+            std::swap(c[0], c[2]);
+            flipcnt++;
+        }
 
-    if (1.0*totalReduced/origSize < factor && simplified > 0) {
-        goto RESTART;
+        Vec n = cross(position(c[1]) - position(c[0]), position(c[2]) - position(c[0]));
+        if (n.norm() > 0) normals[t] = n.normalized();
     }
-}
 
+    qDebug() << "Oriented" << seeds.size() << "components";
+    return flipcnt;
+}
 
-// Swaps diagonal of adjacent coplanar triangles
+// Simplifies the mesh with quadric edge collapses
+// Removes up to factor of the triangles, collapses that would move
+// the surface by more than eps are skipped
 // ------------------------------------------------------------
-void Polygon::flipTriangleEdges(double eps) {
+void Polygon::reduceMesh(double eps, double factor) {
 // ------------------------------------------------------------
 
-    qDebug() << "Flipping diagonals";
-    for (shared_ptr<Tri> tri1 : *this->triangles) {
-
-        // Search adjacent triangles
-        vector<shared_ptr<Tri>> adjTris = tri1->v1->tris;
-        adjTris.insert(adjTris.end(), tri1->v2->tris.begin(), tri1->v2->tris.end());
-        adjTris.insert(adjTris.end(), tri1->v3->tris.begin(), tri1->v3->tris.end());
-
-        for (shared_ptr<Tri> tri2 : adjTris) {
-            if (sharedNodes(*tri1, *tri2) == 2) {
-
-                shared_ptr<Node> ncom1 = nullptr, ncom2 = nullptr, nsep1 = nullptr, nsep2 = nullptr;
-
-                findTwoCommon(*tri1, *tri2, ncom1, ncom2, nsep1, nsep2);
+    compact();
+    size_t origSize = triangleCount();
+    if (origSize == 0) return;
 
-                if (Utils::areCloseToCoplanar(ncom1->p, nsep1->p, ncom2->p, nsep2->p, eps) &&
-                    !Utils::areCloseToColinear(nsep1->p, nsep2->p, ncom1->p, 0.01) &&
-                    !Utils::areCloseToColinear(nsep1->p, nsep2->p, ncom2->p, 0.01)) {
+    auto target = size_t(origSize * std::max(0.0, 1.0 - factor));
+    size_t remaining = Decimator(*this).decimate(target, eps);
+    bvh.clear();
 
-                    Vec normalAvg = (tri1->n + tri2->n) * 0.5;
-
-                    tri1->v1 = nsep1;
-                    tri1->v2 = nsep2;
-                    tri1->v3 = ncom1;
-                    tri2->v1 = nsep1;
-                    tri2->v2 = nsep2;
-                    tri2->v3 = ncom2;
-                    tri1->n = normalAvg;
-                    tri2->n = normalAvg;
-
-                    if (find(nsep1->tris.begin(), nsep1->tris.end(), tri1) == nsep1->tris.end()) {
-                        nsep1->tris.push_back(tri1);
-                    } else {
-                        nsep2->tris.push_back(tri1);
-                    }
-                    if (find(nsep1->tris.begin(), nsep1->tris.end(), tri2) == nsep1->tris.end()) {
-                        nsep1->tris.push_back(tri2);
-                    } else {
-                        nsep2->tris.push_back(tri2);
-                    }
-
-                    ncom1->removeTri(tri2);
-                    ncom2->removeTri(tri1);
-                }
-            }
-        }
-    }
+    qDebug() << "Reduced mesh from" << origSize << "to" << remaining << "triangles";
 }
 
 
@@ -372,7 +374,7 @@ void Polygon::createPolygonFromFile(string path, float scale) {
 // ------------------------------------------------------------
 
     // Check that this is an empty Polygon
-    assert(this->triangles->empty());
+    assert(this->indices.empty());
     assert(this->nodeMap.empty());
 
     // Vertex vectors
@@ -383,72 +385,106 @@ void Polygon::createPolygonFromFile(string path, float scale) {
     assert(vs.size() == ns.size());
 
     // Fill Polygon data structures
+    indices.reserve(vs.size());
+    normals.reserve(vs.size() / 3);
+    removed.reserve(vs.size() / 3);
     for (int i = 0; i < vs.size(); i+=3) {
         addTriangle(vs[i], vs[i+1], vs[i+2], ns[i]);
     }
+    releaseNodeMap();
 
 }
 
 
-// Convertes Polygon into float arrays with position and normal values
-// Arranged sequentially
+// Converts a triangle soup into Polygon
+// Every 3 vertices constitutes a triangle, ns holds a normal per vertex
 // ------------------------------------------------------------
-void Polygon::createGraphicsData(float *vs, float *ns) {
+void Polygon::createPolygonFromTriangles(const vec3 *vs, const vec3 *ns, size_t n_tris) {
 // ------------------------------------------------------------
 
-    // Reallocate arrays
-    delete vs;
-    delete ns;
-    vs = new float[triangles->size() * 3 * 3];
-    ns = new float[triangles->size() * 3 * 3];
+    assert(this->indices.empty());
 
-    int vn = 0;
-    for (const auto &t : *this->triangles) {
+    indices.reserve(3 * n_tris);
+    normals.reserve(n_tris);
+    removed.reserve(n_tris);
+    for (size_t t = 0; t < n_tris; t++) {
+        const vec3 *v = vs + 3 * t;
+        addTriangle(Vec(v[0].x, v[0].y, v[0].z),
+                    Vec(v[1].x, v[1].y, v[1].z),
+                    Vec(v[2].x, v[2].y, v[2].z),
+                    Vec(ns[3 * t].x, ns[3 * t].y, ns[3 * t].z));
+    }
+    releaseNodeMap();
 
-        for (int i = 0; i < 3; i++) {
-            vs[vn * 3 + i] = t->v1->p.data[i];
-        }
-        for (int j = 0; j < 3; j++) {
-            ns[vn * 3 + j] = t->n[j];
-        }
-        vn++;
-        for (int i = 0; i < 3; i++) {
-            vs[vn * 3 + i] = t->v2->p.data[i];
-        }
-        for (int j = 0; j < 3; j++) {
-            ns[vn * 3 + j] = t->n[j];
-        }
-        vn++;
-        for (int i = 0; i < 3; i++) {
-            vs[vn * 3 + i] = t->v3->p.data[i];
-        }
-        for (int j = 0; j < 3; j++) {
-            ns[vn * 3 + j] = t->n[j];
-        }
-        vn ++;
+}
 
+
+// Writes Polygon into float arrays with position and normal values
+// Arranged sequentially, arrays hold 9 floats per triangle
+// ------------------------------------------------------------
+void Polygon::createGraphicsData(float *vs, float *ns) {
+// ------------------------------------------------------------
+
+    int vn = 0;
+    for (uint32_t t = 0; t < triangleCount(); t++) {
+        if (removed[t]) continue;
+
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = corner(t, k);
+            vs[vn * 3] = float(px[v]);
+            vs[vn * 3 + 1] = float(py[v]);
+            vs[vn * 3 + 2] = float(pz[v]);
+            for (int j = 0; j < 3; j++) {
+                ns[vn * 3 + j] = float(normals[t][j]);
+            }
+            vn++;
+        }
     }
 
 }
 
+// Frees the position to vertex map, addNode() rebuilds it when
+// nodes are added again
+// ------------------------------------------------------------
+void Polygon::releaseNodeMap() {
+// ------------------------------------------------------------
+    unordered_map<Vec, uint32_t, vec_hash>().swap(nodeMap);
+}
+
 // Clear nodes and triangles from polygon
 // ------------------------------------------------------------
 void Polygon::clearPolygon() {
 // ------------------------------------------------------------
-    for (auto n : nodeMap) {
-        for (auto t : n.second->tris) {
-            t.reset();
+    vector<double>().swap(px);
+    vector<double>().swap(py);
+    vector<double>().swap(pz);
+    releaseNodeMap();
+    vector<uint32_t>().swap(indices);
+    vector<Vec>().swap(normals);
+    vector<uint8_t>().swap(removed);
+    n_removed = 0;
+    vector<uint32_t>().swap(adjStart);
+    vector<uint32_t>().swap(adjTris);
+    bvh.clear();
+}
+
+// Builds a BVH over the current triangles for isInside queries
+// ------------------------------------------------------------
+void Polygon::buildBVH() {
+// ------------------------------------------------------------
+
+    vector<vec3> soup = vector<vec3>();
+    soup.reserve(indices.size());
+
+    for (uint32_t t = 0; t < triangleCount(); t++) {
+        if (removed[t]) continue;
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = corner(t, k);
+            soup.emplace_back(px[v], py[v], pz[v]);
         }
-        n.second.reset();
     }
-    for (auto t : *triangles) {
-        t->v1.reset();
-        t->v2.reset();
-        t->v3.reset();
-        t.reset();
-    }
-    nodeMap.clear();
-    triangles->clear();
+
+    bvh.build(soup.data(), soup.size() / 3);
 }
 
 // Returns the UNION of two Polygons
@@ -468,18 +504,18 @@ void Polygon::unionPolygons(Polygon &other, Polygon &polygon) {
 
     qDebug() << "Intersection box" << imin[0] << imin[1] << imin[2] << "x" << imax[0] << imax[1] << imax[2];
 
-    vector<shared_ptr<Tri>> trisInIntersection1 = vector<shared_ptr<Tri>>();
-    vector<shared_ptr<Tri>> trisInIntersection2 = vector<shared_ptr<Tri>>();
-    for (const auto &t : *this->triangles) {
+    vector<uint32_t> trisInIntersection1 = vector<uint32_t>();
+    vector<uint32_t> trisInIntersection2 = vector<uint32_t>();
+    for (uint32_t t = 0; t < this->triangleCount(); t++) {
 
-        if (withinBounds(imin, imax, *t)) {
+        if (!this->removed[t] && withinBounds(imin, imax, t)) {
             trisInIntersection1.push_back(t);
         }
 
     }
-    for (const auto &t : *other.triangles) {
+    for (uint32_t t = 0; t < other.triangleCount(); t++) {
 
-        if (withinBounds(imin, imax, *t)) {
+        if (!other.removed[t] && other.withinBounds(imin, imax, t)) {
             trisInIntersection2.push_back(t);
         }
 
@@ -498,16 +534,25 @@ void Polygon::unionPolygons(Polygon &other, Polygon &polygon) {
 bool Polygon::isInside(Vec point) {
 // ------------------------------------------------------------
 
-    int intersections = 0;
+    Vec dir = Vec(Utils::randUnit(), Utils::randUnit(), Utils::randUnit()).normalized();
 
+    if (!bvh.empty()) {
+        return bvh.isInside(vec3(point[0], point[1], point[2]), vec3(dir[0], dir[1], dir[2]));
+    }
+
+    // Brute force over all triangles when no BVH has been built
+    int intersections = 0;
     Vec p;
-    Vec dir = Vec(Utils::randUnit(), Utils::randUnit(), Utils::randUnit()).normalized();
 
-    for (auto t : *triangles) {
+    for (uint32_t t = 0; t < triangleCount(); t++) {
+        if (removed[t]) continue;
 
-        bool ip = intersectPlane(*t, point, dir, p);
+        bool ip = intersectPlane(t, point, dir, p);
         if (ip && p[0] > point[0] && p[1] > point[1] && p[2] > point[2]) {
-            if (Utils::insideTriangle(t->v1->p, t->v2->p, t->v3->p, p)) {
+            Vec a = position(corner(t, 0));
+            Vec b = position(corner(t, 1));
+            Vec c = position(corner(t, 2));
+            if (Utils::insideTriangle(a, b, c, p)) {
                 intersections++;
             }
         }
@@ -522,9 +567,14 @@ bool Polygon::isInside(Vec point) {
 bool Polygon::isCloseToEdge(const Vec &point, double eps) {
 // ------------------------------------------------------------
 
-    for (const auto &n : nodeMap) {
+    // Distance to the surface when a BVH is built, closest node otherwise
+    if (!bvh.empty()) {
+        return bvh.withinDistance(vec3(point[0], point[1], point[2]), float(eps));
+    }
+
+    for (uint32_t v = 0; v < vertexCount(); v++) {
 
-        if ((n.first - point).norm() <= eps) {
+        if ((position(v) - point).norm() <= eps) {
             return true;
         }
     }
@@ -541,8 +591,8 @@ void Polygon::boundingPoints(Vec &minp, Vec &maxp){
     Vec minCorner = Vec(DBL_MAX, DBL_MAX, DBL_MAX);
     Vec maxCorner = Vec(-DBL_MAX, -DBL_MAX, -DBL_MAX);
 
-    for (auto n : nodeMap) {
-        Vec p = n.first;
+    for (uint32_t v = 0; v < vertexCount(); v++) {
+        Vec p = position(v);
         minCorner[0] = std::min(minCorner[0], p[0]);
         minCorner[1] = std::min(minCorner[1], p[1]);
         minCorner[2] = std::min(minCorner[2], p[2]);
@@ -577,17 +627,17 @@ bool Polygon::withinBounds(const Vec &bmin, const Vec &bmax, const Vec &p) {
 
 // Returns whether a triangle is within some dimensional bounds (inclusive)
 // ------------------------------------------------------------
-bool Polygon::withinBounds(const Vec &bmin, const Vec &bmax, const Tri &t) {
+bool Polygon::withinBounds(const Vec &bmin, const Vec &bmax, uint32_t t) {
 // ------------------------------------------------------------
 
     bool inside = false;
-    if (withinBounds(bmin, bmax, t.v1->p)) {
+    if (withinBounds(bmin, bmax, position(corner(t, 0)))) {
         inside = true;
     }
-    if (withinBounds(bmin, bmax, t.v2->p)) {
+    if (withinBounds(bmin, bmax, position(corner(t, 1)))) {
         inside = true;
     }
-    if (withinBounds(bmin, bmax, t.v3->p)) {
+    if (withinBounds(bmin, bmax, position(corner(t, 2)))) {
         inside = true;
     }
 
@@ -601,15 +651,15 @@ bool Polygon::withinBounds(const Vec &bmin, const Vec &bmax, const Tri &t) {
 // if there is no intersection, return false
 // see http://www.devmaster.net/wiki/Ray-triangle_intersection
 // ------------------------------------------------------------
-bool Polygon::intersectPlane(const Tri &t, Vec o, Vec dir, Vec &p) {
+bool Polygon::intersectPlane(uint32_t t, Vec o, Vec dir, Vec &p) {
 // ------------------------------------------------------------
 
     double EPSILON = 1E-5;
     assert(fabs(fabs(dir.norm()) - 1) < EPSILON); // dir must be a unit vector
 
-    Vec a = t.v1->p;
-    Vec b = t.v2->p;
-    Vec c = t.v3->p;
+    Vec a = position(corner(t, 0));
+    Vec b = position(corner(t, 1));
+    Vec c = position(corner(t, 2));
     Vec ba = b - a;
     Vec ca = c - a;
     Vec n = cross(ba, ca); // triangle normal unit vector
@@ -629,20 +679,16 @@ bool Polygon::intersectPlane(const Tri &t, Vec o, Vec dir, Vec &p) {
 
 // Returns number of nodes shared by two triangles
 // ------------------------------------------------------------
-int Polygon::sharedNodes(const Tri &t1, const Tri &t2) {
+int Polygon::sharedNodes(uint32_t t1, uint32_t t2) {
 // ------------------------------------------------------------
 
     int shared = 0;
 
-    if (t1.v1 == t2.v1) shared++;
-    if (t1.v1 == t2.v2) shared++;
-    if (t1.v1 == t2.v3) shared++;
-    if (t1.v2 == t2.v1) shared++;
-    if (t1.v2 == t2.v2) shared++;
-    if (t1.v2 == t2.v3) shared++;
-    if (t1.v3 == t2.v1) shared++;
-    if (t1.v3 == t2.v2) shared++;
-    if (t1.v3 == t2.v3) shared++;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (corner(t1, i) == corner(t2, j)) shared++;
+        }
+    }
 
     return shared;
 }
@@ -650,92 +696,54 @@ int Polygon::sharedNodes(const Tri &t1, const Tri &t2) {
 // For cases where two triangles share an edge
 // Sets common nodes and separate nodes
 // ------------------------------------------------------------
-void Polygon::findTwoCommon(const Tri &t1, const Tri &t2,
-        shared_ptr<Node> &ncom1, shared_ptr<Node> &ncom2,
-        shared_ptr<Node> &nsep1, shared_ptr<Node> &nsep2) {
+void Polygon::findTwoCommon(uint32_t t1, uint32_t t2,
+        uint32_t &ncom1, uint32_t &ncom2,
+        uint32_t &nsep1, uint32_t &nsep2) {
 // ------------------------------------------------------------
 
+    ncom1 = ncom2 = nsep1 = nsep2 = NONE;
+
     // Find common vertices
-    if (t1.v1 == t2.v1 || t1.v1 == t2.v2 || t1.v1 == t2.v3) {
-        ncom1 = t1.v1;
-    }
-    if (t1.v2 == t2.v1 || t1.v2 == t2.v2 || t1.v2 == t2.v3) {
-        if (ncom1 == nullptr) {
-            ncom1 = t1.v2;
+    for (int i = 0; i < 3; i++) {
+        uint32_t v = corner(t1, i);
+        if (v == corner(t2, 0) || v == corner(t2, 1) || v == corner(t2, 2)) {
+            if (ncom1 == NONE) {
+                ncom1 = v;
+            } else {
+                ncom2 = v;
+            }
         } else {
-            ncom2 = t1.v2;
+            nsep1 = v; // Separate vertex of t1
         }
     }
-    if (t1.v3 == t2.v1 || t1.v3 == t2.v2 || t1.v3 == t2.v3) {
-        ncom2 = t1.v3;
-    }
-
-    // Find separate vertices (one per triangle)
-    if (t1.v1 != ncom1 && t1.v1 != ncom2) {
-        nsep1 = t1.v1;
-    }
-    if (t1.v2 != ncom1 && t1.v2 != ncom2) {
-        nsep1 = t1.v2;
-    }
-    if (t1.v3 != ncom1 && t1.v3 != ncom2) {
-        nsep1 = t1.v3;
-    }
 
-    if (t2.v1 != ncom1 && t2.v1 != ncom2) {
-        nsep2 = t2.v1;
-    }
-    if (t2.v2 != ncom1 && t2.v2 != ncom2) {
-        nsep2 = t2.v2;
-    }
-    if (t2.v3 != ncom1 && t2.v3 != ncom2) {
-        nsep2 = t2.v3;
-    }
-
-}
-
-// Consolidates a pair of triangles that share an edge
-// and colinearity of a joined edge defined by eps
-// centerNode is the center node of the colinear edge
-// ------------------------------------------------------------
-bool Polygon::consolidateTriangle(shared_ptr<Tri> t1, shared_ptr<Tri> t2,
-        shared_ptr<Node> centerNode, double eps) {
-// ------------------------------------------------------------
-
-    shared_ptr<Node> ncom1 = nullptr, ncom2 = nullptr, nsep1 = nullptr, nsep2 = nullptr;
-
-    findTwoCommon(*t1, *t2, ncom1, ncom2, nsep1, nsep2);
-    if (Utils::distPointLine(centerNode->p, nsep1->p, nsep2->p) < eps) {
-
-        Vec normalAvg = (t1->n + t2->n) * 0.5;
-
-        shared_ptr<Node> out = (ncom1 == centerNode) ? ncom2 : ncom1;
-        this->addTriangle(nsep1, nsep2, out, normalAvg);
-        this->removeTriangle(t1);
-        this->removeTriangle(t2);
-
-        return true;
+    // Separate vertex of t2
+    for (int j = 0; j < 3; j++) {
+        uint32_t v = corner(t2, j);
+        if (v != ncom1 && v != ncom2) {
+            nsep2 = v;
+        }
     }
 
-    return false;
 }
 
 // Checks normals between two neighboring triangles
 // Returns true if normals are consistent
 // ------------------------------------------------------------
-bool Polygon::isNormalConsistent(const shared_ptr<Tri> &t1, const shared_ptr<Tri> &t2) {
+bool Polygon::isNormalConsistent(uint32_t t1, uint32_t t2) {
 // ------------------------------------------------------------
 
-    assert(sharedNodes(*t1, *t2) > 1);
+    assert(sharedNodes(t1, t2) > 1);
 
-    shared_ptr<Node> ncom1 = nullptr, ncom2 = nullptr, nsep1 = nullptr, nsep2 = nullptr;
+    uint32_t ncom1, ncom2, nsep1, nsep2;
 
-    findTwoCommon(*t1, *t2, ncom1, ncom2, nsep1, nsep2);
+    findTwoCommon(t1, t2, ncom1, ncom2, nsep1, nsep2);
 
-    Vec jax = (ncom2->p - ncom1->p).normalized();
-    Vec t1n = cross(jax, ncom2->p - nsep1->p).normalized();
-    double t1s = dot(t1n, t1->n);
-    Vec t2n = cross(ncom2->p, nsep2->p).normalized();
-    double t2s = dot(t2n, t2->n);
+    Vec jax = (position(ncom2) - position(ncom1)).normalized();
+    Vec t1n = cross(jax, position(ncom2) - position(nsep1)).normalized();
+    double t1s = dot(t1n, normals[t1]);
+    Vec t2n = cross(jax, position(ncom2) - position(nsep2)).normalized();
+    double t2s = dot(t2n, normals[t2]);
 
     return (t1s * t2s < 0);
 }
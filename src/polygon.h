@@ -6,74 +6,72 @@
 #define DMLIDE_POLYGON_H
 
 #include <QDebug>
+#include <cstdint>
+#include <cstring>
 #include <unordered_map>
 
+#include "bvh.h"
 #include "utils.h"
 
-class Node;
-class Tri;
 class Polygon;
 
 
+// Hashes the bit patterns of the coordinates
+// Plain XOR of the coordinate hashes collides on axis aligned grids
 struct vec_hash {
-    size_t operator()(const Vec &vec) const {
-        return hash<double>()(vec[0]) ^ hash<double>()(vec[1]) ^ hash<double>()(vec[2]);
+    static size_t mix(uint64_t x) {
+        x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+        x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+        return size_t(x ^ (x >> 31));
     }
-};
-
-class Node {
-
-public:
-    Vec p;
-    vector<shared_ptr<Tri>> tris;
-    unsigned int index;
 
-    Node() = default;
-    explicit Node(const Vec &p) { this->p = p; }
-
-    bool operator==(const Node &n);
-    bool operator<(const Node &n);
-
-    void removeTri(shared_ptr<Tri> t) {
-        tris.erase(remove(tris.begin(), tris.end(), t), tris.end());
+    size_t operator()(const Vec &vec) const {
+        size_t h = 0;
+        for (int i = 0; i < 3; i++) {
+            double d = vec[i] + 0.0; // -0 and 0 hash alike
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            h = mix(bits + h);
+        }
+        return h;
     }
 };
 
-class Tri {
-
-public:
-    Vec n;
-    shared_ptr<Node> v1;
-    shared_ptr<Node> v2;
-    shared_ptr<Node> v3;
-
-    Tri() = default;
-};
-
+// Indexed triangle mesh
+// Positions are stored SoA, triangles as vertex index triples.
+// Vertex to triangle adjacency is a CSR table rebuilt on demand.
 class Polygon {
 
 public:
-    Polygon() {
-        triangles = new vector<shared_ptr<Tri>>();
-    }
-
-    ~Polygon() {
-        delete triangles;
-        nodeMap.clear();
-    }
+    Polygon() = default;
 
-    shared_ptr<Node> addNode(Vec p);
+    uint32_t addNode(Vec p);
     void addTriangle(Vec v1, Vec v2, Vec v3, Vec n);
-    void addTriangle(shared_ptr<Node> n1, shared_ptr<Node> n2, shared_ptr<Node> n3, Vec n);
-    void removeTriangle(shared_ptr<Tri> t);
+    void addTriangle(uint32_t n1, uint32_t n2, uint32_t n3, Vec n);
+    void removeTriangle(uint32_t t);
+    void compact();
+    void removeUnusedNodes();
+    void buildAdjacency();
+    void edgeNeighbors(vector<uint32_t> &across);
     void mergePolygons(const Polygon &polygon);
     void reduceMesh(double eps, double factor);
-    void flipTriangleEdges(double eps);
     int fixNormals();
     void createPolygonFromFile(string path, float scale);
+    void createPolygonFromTriangles(const vec3 *vs, const vec3 *ns, size_t n_tris);
     void createGraphicsData(float *vs, float *ns);
     void clearPolygon();
+    void releaseNodeMap();
+    void buildBVH();
+
+    size_t vertexCount() const { return px.size(); }
+    size_t triangleCount() const { return indices.size() / 3; }
+    Vec position(uint32_t v) const { return Vec(px[v], py[v], pz[v]); }
+    uint32_t corner(uint32_t t, int k) const { return indices[3 * t + k]; }
 
+    // Triangles using vertex v, valid after buildAdjacency()
+    const uint32_t *trisBegin(uint32_t v) const { return adjTris.data() + adjStart[v]; }
+    const uint32_t *trisEnd(uint32_t v) const { return adjTris.data() + adjStart[v + 1]; }
+    uint32_t trisCount(uint32_t v) const { return adjStart[v + 1] - adjStart[v]; }
 
     // CSG FUNCTIONS
     void unionPolygons(Polygon &other, Polygon &polygon);
@@ -85,18 +83,34 @@ public:
     bool isCloseToEdge(const Vec &point, double eps);
     void boundingPoints(Vec &minp, Vec &maxp);
     bool withinBounds(const Vec &bmin, const Vec &bmax, const Vec &p);
-    bool withinBounds(const Vec &bmin, const Vec &bmax, const Tri &t);
-    bool intersectPlane(const Tri &t, Vec o, Vec dir, Vec &p);
+    bool withinBounds(const Vec &bmin, const Vec &bmax, uint32_t t);
+    bool intersectPlane(uint32_t t, Vec o, Vec dir, Vec &p);
 
     // HELPER FUNCTIONS
-    int sharedNodes(const Tri &t1, const Tri &t2);
-    void findTwoCommon(const Tri &t1, const Tri &t2, shared_ptr<Node> &ncom1, shared_ptr<Node> &ncom2,
-                       shared_ptr<Node> &nsep1, shared_ptr<Node> &nsep2);
-    bool consolidateTriangle(shared_ptr<Tri> t1, shared_ptr<Tri> t2, shared_ptr<Node> centerNode, double eps);
-    bool isNormalConsistent(const shared_ptr<Tri> &t1, const shared_ptr<Tri> &t2);
-
-    unordered_map<Vec, shared_ptr<Node>, vec_hash> nodeMap;
-    vector<shared_ptr<Tri>> *triangles;
+    int sharedNodes(uint32_t t1, uint32_t t2);
+    void findTwoCommon(uint32_t t1, uint32_t t2, uint32_t &ncom1, uint32_t &ncom2,
+                       uint32_t &nsep1, uint32_t &nsep2);
+    bool isNormalConsistent(uint32_t t1, uint32_t t2);
+
+    static const uint32_t NONE = UINT32_MAX;
+
+    // Vertices
+    vector<double> px, py, pz;
+    // Position to vertex index, only kept while nodes are being added,
+    // see releaseNodeMap()
+    unordered_map<Vec, uint32_t, vec_hash> nodeMap;
+
+    // Triangles
+    vector<uint32_t> indices; // Three vertex indices per triangle
+    vector<Vec> normals; // One normal per triangle
+    vector<uint8_t> removed; // Set by removeTriangle() until compact()
+    size_t n_removed = 0;
+
+    // Vertex to triangle adjacency (CSR)
+    vector<uint32_t> adjStart;
+    vector<uint32_t> adjTris;
+
+    BVH bvh; // Built by buildBVH(), stale after the triangles change
 
     Vec minc;
     Vec maxc;
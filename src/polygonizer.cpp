@@ -4,6 +4,9 @@
 
 #include "polygonizer.h"
 
+#define DECIMATE_ERROR 0.1 // Max surface deviation of a collapse, relative to resolution
+#define DECIMATE_FACTOR 0.95 // Max fraction of triangles removed
+
 //---------------------------------------------------------------------------
 Polygonizer::Polygonizer(bar_data *barModel, double resolution, double barDiameter, int threads) {
 //---------------------------------------------------------------------------
@@ -246,21 +249,24 @@ void Polygonizer::calculatePolygon() {
     std::cout << "\nMARCHING CUBES COMPLETED" << std::endl;
 
     for (const Segment &s : segments) {
-        triangleCount += s.polygon->triangles->size();
-        nodeCount += s.polygon->nodeMap.size();
+        triangleCount += s.polygon->triangleCount();
+        nodeCount += s.polygon->vertexCount();
     }
 
-    this->geometry.triangles = new vector<shared_ptr<Tri>>();
+    this->geometry.clearPolygon();
+    this->geometry.nodeMap.reserve(nodeCount);
     for (const Segment &s : segments) {
         this->geometry.mergePolygons(*s.polygon);
+        s.polygon->clearPolygon();
     }
+    this->geometry.releaseNodeMap();
 
-    qDebug() << "Polygon size" << this->geometry.triangles->size() << "tris" << this->geometry.nodeMap.size() << "nodes";
-    std::cout << "Mesh size " << this->geometry.triangles->size() << " tris, " << this->geometry.nodeMap.size() << " nodes\n";
+    qDebug() << "Polygon size" << this->geometry.triangleCount() << "tris" << this->geometry.vertexCount() << "nodes";
+    std::cout << "Mesh size " << this->geometry.triangleCount() << " tris, " << this->geometry.vertexCount() << " nodes\n";
 
     // Reduce mesh
-    //this->geometry.reduceMesh(1E-2, 0.5);
-    qDebug() << "Reduced Polygon size" << this->geometry.triangles->size() << "tris" << this->geometry.nodeMap.size() << "nodes";
+    this->geometry.reduceMesh(DECIMATE_ERROR * resolution, DECIMATE_FACTOR);
+    qDebug() << "Reduced Polygon size" << this->geometry.triangleCount() << "tris" << this->geometry.vertexCount() << "nodes";
 
 }
 
@@ -666,20 +672,25 @@ double Polygonizer::pointDistFromSurface(Polygon &surface, Vec qp) {
 
     double minDist = FLT_MAX;
 
-    for (auto n : surface.nodeMap) {
-        double d = (qp - n.first).norm();
+    for (uint32_t v = 0; v < surface.vertexCount(); v++) {
+        double d = (qp - surface.position(v)).norm();
         if (d < minDist) {
             minDist = d;
         }
     }
 
-    for (auto t : *surface.triangles) {
-        minDist = std::min(minDist, Utils::distPointLine(qp, t->v1->p, t->v2->p));
-        minDist = std::min(minDist, Utils::distPointLine(qp, t->v2->p, t->v3->p));
-        minDist = std::min(minDist, Utils::distPointLine(qp, t->v3->p, t->v1->p));
+    for (uint32_t t = 0; t < surface.triangleCount(); t++) {
+        if (surface.removed[t]) continue;
+
+        Vec p1 = surface.position(surface.corner(t, 0));
+        Vec p2 = surface.position(surface.corner(t, 1));
+        Vec p3 = surface.position(surface.corner(t, 2));
+        minDist = std::min(minDist, Utils::distPointLine(qp, p1, p2));
+        minDist = std::min(minDist, Utils::distPointLine(qp, p2, p3));
+        minDist = std::min(minDist, Utils::distPointLine(qp, p3, p1));
 
-        Vec ax = t->v1->p - qp;
-        Vec n = cross((t->v2->p - t->v1->p), (t->v3->p - t->v1->p)).normalized();
+        Vec ax = p1 - qp;
+        Vec n = cross((p2 - p1), (p3 - p1)).normalized();
         double d = fabs(dot(ax, n));
         minDist = std::min(minDist, d);
 
@@ -845,7 +856,7 @@ bool Polygonizer::writePolygonToSTL(string path){
     Vec n, p1, p2, p3;
 
     qDebug() << "Writing to Binary STL";
-    if (this->geometry.triangles->empty()) {
+    if (this->geometry.triangleCount() == 0) {
         return false;
     }
 
@@ -861,45 +872,35 @@ bool Polygonizer::writePolygonToSTL(string path){
     Utils::STLFACET facet = Utils::STLFACET();
 
     strcpy(header.description, "STL Generator / Creative Machines Lab (2019)");
-    header.nfacets = int(this->geometry.triangles->size());
+    header.nfacets = int(this->geometry.triangleCount());
     file.write((char*)&header, sizeof(header));
 
     facet.pad = 0;
 
     qDebug() << "Wrote header description" << header.nfacets << sizeof(header.description) << sizeof(header.nfacets);
 
-    for (auto & i : *this->geometry.triangles) {
-
-        /**qDebug() << "Attempting to write" << &i << (i == nullptr);
-        qDebug() << "Attempting to write n" << i->n[0];
-        qDebug() << "Attempting to write v1" << i->v1->p[0] << i->v1->p[1] << i->v1->p[2];
-        qDebug() << "Attempting to write v2" << i->v2->p[0] << i->v2->p[1] << i->v2->p[2];
-        qDebug() << "Attempting to write v3" << i->v3->p[0] << i->v3->p[1] << i->v3->p[2];**/
-
-        if (i != nullptr) {
-            Tri triangle = *i;
-
-            n = triangle.n;
-            // Convert to millimeters
-            p1 = triangle.v1->p * 1000;
-            p2 = triangle.v2->p * 1000;
-            p3 = triangle.v3->p * 1000;
-
-            facet.x1 = float(p1[0]);
-            facet.y1 = float(p1[1]);
-            facet.z1 = float(p1[2]);
-            facet.x2 = float(p2[0]);
-            facet.y2 = float(p2[1]);
-            facet.z2 = float(p2[2]);
-            facet.x3 = float(p3[0]);
-            facet.y3 = float(p3[1]);
-            facet.z3 = float(p3[2]);
-            facet.nx = float(n[0]);
-            facet.ny = float(n[1]);
-            facet.nz = float(n[2]);
-
-            file.write((char *) &facet, 50);
-        }
+    for (uint32_t t = 0; t < this->geometry.triangleCount(); t++) {
+
+        n = this->geometry.normals[t];
+        // Convert to millimeters
+        p1 = this->geometry.position(this->geometry.corner(t, 0)) * 1000;
+        p2 = this->geometry.position(this->geometry.corner(t, 1)) * 1000;
+        p3 = this->geometry.position(this->geometry.corner(t, 2)) * 1000;
+
+        facet.x1 = float(p1[0]);
+        facet.y1 = float(p1[1]);
+        facet.z1 = float(p1[2]);
+        facet.x2 = float(p2[0]);
+        facet.y2 = float(p2[1]);
+        facet.z2 = float(p2[2]);
+        facet.x3 = float(p3[0]);
+        facet.y3 = float(p3[1]);
+        facet.z3 = float(p3[2]);
+        facet.nx = float(n[0]);
+        facet.ny = float(n[1]);
+        facet.nz = float(n[2]);
+
+        file.write((char *) &facet, 50);
 
     }
 
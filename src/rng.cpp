@@ -0,0 +1,121 @@
+//
+// Seeded random number streams.
+//
+
+#include "rng.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Stream ids of threads outside OpenMP regions start here,
+// above any OpenMP thread number
+#define SERIAL_STREAMS (uint64_t(1) << 32)
+
+static std::atomic<uint64_t> globalSeed(Rng::randomSeed());
+static std::atomic<uint64_t> generation(1); // Bumped by every seed(), thread streams compare on use
+static std::atomic<uint64_t> serialStreams(SERIAL_STREAMS);
+static std::thread::id seedingThread = std::this_thread::get_id();
+
+// ------------------------------------------------------------
+static uint64_t splitmix64(uint64_t &x) {
+// ------------------------------------------------------------
+    uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// ------------------------------------------------------------
+Rng::Rng(uint64_t seed) {
+// ------------------------------------------------------------
+    for (int k = 0; k < 4; k++) {
+        s[k] = splitmix64(seed);
+    }
+}
+
+// ------------------------------------------------------------
+void Rng::seed(uint64_t seed) {
+// ------------------------------------------------------------
+    globalSeed = seed;
+    seedingThread = std::this_thread::get_id();
+    serialStreams = SERIAL_STREAMS;
+    generation++;
+}
+
+// ------------------------------------------------------------
+uint64_t Rng::randomSeed() {
+// ------------------------------------------------------------
+    std::random_device rd;
+    return (uint64_t(rd()) << 32) ^ uint64_t(rd());
+}
+
+// ------------------------------------------------------------
+uint64_t Rng::currentSeed() {
+// ------------------------------------------------------------
+    return globalSeed;
+}
+
+// ------------------------------------------------------------
+Rng Rng::stream(uint64_t id) {
+// ------------------------------------------------------------
+    uint64_t key = globalSeed.load();
+    key ^= splitmix64(id);
+    return Rng(key);
+}
+
+// The seeding thread is stream 0 both alone and as OpenMP master,
+// so serial draws replay the same whether or not they run in a region
+// ------------------------------------------------------------
+Rng &Rng::local() {
+// ------------------------------------------------------------
+    thread_local Rng rng = Rng();
+    thread_local uint64_t seen = 0;
+
+    uint64_t current = generation;
+    if (seen != current) {
+        uint64_t id = 0;
+        bool parallel = false;
+#ifdef _OPENMP
+        parallel = omp_in_parallel();
+        if (parallel) id = uint64_t(omp_get_thread_num());
+#endif
+        if (!parallel && std::this_thread::get_id() != seedingThread) id = serialStreams++;
+        rng = stream(id);
+        seen = current;
+    }
+    return rng;
+}
+
+// ------------------------------------------------------------
+void Rng::fillUnit(float *out, size_t n) {
+// ------------------------------------------------------------
+    size_t i = 0;
+    for (; i + 1 < n; i += 2) {
+        uint64_t r = next();
+        out[i] = float(r >> 40) * (1.0f / 16777216.0f);
+        out[i + 1] = float((r >> 8) & 0xFFFFFF) * (1.0f / 16777216.0f);
+    }
+    if (i < n) out[i] = unit();
+}
+
+// ------------------------------------------------------------
+void Rng::fillUniform(float *out, size_t n, float min, float max) {
+// ------------------------------------------------------------
+    fillUnit(out, n);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = min + (max - min) * out[i];
+    }
+}
+
+// ------------------------------------------------------------
+void Rng::fillUniform(double *out, size_t n, double min, double max) {
+// ------------------------------------------------------------
+    for (size_t i = 0; i < n; i++) {
+        out[i] = uniform(min, max);
+    }
+}
@@ -0,0 +1,80 @@
+//
+// Seeded random number streams.
+// Every thread draws from its own xoshiro256** generator derived from one
+// global seed, so OpenMP loops never share state and runs can be replayed.
+//
+
+#ifndef DMLIDE_RNG_H
+#define DMLIDE_RNG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+class Rng {
+
+public:
+    typedef uint64_t result_type;
+
+    // Blackman and Vigna "Scrambled Linear Pseudorandom Number Generators" (2021),
+    // the state is filled from seed with splitmix64
+    explicit Rng(uint64_t seed = 0);
+
+    // Reseeds every thread stream, later calls to local() restart from seed
+    static void seed(uint64_t seed);
+    // Seed from std::random_device, used when no seed is given
+    static uint64_t randomSeed();
+    static uint64_t currentSeed();
+
+    // Generator of the calling thread. OpenMP threads use their thread number as
+    // stream, other threads get streams in order of first use
+    static Rng &local();
+    // Independent generator for a fixed stream, for results that must not depend
+    // on how loop iterations are scheduled over threads
+    static Rng stream(uint64_t id);
+
+    uint64_t next() {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, 1) from the high bits
+    float unit() { return float(next() >> 40) * (1.0f / 16777216.0f); }
+    double unitDouble() { return double(next() >> 11) * (1.0 / 9007199254740992.0); }
+    float uniform(float min, float max) { return min + (max - min) * unit(); }
+    double uniform(double min, double max) { return min + (max - min) * unitDouble(); }
+
+    // Bulk draws, two floats per step of the generator
+    void fillUnit(float *out, size_t n);
+    void fillUniform(float *out, size_t n, float min, float max);
+    void fillUniform(double *out, size_t n, double min, double max);
+
+    // Points uniform in the box [lo, hi], for any type with operator[] per axis
+    template <typename Point>
+    void fillPoints(const Point &lo, const Point &hi, Point *out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            for (int a = 0; a < 3; a++) {
+                out[i][a] = lo[a] + (hi[a] - lo[a]) * unitDouble();
+            }
+        }
+    }
+
+    // UniformRandomBitGenerator, so std distributions can draw from Rng
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+    result_type operator()() { return next(); }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    uint64_t s[4];
+};
+
+#endif //DMLIDE_RNG_H
@@ -0,0 +1,370 @@
+//
+// Point samplers for space filled lattices.
+//
+
+#include "sampler.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "cpuFeatures.h"
+
+// Edge of the stratification voxels in units of cutoff
+#define STRATUM_SIZE 0.5f
+
+// Voxel count limit for stratified sampling, coarser voxels beyond it
+#define MAX_STRATA (1 << 22)
+
+// Points tested per boundary voxel to estimate its valid volume
+#define BOUNDARY_PROBES 8
+
+// Redraw rounds for boundary voxels before falling back to a probe
+#define MAX_REDRAWS 32
+
+// ------------------------------------------------------------
+LatticeSampler::LatticeSampler(const glm::vec3 &bmin, const glm::vec3 &bmax, float cutoff)
+        : origin(bmin), extent(bmax - bmin), cutoff(cutoff), cellSize(cutoff / std::sqrt(3.0f)),
+          gen(Rng::local().next()) {
+// ------------------------------------------------------------
+    nx = std::max(1, int(std::ceil(extent.x / cellSize)));
+    ny = std::max(1, int(std::ceil(extent.y / cellSize)));
+    nz = std::max(1, int(std::ceil(extent.z / cellSize)));
+}
+
+// Grid cell holding p, false outside the sampled box
+// ------------------------------------------------------------
+bool LatticeSampler::cellOf(const glm::vec3 &p, int &ix, int &iy, int &iz) const {
+// ------------------------------------------------------------
+    glm::vec3 g = (p - origin) / cellSize;
+    if (!(g.x >= 0 && g.y >= 0 && g.z >= 0)) return false;
+    ix = int(g.x);
+    iy = int(g.y);
+    iz = int(g.z);
+    return ix < nx && iy < ny && iz < nz;
+}
+
+// True if no sample lies closer than cutoff to p
+// Cells are cutoff / sqrt(3) wide, so two cells in each direction suffice
+// ------------------------------------------------------------
+bool LatticeSampler::isFarFromSamples(const glm::vec3 &p) const {
+// ------------------------------------------------------------
+    int ix, iy, iz;
+    if (!cellOf(p, ix, iy, iz)) return false;
+
+    float cutoff2 = cutoff * cutoff;
+    for (int z = std::max(iz - 2, 0); z <= std::min(iz + 2, nz - 1); z++) {
+        for (int y = std::max(iy - 2, 0); y <= std::min(iy + 2, ny - 1); y++) {
+            for (int x = std::max(ix - 2, 0); x <= std::min(ix + 2, nx - 1); x++) {
+                int32_t s = cells[(size_t(z) * ny + y) * nx + x];
+                if (s < 0) continue;
+                glm::vec3 d = samples[s] - p;
+                if (glm::dot(d, d) < cutoff2) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// ------------------------------------------------------------
+void LatticeSampler::addSample(const glm::vec3 &p) {
+// ------------------------------------------------------------
+    int ix, iy, iz;
+    cellOf(p, ix, iy, iz);
+    cells[(size_t(iz) * ny + iy) * nx + ix] = int32_t(samples.size());
+    samples.push_back(p);
+}
+
+// Uniform point in the spherical shell [cutoff, 2 cutoff] around center
+// ------------------------------------------------------------
+glm::vec3 LatticeSampler::annulusPoint(const glm::vec3 &center) {
+// ------------------------------------------------------------
+    float r = cutoff * std::cbrt(1.0f + 7.0f * gen.unit());
+    float z = 2.0f * gen.unit() - 1.0f;
+    float phi = 2.0f * float(M_PI) * gen.unit();
+    float rxy = std::sqrt(std::max(0.0f, 1.0f - z * z));
+
+    return center + r * glm::vec3(rxy * std::cos(phi), rxy * std::sin(phi), z);
+}
+
+// ------------------------------------------------------------
+void LatticeSampler::poissonDisk(const std::vector<glm::vec3> &seeds, const Predicate &inside,
+                                 std::vector<glm::vec3> &points) {
+// ------------------------------------------------------------
+    if (cells.empty()) {
+        cells = std::vector<int32_t>(size_t(nx) * ny * nz, -1);
+    }
+
+    std::vector<int32_t> active = std::vector<int32_t>();
+    size_t first = samples.size();
+
+    // Every seed far from the samples so far starts a new front,
+    // this reaches parts of the volume not connected to the first seed
+    for (const glm::vec3 &seed : seeds) {
+        if (!isFarFromSamples(seed) || !inside(seed)) continue;
+        active.push_back(int32_t(samples.size()));
+        addSample(seed);
+
+        while (!active.empty()) {
+            size_t a = std::uniform_int_distribution<size_t>(0, active.size() - 1)(gen);
+            glm::vec3 center = samples[active[a]];
+
+            bool found = false;
+            for (int k = 0; k < ATTEMPTS && !found; k++) {
+                glm::vec3 candidate = annulusPoint(center);
+                if (isFarFromSamples(candidate) && inside(candidate)) {
+                    active.push_back(int32_t(samples.size()));
+                    addSample(candidate);
+                    found = true;
+                }
+            }
+
+            if (!found) {
+                active[a] = active.back();
+                active.pop_back();
+            }
+        }
+    }
+
+    points.insert(points.end(), samples.begin() + first, samples.end());
+}
+
+// ------------------------------------------------------------
+void LatticeSampler::stratified(size_t n, const VoxelClassifier &classify, const BatchPredicate &valid,
+                                std::vector<glm::vec3> &points) {
+// ------------------------------------------------------------
+    if (n == 0) return;
+
+    float h = cutoff * STRATUM_SIZE;
+    int sx, sy, sz;
+    while (true) {
+        sx = std::max(1, int(std::ceil(extent.x / h)));
+        sy = std::max(1, int(std::ceil(extent.y / h)));
+        sz = std::max(1, int(std::ceil(extent.z / h)));
+        if (size_t(sx) * sy * sz <= MAX_STRATA) break;
+        h *= 1.25f;
+    }
+
+    auto corner = [&](uint32_t v) {
+        uint32_t i = v % uint32_t(sx), j = (v / uint32_t(sx)) % uint32_t(sy), k = v / (uint32_t(sx) * sy);
+        return origin + glm::vec3(i, j, k) * h;
+    };
+    auto jitter = [&](uint32_t v) {
+        return corner(v) + glm::vec3(gen.unit(), gen.unit(), gen.unit()) * h;
+    };
+
+    // Voxel states from their centers
+    size_t nv = size_t(sx) * sy * sz;
+    std::vector<glm::vec3> centers = std::vector<glm::vec3>(nv);
+    for (uint32_t v = 0; v < nv; v++) {
+        centers[v] = corner(v) + glm::vec3(0.5f * h);
+    }
+    std::vector<uint8_t> states = std::vector<uint8_t>();
+    classify(centers, 0.5f * std::sqrt(3.0f) * h, states);
+    std::vector<glm::vec3>().swap(centers);
+
+    // Boundary voxels are weighted by the share of probes that are valid,
+    // the first valid probe is kept as a fallback sample
+    std::vector<uint32_t> strata = std::vector<uint32_t>();
+    std::vector<double> cdf = std::vector<double>();
+    std::vector<glm::vec3> fallback = std::vector<glm::vec3>(); // Per stratum, unused for interior voxels
+    std::vector<uint32_t> boundary = std::vector<uint32_t>();
+    std::vector<glm::vec3> probes = std::vector<glm::vec3>();
+    std::vector<uint8_t> accepted = std::vector<uint8_t>();
+
+    for (uint32_t v = 0; v < nv; v++) {
+        if (states[v] == OccupancyGrid::BOUNDARY) {
+            boundary.push_back(v);
+            for (int p = 0; p < BOUNDARY_PROBES; p++) probes.push_back(jitter(v));
+        }
+    }
+    if (!probes.empty()) valid(probes, accepted);
+
+    double total = 0;
+    size_t b = 0;
+    for (uint32_t v = 0; v < nv; v++) {
+        double weight = 0;
+        glm::vec3 probe = glm::vec3(0);
+        if (states[v] == OccupancyGrid::INSIDE) {
+            weight = 1;
+        } else if (states[v] == OccupancyGrid::BOUNDARY) {
+            for (int p = BOUNDARY_PROBES - 1; p >= 0; p--) {
+                if (!accepted[b * BOUNDARY_PROBES + p]) continue;
+                weight += 1.0 / BOUNDARY_PROBES;
+                probe = probes[b * BOUNDARY_PROBES + p];
+            }
+            b++;
+        }
+        if (weight <= 0) continue;
+
+        total += weight;
+        strata.push_back(v);
+        cdf.push_back(total);
+        fallback.push_back(probe);
+    }
+    if (strata.empty()) return;
+
+    // Voxel for every point by weight, interior ones are done right away
+    size_t start = points.size();
+    points.resize(start + n);
+    std::vector<size_t> pending = std::vector<size_t>(); // Points still to place in boundary voxels
+    std::vector<uint32_t> pendingStrata = std::vector<uint32_t>();
+
+    for (size_t i = 0; i < n; i++) {
+        size_t s = std::upper_bound(cdf.begin(), cdf.end(), gen.uniform(0.0, total)) - cdf.begin();
+        s = std::min(s, strata.size() - 1);
+        uint32_t v = strata[s];
+        if (states[v] == OccupancyGrid::INSIDE) {
+            points[start + i] = jitter(v);
+        } else {
+            pending.push_back(start + i);
+            pendingStrata.push_back(uint32_t(s));
+        }
+    }
+
+    // Boundary draws are redrawn inside their own voxel until valid
+    for (int round = 0; round < MAX_REDRAWS && !pending.empty(); round++) {
+        probes.resize(pending.size());
+        for (size_t i = 0; i < pending.size(); i++) {
+            probes[i] = jitter(strata[pendingStrata[i]]);
+        }
+        valid(probes, accepted);
+
+        size_t kept = 0;
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (accepted[i]) {
+                points[pending[i]] = probes[i];
+            } else {
+                pending[kept] = pending[i];
+                pendingStrata[kept] = pendingStrata[i];
+                kept++;
+            }
+        }
+        pending.resize(kept);
+        pendingStrata.resize(kept);
+    }
+
+    for (size_t i = 0; i < pending.size(); i++) {
+        points[pending[i]] = fallback[pendingStrata[i]];
+    }
+}
+
+#ifdef DMLIDE_AVX2
+// Eight candidates at a time of the distance pass in farthestPoint, with the
+// same results as its scalar loop. Returns where the scalar tail starts
+// ------------------------------------------------------------
+AVX2_TARGET
+static size_t addDistancesAvx2(const glm::vec3 &last, float cutoff, size_t n,
+                               const float *cx, const float *cy, const float *cz,
+                               float *sums, float *minDists, std::vector<size_t> &rejected, float &best) {
+// ------------------------------------------------------------
+    size_t i = 0;
+    const __m256 lx = _mm256_set1_ps(last.x), ly = _mm256_set1_ps(last.y), lz = _mm256_set1_ps(last.z);
+    const __m256 cut = _mm256_set1_ps(cutoff);
+    __m256 bestv = _mm256_set1_ps(-FLT_MAX);
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&cx[i]), lx);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&cy[i]), ly);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(&cz[i]), lz);
+
+        // Same operation order as glm::length, no contraction
+        __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+        __m256 d = _mm256_sqrt_ps(d2);
+        __m256 near = _mm256_cmp_ps(d, cut, _CMP_LT_OQ);
+
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(&sums[i]), _mm256_andnot_ps(near, d));
+        _mm256_storeu_ps(&sums[i], sum);
+        _mm256_storeu_ps(&minDists[i], _mm256_min_ps(_mm256_loadu_ps(&minDists[i]), d));
+        bestv = _mm256_max_ps(bestv, _mm256_blendv_ps(sum, _mm256_set1_ps(-FLT_MAX), near));
+
+        int mask = _mm256_movemask_ps(near);
+        for (int k = 0; mask != 0; k++, mask >>= 1) {
+            if (mask & 1) rejected.push_back(i + k);
+        }
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, bestv);
+    for (float lane : lanes) best = std::max(best, lane);
+    return i;
+}
+#endif
+
+// ------------------------------------------------------------
+void LatticeSampler::farthestPoint(const glm::vec3 &first, const std::vector<glm::vec3> &candidates,
+                                   std::vector<glm::vec3> &points) {
+// ------------------------------------------------------------
+
+    // Live candidates SoA, removed by swap and pop. Each keeps its running
+    // distance sum and its distance to the nearest point, accumulated in
+    // lattice order so the floats match the original scan exactly.
+    size_t n = candidates.size();
+    std::vector<float> cx(n), cy(n), cz(n);
+    std::vector<float> sums(n, 0.0f), minDists(n, FLT_MAX);
+    std::vector<uint32_t> ids(n);
+    std::vector<size_t> rejected = std::vector<size_t>(); // Positions to remove, ascending
+    for (size_t i = 0; i < n; i++) {
+        cx[i] = candidates[i].x;
+        cy[i] = candidates[i].y;
+        cz[i] = candidates[i].z;
+        ids[i] = uint32_t(i);
+    }
+
+    auto removeAt = [&](size_t i) {
+        n--;
+        cx[i] = cx[n]; cy[i] = cy[n]; cz[i] = cz[n];
+        sums[i] = sums[n]; minDists[i] = minDists[n];
+        ids[i] = ids[n];
+    };
+
+    points.push_back(first);
+    glm::vec3 last = first;
+    float maxLength = cutoff;
+
+    while (maxLength >= cutoff && n > 0) {
+
+        // Adds the distance to the newest point to every candidate,
+        // flags those within cutoff and finds the largest remaining sum
+        float best = -FLT_MAX;
+        rejected.clear();
+
+        size_t i = 0;
+#ifdef DMLIDE_AVX2
+        if (CpuFeatures::avx2()) {
+            i = addDistancesAvx2(last, cutoff, n, cx.data(), cy.data(), cz.data(),
+                                 sums.data(), minDists.data(), rejected, best);
+        }
+#endif
+        for (; i < n; i++) {
+            float d = glm::length(glm::vec3(cx[i], cy[i], cz[i]) - last);
+            if (d < cutoff) {
+                rejected.push_back(i);
+                continue;
+            }
+            sums[i] += d;
+            minDists[i] = std::min(minDists[i], d);
+            best = std::max(best, sums[i]);
+        }
+
+        // Ties go to the lowest original index, as in the ordered scan
+        size_t bestPos = n;
+        for (size_t i = 0; i < n; i++) {
+            if (sums[i] != best || (bestPos != n && ids[i] > ids[bestPos])) continue;
+            if (!std::binary_search(rejected.begin(), rejected.end(), i)) bestPos = i;
+        }
+        if (bestPos == n) break;
+
+        // Smallest distance from the chosen point to the lattice, ends
+        // the fill once points can no longer be placed cutoff apart
+        maxLength = std::min(sums[bestPos], minDists[bestPos]);
+        last = glm::vec3(cx[bestPos], cy[bestPos], cz[bestPos]);
+        points.push_back(last);
+        rejected.insert(std::lower_bound(rejected.begin(), rejected.end(), bestPos), bestPos);
+
+        // From the back, so every element swapped in is a live one
+        for (auto r = rejected.rbegin(); r != rejected.rend(); ++r) {
+            removeAt(*r);
+        }
+    }
+}
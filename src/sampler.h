@@ -0,0 +1,74 @@
+//
+// Point samplers for space filled lattices.
+// Points are kept in a uniform background grid so spacing checks
+// only look at nearby cells.
+//
+
+#ifndef DMLIDE_SAMPLER_H
+#define DMLIDE_SAMPLER_H
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "occupancy.h"
+#include "rng.h"
+
+class LatticeSampler {
+
+public:
+    typedef std::function<bool(const glm::vec3 &)> Predicate;
+    typedef std::function<void(const std::vector<glm::vec3> &, std::vector<uint8_t> &)> BatchPredicate;
+    typedef std::function<void(const std::vector<glm::vec3> &, float, std::vector<uint8_t> &)> VoxelClassifier;
+
+    // Samples inside [bmin, bmax] with minimum spacing cutoff
+    LatticeSampler(const glm::vec3 &bmin, const glm::vec3 &bmax, float cutoff);
+
+    // Bridson "Fast Poisson Disk Sampling in Arbitrary Dimensions" (2007)
+    // Grows a front from every seed farther than cutoff from the points so far,
+    // accepting candidates in [cutoff, 2 cutoff] around active points that
+    // satisfy inside. Appends the samples to points.
+    void poissonDisk(const std::vector<glm::vec3> &seeds, const Predicate &inside,
+                     std::vector<glm::vec3> &points);
+
+    // Appends n points drawn uniformly from the part of the box accepted by valid.
+    // The box is cut into voxels that classify labels, from their centers and
+    // circumradius, as OccupancyGrid::INSIDE (entirely valid), OUTSIDE or BOUNDARY.
+    // Interior voxels are sampled with jitter and no tests. Boundary voxels are
+    // weighted by a probed valid fraction, only their draws are tested with valid.
+    // Returns fewer than n points only when no valid region was found.
+    void stratified(size_t n, const VoxelClassifier &classify, const BatchPredicate &valid,
+                    std::vector<glm::vec3> &points);
+
+    // Farthest point sampling as in Loader::createSpaceLattice: starting from
+    // first, repeatedly appends the candidate with the largest sum of distances
+    // to the points so far, dropping candidates closer than cutoff to any point.
+    // Ties go to the lowest candidate index, so the output matches the original
+    // generator bit for bit. Appends first and the chosen candidates to points.
+    void farthestPoint(const glm::vec3 &first, const std::vector<glm::vec3> &candidates,
+                       std::vector<glm::vec3> &points);
+
+    // Candidates tried around an active point before it is retired
+    static const int ATTEMPTS = 30;
+
+private:
+    bool cellOf(const glm::vec3 &p, int &ix, int &iy, int &iz) const;
+    bool isFarFromSamples(const glm::vec3 &p) const;
+    void addSample(const glm::vec3 &p);
+    glm::vec3 annulusPoint(const glm::vec3 &center);
+
+    glm::vec3 origin;
+    glm::vec3 extent;
+    float cutoff;
+    float cellSize; // cutoff / sqrt(3), at most one sample per cell
+    int nx, ny, nz;
+
+    std::vector<int32_t> cells; // Sample index per cell, -1 when empty, allocated by poissonDisk()
+    std::vector<glm::vec3> samples;
+    Rng gen; // Seeded from the calling thread's stream
+};
+
+#endif //DMLIDE_SAMPLER_H
@@ -0,0 +1,120 @@
+//
+// Stepping backends for a Titan simulation.
+//
+
+#include "simBackend.h"
+#include "cpuBackend.h"
+
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+
+static SimBackend::Kind selectedKind = SimBackend::TITAN;
+static std::map<Simulation *, std::unique_ptr<SimBackend>> backends;
+static std::mutex backendsMutex;
+
+// ------------------------------------------------------------
+SimBackend *SimBackend::of(Simulation *sim) {
+// ------------------------------------------------------------
+    std::lock_guard<std::mutex> lock(backendsMutex);
+    std::unique_ptr<SimBackend> &backend = backends[sim];
+    if (backend == nullptr) {
+        if (selectedKind == CPU) {
+            backend.reset(new CpuBackend(sim));
+        } else {
+            backend.reset(new TitanBackend(sim));
+        }
+    }
+    return backend.get();
+}
+
+// ------------------------------------------------------------
+void SimBackend::release(Simulation *sim) {
+// ------------------------------------------------------------
+    std::lock_guard<std::mutex> lock(backendsMutex);
+    backends.erase(sim);
+}
+
+// ------------------------------------------------------------
+void SimBackend::select(Kind kind) {
+// ------------------------------------------------------------
+    selectedKind = kind;
+}
+
+// ------------------------------------------------------------
+SimBackend::Kind SimBackend::selected() {
+// ------------------------------------------------------------
+    return selectedKind;
+}
+
+// ------------------------------------------------------------
+bool SimBackend::kindFromName(const std::string &name, Kind &kind) {
+// ------------------------------------------------------------
+    if (name == "titan" || name == "cuda" || name == "gpu") {
+        kind = TITAN;
+    } else if (name == "cpu") {
+        kind = CPU;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------
+void SimBackend::reduceMetrics(const std::vector<Mass *> &deflectionMasses, StepMetrics &metrics) {
+// ------------------------------------------------------------
+    metrics = StepMetrics();
+    long ns = long(sim->springs.size());
+    long nm = long(sim->masses.size());
+    double totalLength = 0, totalEnergy = 0, kineticEnergy = 0, deflection = 0;
+
+    #pragma omp parallel reduction(+:totalLength, totalEnergy, kineticEnergy, deflection)
+    {
+        double maxForce = 0;
+        long maxForceSpring = -1;
+
+        #pragma omp for schedule(static) nowait
+        for (long i = 0; i < ns; i++) {
+            Spring *s = sim->springs[i];
+            if (s == nullptr || s->_k == 0) continue;
+            totalLength += s->_rest;
+            totalEnergy += s->_curr_force * s->_curr_force / s->_k;
+            if (maxForce < fabs(s->_curr_force)) {
+                maxForce = fabs(s->_curr_force);
+                maxForceSpring = i;
+            }
+        }
+
+        #pragma omp for schedule(static) nowait
+        for (long i = 0; i < nm; i++) {
+            Mass *m = sim->masses[i];
+            kineticEnergy += 0.5 * m->m * m->vel.norm() * m->vel.norm();
+            if (deflectionMasses.empty()) {
+                Mass *refMass = sim->masses.front();
+                double origDist = (m->origpos - refMass->origpos).norm();
+                double newDist = (m->pos - refMass->pos).norm();
+                deflection += fabs(newDist - origDist);
+            }
+        }
+
+        #pragma omp critical
+        if (maxForceSpring >= 0 && (metrics.maxForce < maxForce
+                || (metrics.maxForce == maxForce && maxForceSpring < metrics.maxForceSpring))) {
+            metrics.maxForce = maxForce;
+            metrics.maxForceSpring = maxForceSpring;
+        }
+    }
+
+    if (!deflectionMasses.empty()) {
+        for (Mass *m : deflectionMasses) {
+            deflection += (m->origpos - m->pos).norm();
+        }
+        deflection /= deflectionMasses.size();
+    }
+
+    metrics.totalLength = totalLength;
+    metrics.totalEnergy = totalEnergy;
+    metrics.kineticEnergy = kineticEnergy;
+    metrics.deflection = deflection;
+}
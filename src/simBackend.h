@@ -0,0 +1,91 @@
+//
+// Stepping backends for a Titan simulation.
+// The simulator and optimizers step and synchronize through SimBackend,
+// so the same Simulation runs on a CUDA device or on the host.
+//
+
+#ifndef DMLIDE_SIMBACKEND_H
+#define DMLIDE_SIMBACKEND_H
+
+#include <string>
+#include <vector>
+
+#include <Titan/sim.h>
+
+// Per step bookkeeping of the simulator, reduced in one pass over the state
+struct StepMetrics {
+    double totalLength = 0;    // Rest length of springs with k != 0
+    double totalEnergy = 0;    // Strain energy, f^2 / k over springs with k != 0
+    double maxForce = 0;       // Largest |f| over springs with k != 0
+    long maxForceSpring = -1;  // Index in sim->springs, -1 without springs
+    double kineticEnergy = 0;
+    double deflection = 0;     // See SimBackend::reduceMetrics
+};
+
+class SimBackend {
+
+public:
+    enum Kind {
+        TITAN, // Titan's CUDA kernels
+        CPU    // CpuBackend, host arrays with OpenMP
+    };
+
+    explicit SimBackend(Simulation *sim) : sim(sim) {}
+    virtual ~SimBackend() = default;
+
+    // Backend of sim, created with the selected kind on first use
+    static SimBackend *of(Simulation *sim);
+    // Drops the backend of sim, call before deleting it
+    static void release(Simulation *sim);
+
+    // Kind for backends created from now on
+    static void select(Kind kind);
+    static Kind selected();
+    static bool kindFromName(const std::string &name, Kind &kind);
+
+    // First upload, masses and springs created before it live on the host only.
+    // False when the backend cannot run the simulation
+    virtual bool start() = 0;
+    // Advances the simulation by duration in mass timesteps
+    virtual void step(double duration) = 0;
+    virtual double time() = 0;
+    virtual bool running() = 0;
+    // Stops a running step at time t
+    virtual void pause(double t) = 0;
+
+    // Host copies of the masses and springs from and to the backend
+    virtual void getAll() = 0;
+    virtual void setAll() = 0;
+    virtual void get(Mass *m) = 0;
+    virtual void set(Mass *m) = 0;
+    virtual void set(Spring *s) = 0;
+
+    // Fills metrics from the backend state. Deflection is the mean displacement
+    // of deflectionMasses, or without them the summed change of distance of
+    // every mass to the first one. The default reduces over the host records,
+    // call it after getAll()
+    virtual void reduceMetrics(const std::vector<Mass *> &deflectionMasses, StepMetrics &metrics);
+
+    Simulation *sim;
+};
+
+// Forwards to Titan's CUDA implementation
+class TitanBackend : public SimBackend {
+
+public:
+    explicit TitanBackend(Simulation *sim) : SimBackend(sim) {}
+
+    bool start() override { sim->initCudaParameters(); return true; }
+    void step(double duration) override { sim->step(duration); }
+    double time() override { return sim->time(); }
+    bool running() override { return sim->running(); }
+    void pause(double t) override { sim->pause(t); }
+
+    void getAll() override { sim->getAll(); }
+    void setAll() override { sim->setAll(); }
+    void get(Mass *m) override { sim->get(m); }
+    void set(Mass *m) override { sim->set(m); }
+    void set(Spring *s) override { sim->set(s); }
+};
+
+#endif //DMLIDE_SIMBACKEND_H
@@ -0,0 +1,76 @@
+//
+// Host and device synchronization of a Titan simulation.
+//
+
+#include "simSync.h"
+
+#include <algorithm>
+
+// Marked share of the records above which push() uploads everything
+#define BULK_FRACTION 0.25
+
+// ------------------------------------------------------------
+SimSync::SimSync(Simulation *sim) : sim(sim), backend(SimBackend::of(sim)) {
+// ------------------------------------------------------------
+    massCount = sim->masses.size();
+    springCount = sim->springs.size();
+}
+
+// ------------------------------------------------------------
+void SimSync::clear() {
+// ------------------------------------------------------------
+    dirtyMasses.clear();
+    dirtySprings.clear();
+    massCount = sim->masses.size();
+    springCount = sim->springs.size();
+}
+
+// ------------------------------------------------------------
+void SimSync::push() {
+// ------------------------------------------------------------
+    if (clean()) return;
+
+    // Titan only sets records already in the device layout. Created or
+    // deleted masses and springs need a full upload, this also drops marks
+    // of deleted records. Deleting and creating as many is not detected
+    if (resized()) {
+        pushAll();
+        return;
+    }
+
+    std::sort(dirtyMasses.begin(), dirtyMasses.end());
+    dirtyMasses.erase(std::unique(dirtyMasses.begin(), dirtyMasses.end()), dirtyMasses.end());
+    std::sort(dirtySprings.begin(), dirtySprings.end());
+    dirtySprings.erase(std::unique(dirtySprings.begin(), dirtySprings.end()), dirtySprings.end());
+
+    double records = double(sim->masses.size() + sim->springs.size());
+    if (double(dirtyMasses.size() + dirtySprings.size()) > BULK_FRACTION * records) {
+        pushAll();
+        return;
+    }
+
+    for (Mass *m : dirtyMasses) backend->set(m);
+    for (Spring *s : dirtySprings) backend->set(s);
+    clear();
+}
+
+// ------------------------------------------------------------
+void SimSync::pushAll() {
+// ------------------------------------------------------------
+    backend->setAll();
+    clear();
+}
+
+// ------------------------------------------------------------
+void SimSync::pull(Mass *m) {
+// ------------------------------------------------------------
+    if (!clean()) push();
+    backend->get(m);
+}
+
+// ------------------------------------------------------------
+void SimSync::pullAll() {
+// ------------------------------------------------------------
+    if (!clean()) push();
+    backend->getAll();
+}
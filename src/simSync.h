@@ -0,0 +1,51 @@
+//
+// Host and device synchronization of a Titan simulation.
+// Host edits mark the masses and springs they change, push() uploads
+// only those records instead of the whole simulation.
+//
+
+#ifndef DMLIDE_SIMSYNC_H
+#define DMLIDE_SIMSYNC_H
+
+#include <cstddef>
+#include <vector>
+
+#include <Titan/sim.h>
+
+#include "simBackend.h"
+
+class SimSync {
+
+public:
+    explicit SimSync(Simulation *sim);
+
+    // Titan copies whole records, so a mark covers every field of it
+    void mark(Mass *m) { dirtyMasses.push_back(m); }
+    void mark(Spring *s) { dirtySprings.push_back(s); }
+
+    // Uploads the marked records, or everything when most records are marked
+    // or masses and springs were created or deleted since the last push
+    void push();
+    // Uploads everything, for the first upload and edits all over the simulation
+    void pushAll();
+
+    // Reads records back. Marked edits are pushed first so they are not overwritten
+    void pull(Mass *m);
+    void pullAll();
+
+    // Nothing to upload: no marks and no records created or deleted
+    bool clean() const { return dirtyMasses.empty() && dirtySprings.empty() && !resized(); }
+
+private:
+    bool resized() const { return sim->masses.size() != massCount || sim->springs.size() != springCount; }
+    void clear();
+
+    Simulation *sim;
+    SimBackend *backend;
+    std::vector<Mass *> dirtyMasses;
+    std::vector<Spring *> dirtySprings;
+    size_t massCount;   // Records at the last push, any change uploads everything
+    size_t springCount;
+};
+
+#endif //DMLIDE_SIMSYNC_H
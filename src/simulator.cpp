@@ -1,9 +1,13 @@
 #include "simulator.h"
 #include <QDir>
 
+#include <iterator>
+#include <unordered_map>
+
 Simulator::Simulator(Simulation *sim, Loader *loader, SimulationConfig *config, OptimizationConfig *optConfig,
-        bool graphics, bool endExport) {
+        bool graphics, bool endExport) : sync(sim) {
     this->sim = sim;
+    this->backend = SimBackend::of(sim);
     this->config = config;
     this->optConfig = optConfig;
     this->loader = loader;
@@ -82,6 +86,9 @@ Simulator::Simulator(Simulation *sim, Loader *loader, SimulationConfig *config,
     prevEnergy = -1;
     prevSteps = 0;
     switched = false;
+    loadsKnown = false;
+    loadedCase = nullptr;
+    metricsStale = true;
 
     if (!GRAPHICS) {
         for (int i = 0; i < 30; i++) {
@@ -125,7 +132,11 @@ void Simulator::runSimulation(bool running) {
     if (running) {
         if (simStatus == NOT_STARTED) {
             createDataDir();
-            sim->initCudaParameters();
+            if (!backend->start()) {
+                cout << "Simulation backend could not start, stopping.\n";
+                simStatus = STOPPED;
+                return;
+            }
             dumpSpringData();
             startWallClockTime = std::chrono::system_clock::now();
         }
@@ -140,16 +151,19 @@ void Simulator::runSimulation(bool running) {
 
 void Simulator::runStep() {
     simStatus = PAUSED;
-    sim->step(sim->masses.front()->dt);
-    sim->getAll();
+    backend->step(sim->masses.front()->dt);
+    backend->getAll();
+    metricsStale = true;
 }
 
 void Simulator::getSimMetrics(sim_metrics &metrics) {
     metrics.clockTime = wallClockTime;
-    metrics.time = sim->time();
+    metrics.time = backend->time();
     metrics.nbars = sim->springs.size();
     metrics.totalLength = totalLength;
     metrics.totalEnergy = totalEnergy;
+    if (metricsStale) refreshMetrics();
+    metrics.kineticEnergy = stepMetrics.kineticEnergy;
     metrics.totalLength_start = totalLength_start;
     metrics.totalEnergy_start = totalEnergy_start;
     metrics.deflection = calcDeflection();
@@ -167,6 +181,8 @@ void Simulator::dumpSpringData() {
 }
 
 void Simulator::loadSimDump(std::string sp) {
+    loadsKnown = false;
+    metricsStale = true;
     int nm = 0, ns = 0;
     double time = 0;
     double slen, clen;
@@ -319,50 +335,38 @@ void Simulator::exportSimulation() {
 
 void Simulator::run() {
 
-    if (!sim->running()) {
+    if (!backend->running()) {
         qDebug() << "Next Load" << currentLoad << "Queue size" << config->loadQueue.size() << "Switch at time" << pastLoadTime;
         bool loadQueueDone = false;
 
         // Set repeats
-        if (repeatTime > 0 && repeatTime < sim->time()) {
+        if (repeatTime > 0 && repeatTime < backend->time()) {
             repeatLoad();
         }
 
-        bool currLoadDone = sim->time() >= pastLoadTime;
+        bool currLoadDone = backend->time() >= pastLoadTime;
         if (currLoadDone && !config->loadQueue.empty()) {
             // Load queue
             if (currentLoad >= config->loadQueue.size()) {
                 loadQueueDone = true;
             } else {
                 Loadcase *load = config->loadQueue[currentLoad];
-                clearLoads();
                 applyLoad(load);
                 currentLoad++;
                 pastLoadTime += load->totalDuration;
             }
         }
 
-        sim->step(renderTimeStep);
+        backend->step(renderTimeStep);
         qDebug() << "Stepped" << steps << "Repeats" << n_repeats;
-        sim->getAll();
+        backend->getAll();
+        refreshMetrics();
         totalLength_prev = totalLength;
-        totalLength = 0;
-        double maxForce = 0;
-        Spring *maxForceSpring = nullptr;
-        int i = 0, n = 0;
-        for (Spring *s: sim->springs) {
-            if (s == nullptr) continue;
-
-            if (s->_k == 0) continue;
-            totalLength += s->_rest;
-            if (maxForce < fabs(s->_curr_force)) {
-                maxForce = fabs(s->_curr_force);
-                maxForceSpring = s;
-                n = i;
-            }
-            i++;
+        totalLength = stepMetrics.totalLength;
+        if (stepMetrics.maxForceSpring >= 0) {
+            Spring *maxForceSpring = sim->springs[stepMetrics.maxForceSpring];
+            qDebug() << "MAX FORCE SPRING" << stepMetrics.maxForceSpring << stepMetrics.maxForce << maxForceSpring->_rest << (maxForceSpring->_left->pos - maxForceSpring->_right->pos).norm();
         }
-        if (maxForceSpring != nullptr) qDebug() << "MAX FORCE SPRING" << n << maxForce << maxForceSpring->_rest << (maxForceSpring->_left->pos - maxForceSpring->_right->pos).norm();
 
         bool stopReached = stopCriteriaMet();
         qDebug() << "Removed springs" << springRemover->removedSprings.size();
@@ -396,7 +400,8 @@ void Simulator::run() {
                     s->_curr_force = 0;
                 }
                 //equilibrium = true;
-                sim->setAll();
+                backend->setAll();
+                metricsStale = true;
                 stepsSinceEquil = 0;
                 equilibrium = true;
             }
@@ -412,6 +417,8 @@ void Simulator::run() {
 
                     qDebug() << "About to optimize";
                     optimizer->optimize();
+                    loadsKnown = false; // Optimizers can move external forces
+                    metricsStale = true;
                     equilibrium = false;
                     closeToPrevious = 0;
                     cout << "Average trial time (simulation): " << massDisplacer->totalTrialTime / massDisplacer->totalAttempts << "s \n";
@@ -438,6 +445,8 @@ void Simulator::run() {
             if (optConfig != nullptr) {
                 if (switched) {
                     optimizer->optimize();
+                    loadsKnown = false; // Optimizers can move external forces
+                    metricsStale = true;
                     //writeMetric(metricFile);
 
                     optimized++;
@@ -460,13 +469,15 @@ void Simulator::run() {
 
                             qDebug() << "OPTIMIZING";
                             writeMetric(metricFile);
-                            double simTimeBeforeOpt = sim->time();
+                            double simTimeBeforeOpt = backend->time();
 
                             if (calcDeflection() > deflection_start * 10) {
                                 qDebug() << "Deflection" << calcDeflection() << deflection_start;
                                 springRemover->resetHalfLastRemoval();
                             } else {
                                 optimizer->optimize();
+                                loadsKnown = false; // Optimizers can move external forces
+                                metricsStale = true;
                                 if (!springRemover->regeneration) optimized++;
                                 qDebug() << "Removed spring post opt" << springRemover->removedSprings.size();
                                 n_repeats = optimizeAfter > 0 ? optimizeAfter - 1 : 0;
@@ -481,6 +492,7 @@ void Simulator::run() {
                                 if (springRemover->regeneration && !optConfig->rules.empty()) {
                                     if (totalLength <= totalLength_start * optConfig->rules.front().regenThreshold) {
                                         springRemover->regenerateLattice(config);
+                                        metricsStale = true;
                                         optimized++;
                                         //springRemover->regenerateShift();
                                         n_masses = int(sim->masses.size());
@@ -489,7 +501,7 @@ void Simulator::run() {
 
                                 }
                             // Account for time shift
-                            optimizeTime = sim->time() - simTimeBeforeOpt;
+                            optimizeTime = backend->time() - simTimeBeforeOpt;
                             qDebug() << "OPTIMIZE TIME" << optimizeTime;
                             pastLoadTime += optimizeTime;
 
@@ -526,7 +538,7 @@ void Simulator::run() {
 
 void Simulator::repeatLoad() {
 
-    if (!sim->running()) {
+    if (!backend->running()) {
 
         if (n_repeats == 0) {
             writeMetricHeader(metricFile);
@@ -566,7 +578,8 @@ void Simulator::repeatLoad() {
 
         // Increase repeat time
         repeatTime += config->repeat.after;
-        sim->setAll();
+        backend->setAll();
+        metricsStale = true;
 
         n_repeats++;
     }
@@ -647,11 +660,9 @@ Vec Simulator::getSimCenter() {
 }
 
 void Simulator::equilibriate() {
+    if (metricsStale) refreshMetrics();
     totalEnergy_prev = totalEnergy;
-    totalEnergy = 0;
-    for (Spring *s : sim->springs) {
-        totalEnergy += s->_curr_force * s->_curr_force / s->_k;
-    }
+    totalEnergy = stepMetrics.totalEnergy;
     qDebug() << "ENERGY" << totalEnergy << prevEnergy << closeToPrevious << stepsSinceEquil;
     if (prevEnergy > 0 && fabs(prevEnergy - totalEnergy) < totalEnergy * 1E-6) {
         closeToPrevious++;
@@ -744,27 +755,24 @@ bool Simulator::dumpCriteriaMet() {
     return dump;
 }
 
-double Simulator::calcDeflection() {
-    double deflection = 0;
+// Spring, energy and deflection metrics of the current state in one backend
+// reduction. Deflection is measured at the loaded masses, or over the whole
+// simulation without forces
+void Simulator::refreshMetrics() {
+    assert(!sim->masses.empty());
     vector<Mass *> points = vector<Mass *>();
     if (config->load && !config->load->forces.empty()) {
         for (Force *f : config->load->forces) {
-            for (Mass *m : f->masses) {
-                points.push_back(m);
-                deflection += (m->origpos - m->pos).norm();
-            }
-        }
-        deflection /= points.size();
-    } else {
-        assert(!sim->masses.empty());
-        Mass *refMass = sim->masses.front();
-        for (Mass *m : sim->masses) {
-            double origDist = (m->origpos - refMass->origpos).norm();
-            double newDist = (m->pos - refMass->pos).norm();
-            deflection += fabs(newDist - origDist);
+            points.insert(points.end(), f->masses.begin(), f->masses.end());
         }
     }
-    return deflection;
+    backend->reduceMetrics(points, stepMetrics);
+    metricsStale = false;
+}
+
+double Simulator::calcDeflection() {
+    if (metricsStale) refreshMetrics();
+    return stepMetrics.deflection;
 }
 
 Vec Simulator::getDeflectionPoint() {
@@ -858,7 +866,7 @@ void Simulator::writeMetric(const QString &outputFile) {
         } else if (optConfig->rules.front().method == OptimizationRule::REMOVE_LOW_STRESS) {
             QString mLine = QString("%1,%2,%3,%4,%5,%6\n")
                     .arg(wallClockTime)
-                    .arg(sim->time())
+                    .arg(backend->time())
                     .arg(optimized)
                     .arg(calcDeflection())
                     .arg(totalLength)
@@ -890,7 +898,7 @@ void Simulator::writeSimDump(const QString &outputFile) {
 
     // HEADER
     QString h = QString("SIMULATION DUMP; Time: %1, Springs: %2, Masses: %3\n")
-            .arg(sim->time())
+            .arg(backend->time())
             .arg(sim->springs.size())
             .arg(sim->masses.size());
     file.write(h.toUtf8());
@@ -967,78 +975,132 @@ void Simulator::clearLoads() {
     }
 }
 
-void Simulator::applyLoad(Loadcase *load) {
-    sim->getAll();
+// Masses of the loadcase as indices into sim->masses. Masses no longer in the
+// simulation are dropped from the force and torque lists, as applyLoad always did
+void Simulator::compileLoad(Loadcase *load, CompiledLoad &compiled) {
+    unordered_map<Mass *, uint32_t> index = unordered_map<Mass *, uint32_t>();
+    index.reserve(sim->masses.size());
+    for (uint32_t i = 0; i < sim->masses.size(); i++) {
+        index.emplace(sim->masses[i], i);
+    }
 
-    qDebug() << "Applying" << load->anchors[0]->masses.size() << "anchors and" << load->forces[0]->masses.size() << "forces";
-    for (Mass *m : sim->masses) {
-        for (Anchor *a : load->anchors) {
-            for (Mass *am : a->masses) {
-                if (m == am) {
-                    m->fix();
-                }
-            }
+    compiled = CompiledLoad();
+    for (Anchor *a : load->anchors) {
+        for (Mass *am : a->masses) {
+            auto found = index.find(am);
+            if (found != index.end()) compiled.anchored.push_back(found->second);
         }
     }
     for (Force *f : load->forces) {
-        int forceMasses = 0;
-
+        f->masses.erase(remove_if(f->masses.begin(), f->masses.end(),
+                                  [&](Mass *fm) { return index.count(fm) == 0; }), f->masses.end());
+        if (f->masses.empty()) continue;
+        Vec distributedForce = f->magnitude / f->masses.size();
         for (Mass *fm : f->masses) {
-            bool valid = false;
-            for (Mass *m : sim->masses) {
-                    if (m == fm) {
-                    m->extduration = f->duration + pastLoadTime;
-                    qDebug() << "DURATION" << m->extduration;
-                    if (m->extduration < 0) {
-                        m->extduration = DBL_MAX;
-                    }
-                    forceMasses ++;
-                    valid = true;
-                }
-            }
-            if (!valid) {
-                f->masses.erase(remove(f->masses.begin(), f->masses.end(), fm), f->masses.end());
-            }
-        }
-        if (forceMasses > 0) {
-            Vec distributedForce = f->magnitude / forceMasses;
-            for (Mass *fm : f->masses) {
-                fm->extforce += distributedForce;
-                fm->force += distributedForce;
-            }
+            compiled.forced.push_back(index[fm]);
+            compiled.forces.push_back(distributedForce);
+            compiled.forceDurations.push_back(f->duration);
         }
     }
     for (Torque *t : load->torques) {
-        int torqueMasses = 0;
-
+        t->masses.erase(remove_if(t->masses.begin(), t->masses.end(),
+                                  [&](Mass *tm) { return index.count(tm) == 0; }), t->masses.end());
         for (Mass *tm : t->masses) {
-            bool valid = false;
-            for (Mass *m : sim->masses) {
-                    if (m == tm) {
-                    m->extduration = t->duration + pastLoadTime;
-                    qDebug() << "DURATION" << m->extduration;
-                    if (m->extduration < 0) {
-                        m->extduration = DBL_MAX;
-                    }
-                    torqueMasses ++;
-                    valid = true;
-                }
-            }
-            if (!valid) {
-                t->masses.erase(remove(t->masses.begin(), t->masses.end(), tm), t->masses.end());
-            }
+            compiled.torqued.push_back(index[tm]);
+            compiled.torques.push_back(t);
         }
-        if (torqueMasses > 0) {
-            Vec torqueMag = t->magnitude / torqueMasses;
-            for (Mass *m : t->masses) {
-                Vec distance = Vec(t->origin[0]-m->pos[0] , t->origin[1]-m->pos[1] , t->origin[2]-m->pos[2]);
-                Vec forceProjection = cross(t->magnitude,distance)/distance.norm();
-                m->force += forceProjection;
-                m->extforce += forceProjection;
-            }
+    }
+
+    compiled.touched = compiled.anchored;
+    compiled.touched.insert(compiled.touched.end(), compiled.forced.begin(), compiled.forced.end());
+    compiled.touched.insert(compiled.touched.end(), compiled.torqued.begin(), compiled.torqued.end());
+    sort(compiled.touched.begin(), compiled.touched.end());
+    compiled.touched.erase(unique(compiled.touched.begin(), compiled.touched.end()), compiled.touched.end());
+
+    compiled.members.reserve(compiled.touched.size());
+    for (uint32_t i : compiled.touched) {
+        compiled.members.push_back(sim->masses[i]);
+    }
+    compiled.massCount = sim->masses.size();
+}
+
+// Tables stay valid until the optimizers add or remove masses
+bool Simulator::isCompiled(const CompiledLoad &compiled) const {
+    if (compiled.massCount != sim->masses.size()) return false;
+    for (size_t i = 0; i < compiled.touched.size(); i++) {
+        if (sim->masses[compiled.touched[i]] != compiled.members[i]) return false;
+    }
+    return true;
+}
+
+// Clears the previous load and applies the next. Only the masses of both
+// loads are read back and uploaded, the whole simulation when the previous
+// load is unknown
+void Simulator::applyLoad(Loadcase *load) {
+    CompiledLoad &compiled = compiledLoads[load];
+    if (compiled.massCount == 0 || !isCompiled(compiled)) {
+        compileLoad(load, compiled);
+    }
+
+    vector<uint32_t> dirty = vector<uint32_t>();
+    bool full = !loadsKnown || loadedCase == nullptr || !isCompiled(compiledLoads[loadedCase]);
+    if (!full) {
+        const vector<uint32_t> &previous = compiledLoads[loadedCase].touched;
+        set_union(previous.begin(), previous.end(), compiled.touched.begin(), compiled.touched.end(),
+                  back_inserter(dirty));
+    }
+
+    if (full) {
+        sync.pullAll();
+        clearLoads();
+    } else {
+        for (uint32_t i : dirty) {
+            Mass *m = sim->masses[i];
+            sync.pull(m);
+            m->extforce = Vec(0,0,0);
+            m->extduration = 0;
+            m->unfix();
+        }
+    }
+
+    qDebug() << "Applying" << compiled.anchored.size() << "anchored," << compiled.forced.size() << "forced and"
+             << compiled.torqued.size() << "torqued masses";
+
+    for (uint32_t i : compiled.anchored) {
+        sim->masses[i]->fix();
+    }
+    for (size_t e = 0; e < compiled.forced.size(); e++) {
+        Mass *m = sim->masses[compiled.forced[e]];
+        m->extduration = compiled.forceDurations[e] + pastLoadTime;
+        if (m->extduration < 0) {
+            m->extduration = DBL_MAX;
+        }
+        m->extforce += compiled.forces[e];
+        m->force += compiled.forces[e];
+    }
+    for (size_t e = 0; e < compiled.torqued.size(); e++) {
+        Mass *m = sim->masses[compiled.torqued[e]];
+        Torque *t = compiled.torques[e];
+        m->extduration = t->duration + pastLoadTime;
+        if (m->extduration < 0) {
+            m->extduration = DBL_MAX;
+        }
+        Vec distance = Vec(t->origin[0]-m->pos[0] , t->origin[1]-m->pos[1] , t->origin[2]-m->pos[2]);
+        Vec forceProjection = cross(t->magnitude,distance)/distance.norm();
+        m->force += forceProjection;
+        m->extforce += forceProjection;
+    }
+
+    if (full) {
+        sync.pushAll();
+    } else {
+        for (uint32_t i : dirty) {
+            sync.mark(sim->masses[i]);
         }
+        sync.push();
     }
-    sim->setAll();
+    loadedCase = load;
+    loadsKnown = true;
 }
 
 void Simulator::varyLoadDirection() {
@@ -1074,6 +1136,6 @@ void Simulator::varyLoadDirection() {
                 }
             }
         }
-        sim->setAll();
+        backend->setAll();
     }
 }
@@ -3,6 +3,8 @@
 
 #include "optimizer.h"
 #include "loader.h"
+#include "simSync.h"
+#include "simBackend.h"
 #include "io/exportThread.h"
 
 #undef GRAPHICS
@@ -21,6 +23,7 @@ struct sim_metrics {
     double time;
     double totalLength;
     double totalEnergy;
+    double kineticEnergy;
 
     double totalLength_start;
     double totalEnergy_start;
@@ -46,6 +49,8 @@ public:
     };
 
     Simulation *sim;
+    SimBackend *backend; // Titan or CPU stepping, see --backend
+    SimSync sync; // Uploads for load switches
     SimulationConfig *config;
     Optimizer *optimizer;
     OptimizationConfig *optConfig;
@@ -126,6 +131,11 @@ private:
     Vec getSimCenter();
     void equilibriate();
     bool stopCriteriaMet();
+
+    // Metrics of the current state, reduced by the backend once per step
+    StepMetrics stepMetrics;
+    bool metricsStale; // Set when the state changes outside of run()
+    void refreshMetrics();
     bool dumpCriteriaMet();
 
     int currentLoad;
@@ -134,6 +144,25 @@ private:
     bool varyLoad;
     void clearLoads();
     void applyLoad(Loadcase * load);
+
+    // Loadcase as tables of indices into sim->masses, compiled on first use
+    // and again when the optimizers change the masses
+    struct CompiledLoad {
+        vector<uint32_t> anchored;      // Masses to fix
+        vector<uint32_t> forced;        // Mass per force entry
+        vector<Vec> forces;             // Distributed force per entry
+        vector<double> forceDurations;  // Per entry, pastLoadTime is added when applied
+        vector<uint32_t> torqued;       // Mass per torque entry
+        vector<Torque *> torques;       // Per entry, projected from the mass position when applied
+        vector<uint32_t> touched;       // All masses above, ascending
+        vector<Mass *> members;         // sim->masses[touched[i]] when compiled
+        size_t massCount = 0;
+    };
+    map<Loadcase *, CompiledLoad> compiledLoads;
+    Loadcase *loadedCase; // Last load applied by applyLoad
+    bool loadsKnown;      // False when masses beyond loadedCase may carry loads
+    void compileLoad(Loadcase *load, CompiledLoad &compiled);
+    bool isCompiled(const CompiledLoad &compiled) const;
     void varyLoadDirection();
 
     Vec getDeflectionPoint();
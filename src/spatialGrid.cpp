@@ -0,0 +1,104 @@
+//
+// Uniform cell list over a point set.
+//
+
+#include "spatialGrid.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Bounds the points, sizes the cells and sorts point indices by cell
+// with a counting sort, which keeps them ascending within each cell
+// ------------------------------------------------------------
+void SpatialGrid::build(const std::vector<glm::dvec3> &points, double cellSize) {
+// ------------------------------------------------------------
+
+    clear();
+    if (points.empty()) return;
+
+    glm::dvec3 bmin = glm::dvec3(DBL_MAX);
+    glm::dvec3 bmax = glm::dvec3(-DBL_MAX);
+    for (const glm::dvec3 &p : points) {
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+
+    // Slightly larger cells so rounding in the binning never pushes
+    // a pair at exactly cellSize two cells apart
+    glm::dvec3 extent = bmax - bmin;
+    size = std::max(cellSize, 1E-12) * (1 + 1E-6);
+    for (;;) {
+        nx = int64_t(extent.x / size) + 1;
+        ny = int64_t(extent.y / size) + 1;
+        nz = int64_t(extent.z / size) + 1;
+        if (double(nx) * double(ny) * double(nz) <= double(MAX_CELLS)) break;
+        size *= 1.25;
+    }
+    invSize = 1.0 / size;
+    origin = bmin;
+
+    size_t n = points.size();
+    std::vector<uint32_t> cellIds = std::vector<uint32_t>(n);
+    cellStart = std::vector<uint32_t>(size_t(nx * ny * nz) + 1, 0);
+
+    for (size_t p = 0; p < n; p++) {
+        int64_t i, j, k;
+        cellOf(points[p], i, j, k);
+        cellIds[p] = uint32_t((k * ny + j) * nx + i);
+        cellStart[cellIds[p] + 1]++;
+    }
+    for (size_t c = 1; c < cellStart.size(); c++) {
+        cellStart[c] += cellStart[c - 1];
+    }
+
+    items = std::vector<uint32_t>(n);
+    std::vector<uint32_t> fill = std::vector<uint32_t>(cellStart.begin(), cellStart.end() - 1);
+    for (size_t p = 0; p < n; p++) {
+        items[fill[cellIds[p]]++] = uint32_t(p);
+    }
+}
+
+// ------------------------------------------------------------
+void SpatialGrid::clear() {
+// ------------------------------------------------------------
+    std::vector<uint32_t>().swap(cellStart);
+    std::vector<uint32_t>().swap(items);
+    nx = ny = nz = 0;
+    size = invSize = 0;
+}
+
+// Cell coordinates of p, clamped to the grid
+// ------------------------------------------------------------
+void SpatialGrid::cellOf(const glm::dvec3 &p, int64_t &i, int64_t &j, int64_t &k) const {
+// ------------------------------------------------------------
+    glm::dvec3 g = (p - origin) * invSize;
+    i = std::min(std::max(int64_t(std::floor(g.x)), int64_t(0)), nx - 1);
+    j = std::min(std::max(int64_t(std::floor(g.y)), int64_t(0)), ny - 1);
+    k = std::min(std::max(int64_t(std::floor(g.z)), int64_t(0)), nz - 1);
+}
+
+// Flat point sets spread the cells over their nonzero extents
+// ------------------------------------------------------------
+double SpatialGrid::cellSizeFor(const std::vector<glm::dvec3> &points, double perCell) {
+// ------------------------------------------------------------
+    if (points.empty()) return 1;
+
+    glm::dvec3 bmin = glm::dvec3(DBL_MAX);
+    glm::dvec3 bmax = glm::dvec3(-DBL_MAX);
+    for (const glm::dvec3 &p : points) {
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+    glm::dvec3 extent = bmax - bmin;
+    double cells = std::max(1.0, double(points.size()) / perCell);
+
+    double measure = 1;
+    int dims = 0;
+    for (double e : {extent.x, extent.y, extent.z}) {
+        if (e <= 0) continue;
+        measure *= e;
+        dims++;
+    }
+    return (dims > 0) ? std::pow(measure / cells, 1.0 / dims) : 1;
+}
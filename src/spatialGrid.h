@@ -0,0 +1,88 @@
+//
+// Uniform cell list over a point set.
+// Points are bucketed by cell in one flat array (compressed rows),
+// so neighbor queries only visit the 27 cells around a point.
+//
+
+#ifndef DMLIDE_SPATIALGRID_H
+#define DMLIDE_SPATIALGRID_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class SpatialGrid {
+
+public:
+    SpatialGrid() = default;
+
+    // Bins points into cubic cells of side at least cellSize, so every pair
+    // closer than cellSize lies in the same or in adjacent cells
+    void build(const std::vector<glm::dvec3> &points, double cellSize);
+    void clear();
+
+    bool empty() const { return items.empty(); }
+    double cellSize() const { return size; }
+    size_t cellCount() const { return cellStart.empty() ? 0 : cellStart.size() - 1; }
+
+    // Calls visit(i) for every point i in the cells around p,
+    // ascending within each cell. Visits candidates, not only points within cellSize
+    template <typename Visitor>
+    void forEachNear(const glm::dvec3 &p, Visitor visit) const {
+        if (items.empty()) return;
+        int64_t ci, cj, ck;
+        cellOf(p, ci, cj, ck);
+        for (int64_t k = std::max<int64_t>(ck - 1, 0); k <= std::min<int64_t>(ck + 1, nz - 1); k++) {
+            for (int64_t j = std::max<int64_t>(cj - 1, 0); j <= std::min<int64_t>(cj + 1, ny - 1); j++) {
+                size_t row = (size_t(k) * ny + size_t(j)) * nx;
+                size_t i0 = row + size_t(std::max<int64_t>(ci - 1, 0));
+                size_t i1 = row + size_t(std::min<int64_t>(ci + 1, nx - 1));
+                // Cells of a row are contiguous, scan them as one range
+                for (uint32_t s = cellStart[i0]; s < cellStart[i1 + 1]; s++) {
+                    visit(items[s]);
+                }
+            }
+        }
+    }
+
+    // Calls visit(i) for every point i in the cells overlapping the box [lo, hi],
+    // ascending within each cell. Boxes beyond the grid visit nothing
+    template <typename Visitor>
+    void forEachInBox(const glm::dvec3 &lo, const glm::dvec3 &hi, Visitor visit) const {
+        if (items.empty()) return;
+        glm::dvec3 top = origin + glm::dvec3(double(nx), double(ny), double(nz)) * size;
+        if (hi.x < origin.x || hi.y < origin.y || hi.z < origin.z
+            || lo.x > top.x || lo.y > top.y || lo.z > top.z) return;
+        int64_t i0, j0, k0, i1, j1, k1;
+        cellOf(lo, i0, j0, k0);
+        cellOf(hi, i1, j1, k1);
+        for (int64_t k = k0; k <= k1; k++) {
+            for (int64_t j = j0; j <= j1; j++) {
+                size_t row = (size_t(k) * ny + size_t(j)) * nx;
+                for (uint32_t s = cellStart[row + i0]; s < cellStart[row + i1 + 1]; s++) {
+                    visit(items[s]);
+                }
+            }
+        }
+    }
+
+    // Cell edge for about perCell points per cell over the bounds of points
+    static double cellSizeFor(const std::vector<glm::dvec3> &points, double perCell);
+
+    // Cells per grid are capped, sparse point sets get coarser cells
+    static const size_t MAX_CELLS = size_t(1) << 24;
+
+private:
+    void cellOf(const glm::dvec3 &p, int64_t &i, int64_t &j, int64_t &k) const;
+
+    glm::dvec3 origin;
+    double size = 0;
+    double invSize = 0;
+    int64_t nx = 0, ny = 0, nz = 0;
+    std::vector<uint32_t> cellStart; // First item per cell, one extra entry at the end
+    std::vector<uint32_t> items;     // Point indices grouped by cell
+};
+
+#endif //DMLIDE_SPATIALGRID_H
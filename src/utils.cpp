@@ -1,6 +1,11 @@
 #include "utils.h"
+#include "rng.h"
 
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <cctype>
+#include <cstring>
 
 #define EPSILON 1E-5
 
@@ -37,35 +42,37 @@ string Utils::trim(string &s) {
     return  s;
 }
 
+// Draws come from the calling thread's stream, see Rng
 float Utils::randFloat(float min, float max) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<float> dis(min, max);
-    return dis(gen);
+    return Rng::local().uniform(min, max);
 }
 
 float Utils::randUnit() {
-    return randFloat(0.0f, 1.0f);
+    return Rng::local().unit();
 }
 
 vec3 Utils::randDirection() {
-    return normalize(vec3(randUnit(), randUnit(), randUnit()));
+    Rng &rng = Rng::local();
+    return normalize(vec3(rng.unit(), rng.unit(), rng.unit()));
 }
 
 Vec Utils::randDirectionVec() {
-    return Vec(randFloat(-1, 1), randFloat(-1, 1), randFloat(-1, 1)).normalized();
+    Rng &rng = Rng::local();
+    return Vec(rng.uniform(-1.0f, 1.0f), rng.uniform(-1.0f, 1.0f), rng.uniform(-1.0f, 1.0f)).normalized();
 }
 
 vec3 Utils::randPoint(vec3 lowBound, vec3 highBound) {
-    return glm::vec3(Utils::randFloat(lowBound.x, highBound.x),
-                     Utils::randFloat(lowBound.y, highBound.y),
-                     Utils::randFloat(lowBound.z, highBound.z));
+    Rng &rng = Rng::local();
+    return glm::vec3(rng.uniform(lowBound.x, highBound.x),
+                     rng.uniform(lowBound.y, highBound.y),
+                     rng.uniform(lowBound.z, highBound.z));
 }
 
 Vec Utils::randPointVec(Vec lowBound, Vec highBound) {
-    return Vec(Utils::randFloat(lowBound[0], highBound[0]),
-             Utils::randFloat(lowBound[1], highBound[1]),
-             Utils::randFloat(lowBound[2], highBound[2]));
+    Rng &rng = Rng::local();
+    return Vec(rng.uniform(float(lowBound[0]), float(highBound[0])),
+               rng.uniform(float(lowBound[1]), float(highBound[1])),
+               rng.uniform(float(lowBound[2]), float(highBound[2])));
 }
 
 // Clamps an input value from imin and imax to a range defined by omin and omax
@@ -378,6 +385,31 @@ inline QDebug operator<<(QDebug dbg, const std::string& str)
 }
 
 
+// Finds the file with either capitalization of the .stl extension
+static bool resolveModelPath(string &path) {
+    if (QFile::exists(QString::fromStdString(path))) {
+        return true;
+    }
+
+    qDebug() << "Attempting to correct file endings...";
+    string alt = path;
+    if (alt.size() >= 4 && alt.compare(alt.size() - 4, 4, ".stl") == 0) {
+        alt.replace(alt.end() - 3, alt.end(), "STL");
+    } else if (alt.size() >= 4 && alt.compare(alt.size() - 4, 4, ".STL") == 0) {
+        alt.replace(alt.end() - 3, alt.end(), "stl");
+    }
+
+    if (QFile::exists(QString::fromStdString(alt))) {
+        qDebug() << "New path: " << alt;
+        path = alt;
+        return true;
+    }
+
+    qDebug() << "File in path: " << path << " not found!";
+    return false;
+}
+
+
 // createModelFromFile(string fileName, vector<vec3> &vs, vector<vec3> &ns)
 //
 // Populates a model from a file.
@@ -386,79 +418,8 @@ inline QDebug operator<<(QDebug dbg, const std::string& str)
 //   -- Binary STL
 //
 void Utils::createModelFromFile(string path, float scale, vector<vec3> &vs, vector<vec3> &ns) {
-    enum Format {
-        STL_ASCII,
-        STL_BINARY,
-        OTHER
-    };
-
-    Format fileFormat = OTHER;
-
-    ifstream file(path, ios::in | ios::binary);
-    string header;
-    qDebug() << "Header...";
-    qDebug() << "*** " << header << " ***";
-    qDebug() << "Path...";
-    qDebug() << "*** " << path << " ***";
-
-    if (!file) { 
-        qDebug() << "Attempting to correct file endings...";
-        // this  is gonna check to see if the file exists with 
-        // a different capitalization
-        if (endsWith(path,".stl")) { 
-            qDebug() << 2; 
-            path.replace(path.end()-3,path.end(),"STL");
-        } 
-        
-        if (endsWith(path,".STL")) {
-            qDebug() << 1;  
-            path.replace(path.end()-3,path.end(),"stl"); 
-        } 
-        
-        qDebug() << "New path: " << path; 
-        file.close();
-        file.open(path);        
-    }
-    if (!file) {
-            qDebug() << "File in path: " << path << " not found!";
-            return;
-    }
-
-    if (endsWith(path, ".stl") || endsWith(path, ".STL")) {
-        getline(file, header);
-
-        qDebug() << "Header...";
-        qDebug() << "*** " << header << " ***";
-
-
-
-        if (startsWith(trim(header), "solid")) {
-            fileFormat = STL_ASCII;
-        } else {
-            fileFormat = STL_BINARY;
-        }
-    }
-
-    // Parse based on format
-    switch (fileFormat) {
-        case STL_ASCII:
-            parseStlASCII(file, vs, ns);
-            break;
-        case STL_BINARY:
-            parseStlBinary(file, vs, ns);
-            break;
-        default:
-            break;
-    }
-
-    file.close();
-
-    // Apply units
-    if (scale != 1) {
-        for (int i = 0; i < vs.size(); i++) {
-            vs[i] = scale * vs[i];
-        }
-    }
+    if (!resolveModelPath(path)) return;
+    readStl(path, scale, vs, ns);
 }
 
 
@@ -470,233 +431,371 @@ void Utils::createModelFromFile(string path, float scale, vector<vec3> &vs, vect
 //   -- Binary STL
 //
 void Utils::createModelFromFile(string path, float scale, vector<Vec> &vs, vector<Vec> &ns) {
-    enum Format {
-        STL_ASCII,
-        STL_BINARY,
-        OTHER
-    };
-
-    Format fileFormat = OTHER;
-
-    ifstream file(path, ios::in | ios::binary);
-    string header;
-    qDebug() << "Header...";
-    qDebug() << "*** " << header << " ***";
-    qDebug() << "Path...";
-    qDebug() << "*** " << path << " ***";
-
-    if (!file) { 
-        qDebug() << "Attempting to correct file endings...";
-        // this  is gonna check to see if the file exists with 
-        // a different capitalization
-        if (endsWith(path,".stl")) { 
-            qDebug() << 3; 
-            path.replace(path.end()-3,path.end(),"STL");
-        //   path = path.substr(0,path.length()-3) + "STL";
-        }
-        else if (endsWith(path,".STL")) { 
-            qDebug() << 4; 
-            path.replace(path.end()-3,path.end(),"stl");
-        //  path = path.substr(0,path.length()-3) + "stl";
-        } 
-        
-        qDebug() << "New path: " << path;  
-        file.close();
-        file.open(path);       
-    }
-    if (!file) {
-            qDebug() << "File in path: " << path << " not found!";
-            return;
-    }
-
-    if (endsWith(path, ".stl") || endsWith(path, ".STL")) {
-        getline(file, header);
+    if (!resolveModelPath(path)) return;
+    readStl(path, scale, vs, ns);
+}
 
-        qDebug() << "Header...";
-        qDebug() << "*** " << header << " ***";
 
-        if (startsWith(trim(header), "solid")) {
-            fileFormat = STL_ASCII;
-        } else {
-            fileFormat = STL_BINARY;
-        }
-    }
+// Reads the next whitespace separated token of [p, end)
+static bool nextToken(const char *&p, const char *end, const char *&token, size_t &length) {
+    while (p < end && isspace((unsigned char) *p)) p++;
+    if (p == end) return false;
+    token = p;
+    while (p < end && !isspace((unsigned char) *p)) p++;
+    length = size_t(p - token);
+    return true;
+}
 
-    // Parse based on format
-    switch (fileFormat) {
-        case STL_ASCII:
-            parseStlASCII(file, vs, ns);
-            break;
-        case STL_BINARY:
-            parseStlBinary(file, vs, ns);
-            break;
-        default:
-            break;
+// Reads three numbers, tokens are copied out since the buffer is not terminated
+static bool nextTriple(const char *&p, const char *end, double *xyz) {
+    const char *token;
+    size_t length;
+    char number[64];
+    for (int i = 0; i < 3; i++) {
+        if (!nextToken(p, end, token, length) || length >= sizeof(number)) return false;
+        memcpy(number, token, length);
+        number[length] = '\0';
+        char *parsed;
+        xyz[i] = strtod(number, &parsed);
+        if (parsed == number) return false;
     }
+    return true;
+}
 
-    file.close();
-
-    // Apply units
-    if (scale != 1) {
-        for (int i = 0; i < vs.size(); i++) {
-            vs[i] = scale * vs[i];
+// parseStlASCII(const char *data, size_t size, float scale, vector<V> &vs, vector<V> &ns)
+//
+// Parses vertex positions and normals from an STL (ASCII) buffer
+// See https://en.wikipedia.org/wiki/STL_(file_format)
+//
+template <typename V>
+static bool parseStlASCII(const char *data, size_t size, float scale, vector<V> &vs, vector<V> &ns) {
+
+    const char *p = data, *end = data + size;
+    const char *token;
+    size_t length;
+    double xyz[3];
+
+    // Three vertices per facet of roughly 250 bytes
+    vs.reserve(vs.size() + size / 80);
+    ns.reserve(ns.size() + size / 80);
+
+    while (nextToken(p, end, token, length)) {
+        if (length == 6 && memcmp(token, "normal", 6) == 0) {
+            if (!nextTriple(p, end, xyz)) return false;
+            V n = V(xyz[0], xyz[1], xyz[2]);
+            ns.push_back(n); ns.push_back(n); ns.push_back(n);
+        } else if (length == 6 && memcmp(token, "vertex", 6) == 0) {
+            if (!nextTriple(p, end, xyz)) return false;
+            V v = V(xyz[0], xyz[1], xyz[2]);
+            if (scale != 1) v = scale * v;
+            vs.push_back(v);
         }
     }
+    return true;
 }
 
-
-// parseStlASCII(ifstream &text, vector<vec3> &vs, vector<vec3> &ns)
+// parseStlBinary(const char *data, size_t size, float scale, vector<V> &vs, vector<V> &ns)
 //
-// Parses vertex positions and normals from a Qt file in STL (ASCII) format
+// Parses vertex positions and normals from an STL (binary) buffer
+// Facets are fixed size records, decoded in parallel straight into vs and ns
 // See https://en.wikipedia.org/wiki/STL_(file_format)
 //
-void Utils::parseStlASCII(ifstream &text, vector<vec3> &vs, vector<vec3> &ns) {
+template <typename V>
+static bool parseStlBinary(const char *data, size_t size, float scale, vector<V> &vs, vector<V> &ns) {
+
+    uint32_t nfacets;
+    memcpy(&nfacets, data + 80, sizeof(nfacets));
+    if (size < 84 + size_t(nfacets) * 50) return false;
+
+    size_t base = vs.size();
+    vs.resize(base + 3 * size_t(nfacets));
+    ns.resize(base + 3 * size_t(nfacets));
+    const char *facets = data + 84;
+
+    #pragma omp parallel for schedule(static)
+    for (long t = 0; t < long(nfacets); t++) {
+        float f[12]; // Normal then three vertices
+        memcpy(f, facets + 50 * t, sizeof(f));
+
+        V n = V(f[0], f[1], f[2]);
+        V *v = &vs[base + 3 * t];
+        V *vn = &ns[base + 3 * t];
+        for (int k = 0; k < 3; k++) {
+            v[k] = V(f[3 + 3 * k], f[4 + 3 * k], f[5 + 3 * k]);
+            if (scale != 1) v[k] = scale * v[k];
+            vn[k] = n;
+        }
+    }
+    return true;
+}
 
-    qDebug() << "PARSING STL ASCII";
-    vec3 n, v;
-    string sdead;
+// Binary when the facet count in the header matches the file size,
+// some binary exporters also start their header with "solid"
+static bool isStlBinary(const char *data, size_t size) {
+    if (size < 84) return false;
 
-    for (string line; getline(text, line); ) {
+    uint32_t nfacets;
+    memcpy(&nfacets, data + 80, sizeof(nfacets));
+    if (size == 84 + size_t(nfacets) * 50) return true;
 
-        if (left(line, 8).compare("endsolid") == 0) {
-            return;
-        }
+    const char *p = data, *end = data + size;
+    while (p < end && isspace((unsigned char) *p)) p++;
+    return !(end - p >= 5 && memcmp(p, "solid", 5) == 0);
+}
 
-        if (startsWith(trim(line), "facet normal")) {
+template <typename V>
+static bool readStlMapped(const string &path, float scale, vector<V> &vs, vector<V> &ns, double *mbps) {
 
-            istringstream iss(line);
-            if (!(iss >> sdead >> sdead >> n.x >> n.y >> n.z)) {
-                return;
-            }
-            ns.push_back(n); ns.push_back(n); ns.push_back(n);
-        }
+    QElapsedTimer timer;
+    timer.start();
 
-        if (startsWith(trim(line), "vertex")) {
-            istringstream iss(line);
-            if (!(iss >> sdead >> v.x >> v.y >> v.z)) {
-                return;
-            }
-            vs.push_back(v);
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Could not open" << path;
+        return false;
+    }
+
+    auto size = size_t(file.size());
+    const char *data = reinterpret_cast<const char *>(size > 0 ? file.map(0, file.size()) : nullptr);
+
+    // Fall back to a plain read where mapping is not supported
+    QByteArray buffer;
+    if (data == nullptr && size > 0) {
+        buffer = file.readAll();
+        data = buffer.constData();
+    }
+
+    bool ok = false;
+    if (size > 0) {
+        if (isStlBinary(data, size)) {
+            ok = parseStlBinary(data, size, scale, vs, ns);
+        } else {
+            ok = parseStlASCII(data, size, scale, vs, ns);
         }
+    }
 
+    if (buffer.isEmpty() && data != nullptr) {
+        file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(data)));
     }
+    file.close();
 
+    double seconds = std::max(1E-9, timer.nsecsElapsed() * 1E-9);
+    double rate = size / 1E6 / seconds;
+    if (mbps != nullptr) *mbps = rate;
+    qDebug() << "Read" << size / 1E6 << "MB of STL in" << seconds * 1E3 << "ms (" << rate << "MB/s )";
+
+    if (!ok) qDebug() << "Malformed STL" << path;
+    return ok;
 }
 
 
-// parseStlASCII(ifstream &text, vector<Vec> &vs, vector<Vec> &ns)
+// readStl(const string &path, float scale, vector<vec3> &vs, vector<vec3> &ns, double *mbps)
 //
-// Parses vertex positions and normals from a Qt file in STL (ASCII) format
-// See https://en.wikipedia.org/wiki/STL_(file_format)
+// Appends the triangles of an ASCII or binary STL to vs and ns,
+// positions multiplied by scale. The file is memory mapped.
+// Load throughput in MB/s is written to mbps when given.
 //
-void Utils::parseStlASCII(ifstream &text, vector<Vec> &vs, vector<Vec> &ns) {
+bool Utils::readStl(const string &path, float scale, vector<vec3> &vs, vector<vec3> &ns, double *mbps) {
+    return readStlMapped(path, scale, vs, ns, mbps);
+}
 
-    qDebug() << "PARSING STL ASCII";
-    Vec n, v;
-    string sdead;
 
-    for (string line; getline(text, line); ) {
+// readStl(const string &path, float scale, vector<Vec> &vs, vector<Vec> &ns, double *mbps)
+//
+// Appends the triangles of an ASCII or binary STL to vs and ns,
+// positions multiplied by scale. The file is memory mapped.
+// Load throughput in MB/s is written to mbps when given.
+//
+bool Utils::readStl(const string &path, float scale, vector<Vec> &vs, vector<Vec> &ns, double *mbps) {
+    return readStlMapped(path, scale, vs, ns, mbps);
+}
 
-        if (left(line, 8).compare("endsolid") == 0) {
-            return;
-        }
+vec3 Utils::vecToVec3(Vec &vector) {
+   return vec3(vector[0], vector[1], vector[2]);
+}
 
-        if (startsWith(trim(line), "facet normal")) {
 
-            istringstream iss(line);
-            if (!(iss >> sdead >> sdead >> n[0] >> n[1] >> n[2])) {
-                return;
-            }
-            ns.push_back(n); ns.push_back(n); ns.push_back(n);
-        }
+// Key of a vertex in the welding hash: exact float bits, or the
+// integer cell coordinates when welding with a tolerance
+struct WeldKey {
+    int32_t x, y, z;
+    bool operator==(const WeldKey &k) const { return x == k.x && y == k.y && z == k.z; }
+};
 
-        if (startsWith(trim(line), "vertex")) {
-            istringstream iss(line);
-            if (!(iss >> sdead >> v[0] >> v[1] >> v[2])) {
-                return;
-            }
-            vs.push_back(v);
+struct WeldKeyHash {
+    size_t operator()(const WeldKey &k) const {
+        uint64_t h = uint64_t(uint32_t(k.x)) * 0x9E3779B97F4A7C15ULL;
+        h ^= uint64_t(uint32_t(k.y)) * 0xC2B2AE3D27D4EB4FULL + (h << 6) + (h >> 2);
+        h ^= uint64_t(uint32_t(k.z)) * 0x165667B19E3779F9ULL + (h << 6) + (h >> 2);
+        return size_t(h ^ (h >> 32));
+    }
+};
+
+// Exclusive prefix sum in place, blocked over OpenMP threads
+static uint exclusiveScan(vector<uint> &v) {
+    long n = long(v.size());
+    const long block = 1 << 16;
+    long nBlocks = (n + block - 1) / block;
+    vector<uint> sums = vector<uint>(nBlocks + 1, 0);
+
+    #pragma omp parallel for
+    for (long b = 0; b < nBlocks; b++) {
+        uint sum = 0;
+        for (long i = b * block; i < std::min(n, (b + 1) * block); i++) {
+            uint x = v[i];
+            v[i] = sum;
+            sum += x;
         }
+        sums[b + 1] = sum;
+    }
 
+    for (long b = 0; b < nBlocks; b++) {
+        sums[b + 1] += sums[b];
     }
 
+    #pragma omp parallel for
+    for (long b = 1; b < nBlocks; b++) {
+        for (long i = b * block; i < std::min(n, (b + 1) * block); i++) {
+            v[i] += sums[b];
+        }
+    }
+
+    return sums[nBlocks];
 }
 
-// parseStlBinary(ifstream &text, vector<vec3> &vs, vector<vec3> &ns)
+// weldVertices(const vec3 *vs, size_t n, float tolerance, vector<uint> &indices, vector<uint> &firsts)
 //
-// Parses vertex positions and normals from a Qt file in STL (binary) format
-// See https://en.wikipedia.org/wiki/STL_(file_format)
+// Collapses duplicate vertices with a spatial hash.
+// With tolerance 0 only identical positions are merged, otherwise
+// vertices within tolerance of an earlier vertex are merged into it.
+// indices[i] is the collapsed index of vertex i, in order of first
+// occurrence, and firsts[j] is the first vertex of collapsed vertex j.
+// Returns the number of collapsed vertices.
 //
-void Utils::parseStlBinary(ifstream &text, vector<vec3> &vs, vector<vec3> &ns) {
+uint Utils::weldVertices(const vec3 *vs, size_t n, float tolerance, vector<uint> &indices, vector<uint> &firsts) {
 
-    qDebug() << "PARSING STL BINARY";
+    vector<uint> rep = vector<uint>(n);
+    vector<uint> next = vector<uint>(n, UINT32_MAX);
+    unordered_map<WeldKey, uint, WeldKeyHash> heads = unordered_map<WeldKey, uint, WeldKeyHash>();
+    heads.reserve(n);
 
-    STLHEADER header;
-    STLFACET facet;
+    float invCell = (tolerance > 0) ? 1.0f / tolerance : 0.0f;
 
-    char h[80];
-    char nt[4];
-    text.read(h, 80);
-    text.read(nt, 4);
+    // Single pass finding the first vertex each vertex collapses into
+    for (size_t i = 0; i < n; i++) {
+        const vec3 &p = vs[i];
 
-    uint num_triangles = * (long *) nt;
-    qDebug() << num_triangles;
+        if (tolerance <= 0) {
+            vec3 q = p + vec3(0.0f); // Treats -0 as 0
+            WeldKey key;
+            memcpy(&key.x, &q.x, 4);
+            memcpy(&key.y, &q.y, 4);
+            memcpy(&key.z, &q.z, 4);
 
-    //text.read(reinterpret_cast<char *>(&header), sizeof(header));
+            auto found = heads.emplace(key, uint(i));
+            rep[i] = found.first->second;
+            continue;
+        }
 
-    //uint nfacets = * reinterpret_cast<uint *>(header.nfacets);
+        WeldKey cell = {int32_t(floor(p.x * invCell)), int32_t(floor(p.y * invCell)), int32_t(floor(p.z * invCell))};
+
+        // Lowest index within tolerance among the neighboring cells
+        uint match = UINT32_MAX;
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    auto h = heads.find({cell.x + dx, cell.y + dy, cell.z + dz});
+                    if (h == heads.end()) continue;
+
+                    for (uint r = h->second; r != UINT32_MAX; r = next[r]) {
+                        if (r < match && length(vs[r] - p) <= tolerance) {
+                            match = r;
+                        }
+                    }
+                }
+            }
+        }
 
-    for (uint t = 0; t < * (int *) header.nfacets; t++) {
-        text.read(reinterpret_cast<char *>(&facet), 50);
+        if (match != UINT32_MAX) {
+            rep[i] = match;
+        } else {
+            rep[i] = uint(i);
+            auto h = heads.find(cell);
+            if (h == heads.end()) {
+                heads[cell] = uint(i);
+            } else {
+                next[i] = h->second;
+                h->second = uint(i);
+            }
+        }
+    }
 
-        ns.push_back(vec3(facet.nx, facet.ny, facet.nz));
-        ns.push_back(vec3(facet.nx, facet.ny, facet.nz));
-        ns.push_back(vec3(facet.nx, facet.ny, facet.nz));
+    // Compact first occurrences with a prefix sum over the flags
+    vector<uint> slot = vector<uint>(n);
+    long ln = long(n);
 
-        vs.push_back(vec3(facet.x1, facet.y1, facet.z1));
-        vs.push_back(vec3(facet.x2, facet.y2, facet.z2));
-        vs.push_back(vec3(facet.x3, facet.y3, facet.z3));
+    #pragma omp parallel for
+    for (long i = 0; i < ln; i++) {
+        slot[i] = (rep[i] == uint(i)) ? 1 : 0;
     }
-}
-
 
-// parseStlBinary(ifstream &text, vector<Vec> &vs, vector<Vec> &ns)
-//
-// Parses vertex positions and normals from a Qt file in STL (binary) format
-// See https://en.wikipedia.org/wiki/STL_(file_format)
-//
-void Utils::parseStlBinary(ifstream &text, vector<Vec> &vs, vector<Vec> &ns) {
+    uint nUnique = exclusiveScan(slot);
+    indices.resize(n);
+    firsts.resize(nUnique);
 
-    qDebug() << "PARSING STL BINARY";
+    #pragma omp parallel for
+    for (long i = 0; i < ln; i++) {
+        indices[i] = slot[rep[i]];
+        if (rep[i] == uint(i)) {
+            firsts[slot[i]] = uint(i);
+        }
+    }
 
-    STLHEADER header;
-    STLFACET facet;
+    return nUnique;
+}
 
-    char h[80];
-    char nt[4];
-    text.read(h, 80);
-    text.read(nt, 4);
+// averageWelded(const vec3 *ns, const vector<uint> &indices, const vector<uint> &firsts, vector<vec3> &out)
+//
+// Averages the normals of every group of welded vertices.
+// Groups are gathered with a counting sort, then summed in parallel
+// in the order model_data::indexVertices used to accumulate them.
+//
+void Utils::averageWelded(const vec3 *ns, const vector<uint> &indices, const vector<uint> &firsts, vector<vec3> &out) {
 
-    uint num_triangles = * (long *) nt;
-    qDebug() << num_triangles;
+    long nUnique = long(firsts.size());
+    vector<uint> offsets = vector<uint>(nUnique + 1, 0);
+    for (uint j : indices) {
+        offsets[j + 1]++;
+    }
+    for (long j = 0; j < nUnique; j++) {
+        offsets[j + 1] += offsets[j];
+    }
 
-    //text.read(reinterpret_cast<char *>(&header), sizeof(header));
+    vector<uint> members = vector<uint>(indices.size());
+    vector<uint> fill = vector<uint>(offsets.begin(), offsets.end() - 1);
+    for (uint i = 0; i < indices.size(); i++) {
+        members[fill[indices[i]]++] = i;
+    }
 
-    //uint nfacets = * reinterpret_cast<uint *>(header.nfacets);
+    out.resize(nUnique);
 
-    for (uint t = 0; t < * (int *) header.nfacets; t++) {
-        text.read(reinterpret_cast<char *>(&facet), 50);
+    #pragma omp parallel for
+    for (long j = 0; j < nUnique; j++) {
+        uint start = offsets[j];
+        uint count = offsets[j + 1] - start;
 
-        ns.push_back(Vec(facet.nx, facet.ny, facet.nz));
-        ns.push_back(Vec(facet.nx, facet.ny, facet.nz));
-        ns.push_back(Vec(facet.nx, facet.ny, facet.nz));
+        if (count == 1) {
+            out[j] = ns[firsts[j]];
+            continue;
+        }
 
-        vs.push_back(Vec(facet.x1, facet.y1, facet.z1));
-        vs.push_back(Vec(facet.x2, facet.y2, facet.z2));
-        vs.push_back(Vec(facet.x3, facet.y3, facet.z3));
+        // Second occurrence first, then the original, then the rest
+        vec3 average = vec3(0.0f, 0.0f, 0.0f);
+        average += ns[members[start + 1]];
+        average += ns[members[start]];
+        for (uint k = 2; k < count; k++) {
+            average += ns[members[start + k]];
+        }
+        out[j] = (1.0f / count) * average;
     }
 }
-
-vec3 Utils::vecToVec3(Vec &vector) {
-   return vec3(vector[0], vector[1], vector[2]);
-}
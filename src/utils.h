@@ -5,6 +5,7 @@
 #include <fstream>
 #include <sstream>
 #include <random>
+#include <unordered_map>
 
 #include <glm/glm.hpp>
 #include <Titan/sim.h>
@@ -65,11 +66,13 @@ public:
     static void createCube(vec3 center, float edgeLength, vector<vec3> &vs, vector<vec3> &ns);
     static void createModelFromFile(string path, float scale, vector<vec3> &vs, vector<vec3> &ns);
     static void createModelFromFile(string path, float scale, vector<Vec> &vs, vector<Vec> &ns);
-    static void parseStlASCII(ifstream &text, vector<vec3> &vs, vector<vec3> &ns);
-    static void parseStlASCII(ifstream &text, vector<Vec> &vs, vector<Vec> &ns);
-    static void parseStlBinary(ifstream &text, vector<vec3> &vs, vector<vec3> &ns);
-    static void parseStlBinary(ifstream &text, vector<Vec> &vs, vector<Vec> &ns);
+    static bool readStl(const string &path, float scale, vector<vec3> &vs, vector<vec3> &ns, double *mbps = nullptr);
+    static bool readStl(const string &path, float scale, vector<Vec> &vs, vector<Vec> &ns, double *mbps = nullptr);
     static vec3 vecToVec3(Vec &vector);
+
+    // MESH UTILS
+    static uint weldVertices(const vec3 *vs, size_t n, float tolerance, vector<uint> &indices, vector<uint> &firsts);
+    static void averageWelded(const vec3 *ns, const vector<uint> &indices, const vector<uint> &firsts, vector<vec3> &out);
 };
 
 #endif // UTILS_H